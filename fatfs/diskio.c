@@ -12,11 +12,85 @@
 
 #include "supercard_driver.h"
 
+#ifdef SD_CACHE_LINES
+
+#include <stdbool.h>
+#include <string.h>
+#include "compiler.h"
+
+// Small LRU sector cache. FatFs only keeps one window sector per volume, so
+// FAT and directory sectors (always read one by one) are re-read constantly.
+// Single sector reads are served from cache lines of SD_CACHE_LINE_SECTORS
+// sectors, which are filled with a single multi-block read (read-ahead).
+// Multi-sector reads (file data) bypass the cache. Writes are written through
+// and update any cached copy, so the cache never holds dirty data.
+
+#ifndef SD_CACHE_LINE_SECTORS
+  #define SD_CACHE_LINE_SECTORS   4
+#endif
+
+typedef struct {
+  LBA_t sector;        // First sector of the line (~0 if invalid)
+  uint32_t lastuse;    // LRU stamp
+} t_cache_tag;
+
+static t_cache_tag ctags[SD_CACHE_LINES] EWRAM_BSS;
+static uint8_t cdata[SD_CACHE_LINES][SD_CACHE_LINE_SECTORS * 512] EWRAM_BSS;
+static uint32_t cstamp EWRAM_BSS;
+
+static void cache_invalidate(void) {
+  cstamp = 0;
+  for (unsigned i = 0; i < SD_CACHE_LINES; i++) {
+    ctags[i].sector = ~0U;
+    ctags[i].lastuse = 0;
+  }
+}
+
+static bool cache_read(BYTE *buff, LBA_t sector) {
+  const LBA_t lsect = sector - (sector % SD_CACHE_LINE_SECTORS);
+  unsigned l, victim = 0;
+  for (l = 0; l < SD_CACHE_LINES; l++) {
+    if (ctags[l].sector == lsect)
+      break;
+    if (ctags[l].lastuse < ctags[victim].lastuse)
+      victim = l;
+  }
+
+  if (l == SD_CACHE_LINES) {
+    // Miss, fill the least recently used line.
+    l = victim;
+    ctags[l].sector = ~0U;
+    if (sdcard_read_blocks(cdata[l], lsect, SD_CACHE_LINE_SECTORS))
+      return false;
+    ctags[l].sector = lsect;
+  }
+
+  ctags[l].lastuse = ++cstamp;
+  memcpy(buff, &cdata[l][(sector - lsect) * 512], 512);
+  return true;
+}
+
+static void cache_update(const BYTE *buff, LBA_t sector, UINT count) {
+  for (unsigned l = 0; l < SD_CACHE_LINES; l++) {
+    const LBA_t lsect = ctags[l].sector;
+    if (lsect == ~0U)
+      continue;
+    for (unsigned i = 0; i < SD_CACHE_LINE_SECTORS; i++)
+      if (lsect + i >= sector && lsect + i < sector + count)
+        memcpy(&cdata[l][i * 512], &buff[(lsect + i - sector) * 512], 512);
+  }
+}
+
+#endif
+
 DSTATUS disk_status (BYTE pdrv) {
   return 0;
 }
 
 DSTATUS disk_initialize (BYTE pdrv) {
+  #ifdef SD_CACHE_LINES
+  cache_invalidate();
+  #endif
   return 0;
 }
 
@@ -32,6 +106,12 @@ DRESULT disk_read (
 	UINT count		/* Number of sectors to read */
 )
 {
+  #ifdef SD_CACHE_LINES
+  // On cache errors (ie. lines beyond the card end) just read the sector.
+  if (count == 1 && cache_read(buff, sector))
+    return RES_OK;
+  #endif
+
   unsigned err = sdcard_read_blocks(buff, sector, count);
   return err ? RES_ERROR : RES_OK;
 }
@@ -51,6 +131,15 @@ DRESULT disk_write (
 )
 {
   unsigned err = sdcard_write_blocks(buff, sector, count);
+
+  #ifdef SD_CACHE_LINES
+  // Keep cached copies in sync (even on error, the card content is unknown).
+  if (err)
+    cache_invalidate();
+  else
+    cache_update(buff, sector, count);
+  #endif
+
   return err ? RES_ERROR : RES_OK;
 }
 
@@ -136,6 +136,8 @@ en_strings = [
 
   "MSG_LOADER_PREFDS":  "Direct-Save",
   "MSG_LOADER_PREFDSI": "Directly save to SD card (only available for some games)",
+  "MSG_LOADER_PGLOAD":  "Patch on load",
+  "MSG_LOADER_PGLOADI": "Generate missing patches while the ROM loads, instead of reading it twice. Direct-Save is unavailable on that first launch",
 
   "MSG_LOADER_LOADP_I0": "Automatically loads .sav file",
   "MSG_LOADER_LOADP_I1": "Clears memory (start anew)",
@@ -226,6 +228,7 @@ en_strings = [
   "MSG_GOOD_RAM":  "All memory tests passed!",             # alertmsg
 
   "MSG_BENCHSPD":  "Speed: %u KiB/s",
+  "MSG_BENCHLDSPD":"Read %u, load %u (old %u) KiB/s",
   "MSG_CAPACITY":  "Capacity: %s",
   "MSG_DBPINFO":   "Patch database version info",
   }),
@@ -24,6 +24,7 @@
 #include <stddef.h>
 
 #include "emu.h"
+#include "supercard_driver.h"
 
 #define MAX(a, b) ((a > b) ? (a) : (b))
 #define MIN(a, b) ((a < b) ? (a) : (b))
@@ -48,7 +49,8 @@
 
 #define SUPERFW_DIR               "/.superfw"
 #define ROMCONFIG_PATH            "/.superfw/config/"
-#define PATCHDB_PATH              "/.superfw/patches/"
+#define PATCH_CACHE_FILE          "/.superfw/patches.cache"
+#define DIRCACHE_FILEPTRN         "/.superfw/dircache/%08x.bin"
 #define CHEATS_PATH               "/.superfw/cheats/"
 #define EMULATORS_PATH            "/.superfw/emulators/"
 #define GBC_EMULATOR_PATH         "/.superfw/emulators/gbc-emu.gba"
@@ -60,6 +62,8 @@
 
 #define PENDING_SAVE_FILEPATH     "/.superfw/pending-save.txt"
 #define PENDING_SRAM_TEST         "/.superfw/pending-sram-test.txt"
+#define SDBENCH_LOG_FILEPATH      "/.superfw/benchmark.csv"
+#define SDBENCH_TMP_FILEPATH      "/.superfw/benchmark.tmp"
 
 extern const uint8_t  dldi_payload[];
 extern const uint32_t dldi_payload_size;
@@ -83,6 +87,8 @@ extern const uint32_t ingame_trampoline_payload_size;
 #define ROM_OFF_PATCH_DB          0x01D00000     // At 0x09D00000
 #define ROM_OFF_ASSETS_BASE       0x01E00000     // At 0x09E00000
 
+#define PATCH_DB_MAX_SIZE         (ROM_OFF_ASSETS_BASE - ROM_OFF_PATCH_DB)
+
 #define ROM_SCRATCH_U8          ((volatile uint8_t*)(0x08000000 + ROM_OFF_SCRATCH))
 #define ROM_FONTBASE_U8         ((volatile uint8_t*)(0x08000000 + ROM_OFF_FONTS_BASE))
 #define ROM_HISCRATCH_U8        ((volatile uint8_t*)(0x08000000 + ROM_OFF_HISCRATCH))
@@ -220,6 +226,7 @@ typedef struct {
 void menu_init(int);    // Initializes meny system (ie. loading resources)
 void menu_render(unsigned fcnt);     // Renders the menu to the backframe
 void menu_keypress(unsigned newkeys);   // Notifies key press
+void menu_work();       // Does background work (like dir loading) until the frame ends
 void menu_flip();       // Swaps front and back buffer to show the last rendered frame.
 
 // Patching system
@@ -274,7 +281,7 @@ unsigned prepare_sram_based_savegame(t_sram_load_policy loadp, t_sram_save_polic
 unsigned preload_gba_rom(const char *fn, uint32_t fs, t_rom_header *romh);
 // Loads a ROM file and launches it.
 unsigned load_gba_rom(const char *fn, uint32_t fs, const struct struct_t_patch *ptch,
-                      const t_dirsave_info *dsinfo, bool ingame_menu,
+                      bool genpatches, const t_dirsave_info *dsinfo, bool ingame_menu,
                       const t_rtc_info *rtcinfo, unsigned cheats, progress_fn progress);
 // Launch from NOR
 unsigned  flash_gba_nor(const char *fn, uint32_t fs, const t_rom_header *rom_header,
@@ -391,13 +398,27 @@ void flash_erase_fsm_start(t_flash_erase_state *st, uint32_t baseaddr, unsigned
 int flash_erase_fsm_step(t_flash_erase_state *st);
 
 // Test/validation stuff
+#define SDBENCH_SEQ_SIZES     3       // Sequential read request sizes (1, 4, 16 blocks)
+
+typedef struct {
+  unsigned rnd_iops;                  // Random single block reads per second
+  unsigned seq_kbs[SDBENCH_SEQ_SIZES];// Sequential reads (KiB/s)
+  unsigned fwrite_kbs, fread_kbs;     // FatFs f_write/f_read (8KiB requests)
+  unsigned wr_kbs[2];                 // Raw multi-block writes (without/with pre-erase)
+  unsigned dma_kbs;                   // DMA copy to SDRAM
+} t_sdbench_results;
+
 unsigned sram_test();
 int sdram_test(progress_abort_fn progcb);
 void sram_pseudo_fill();
 unsigned sram_pseudo_check();
 int check_peding_sram_test();
 void program_sram_check();
-int sdbench_read(progress_abort_fn progcb);
+int sdbench_run(t_sdbench_results *res, uint32_t card_blocks,
+                uint8_t *dst, unsigned maxsize, progress_abort_fn progcb);
+bool sdbench_save_log(const t_sdbench_results *res, const t_card_info *card);
+int sdbench_load(const char *fn, uint8_t *dst, unsigned maxsize, bool batched, progress_abort_fn progcb);
+unsigned frames_ms(unsigned frames);
 
 #endif
 
@@ -21,9 +21,12 @@
 #ifdef __GBA__
   #define ARM_CODE   __attribute__((target("arm")))
   #define IWRAM_CODE __attribute__((section(".iwram_code"), long_call))
+  // Big buffers can be placed in EWRAM (note: this is not zeroed on boot!)
+  #define EWRAM_BSS  __attribute__((section(".sbss")))
 #else
   #define ARM_CODE
   #define IWRAM_CODE
+  #define EWRAM_BSS
 #endif
 
 #define NOINLINE __attribute__((noinline))
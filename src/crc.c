@@ -329,4 +329,32 @@ void crc16_nibble_512_nolut(const uint8_t *buf, uint8_t *crcout) {
   }
 }
 
+// Same as the no-LUT version, but the 64 bit state is kept in two 32 bit words
+// (no 64 bit shifts, which are expensive on ARM7) and the loop is unrolled.
+// Used to verify SD reads, so it must be fast enough to keep up with them.
+// The performance is ~2.5 cycles per byte, which is roughly 0.08ms per block.
+
+ARM_CODE IWRAM_CODE NOINLINE
+void crc16_nibble_512_fast(const uint8_t *buf, uint8_t *crcout) {
+  if (((uintptr_t)buf) & 3) {
+    crc16_nibble_512_nolut8bit(buf, crcout);
+    return;
+  }
+
+  const uint32_t *buf32 = (const uint32_t*)buf;
+  uint32_t hi = 0, lo = 0;
+  for (unsigned i = 0; i < 512 / 16; i++) {
+    #pragma GCC unroll 4
+    for (unsigned j = 0; j < 4; j++) {
+      uint32_t lf = hi ^ read32be(*buf32++);
+      lf ^= lf >> 16;        // Propagate overlapping bits
+      hi = lo ^ (lf >> 12) ^ (lf << 16);
+      lo = lf ^ (lf << 20);
+    }
+  }
+  for (int i = 0; i < 4; i++) {
+    crcout[i]     = hi >> ((3-i) * 8);
+    crcout[i + 4] = lo >> ((3-i) * 8);
+  }
+}
 
@@ -30,6 +30,7 @@ void crc16_nibble_512_nolut(const uint8_t *buf, uint8_t *crcout);
 void crc16_nibble_512_nolut8bit(const uint8_t *buf, uint8_t *crcout);
 void crc16_nibble_512_nolutw(const uint8_t *buf, uint8_t *crcout);
 void crc16_nibble_512_8bit(const uint8_t *buf, uint8_t *crcout);
+void crc16_nibble_512_fast(const uint8_t *buf, uint8_t *crcout);
 
 
 #endif
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "dircache.h"
+#include "fileextent.h"
+#include "fatfs/diskio.h"
+#include "common.h"
+#include "util.h"
+#include "nanoprintf.h"
+
+// Cache file layout: header (one sector), entries (sector padded), arena.
+// The header is written last, so that partially written files are rejected.
+
+#define DIRCACHE_SIGNATURE    "SUPERFWDCACHE01"
+#define DIRCACHE_VERSION      2
+#define DIRCACHE_HDR_SIZE     512
+#define FNV_PRIME             0x01000193
+#define FNV_BASIS             0x811C9DC5
+
+#define ALIGN512(x) (((x) + 511) & ~511U)
+
+typedef struct {
+  char signature[16];
+  uint32_t version;
+  uint32_t count;           // Number of entries
+  uint32_t arena_used;      // Arena size (bytes)
+  t_dirsig sig;             // Directory signature at the time of caching
+  char path[MAX_FN_LEN];    // Directory path (to detect file name collisions)
+  uint8_t reserved[216];
+} t_dircache_header;
+
+_Static_assert(sizeof(t_dircache_header) == DIRCACHE_HDR_SIZE, "Bad cache header size");
+
+static uint32_t path_hash(const char *s) {
+  uint32_t h = FNV_BASIS;
+  while (*s)
+    h = (h ^ (uint8_t)*s++) * FNV_PRIME;
+  return h;
+}
+
+static void cache_filename(char *fn, unsigned maxlen, const char *path) {
+  npf_snprintf(fn, maxlen, DIRCACHE_FILEPTRN, (unsigned)path_hash(path));
+}
+
+typedef struct {
+  uint8_t pdrv;
+  uint8_t *buf;
+  t_dirsig *sig;
+} t_sigstate;
+
+static bool hash_run(uint32_t sector, uint32_t count, void *arg) {
+  t_sigstate *st = (t_sigstate*)arg;
+  if (RES_OK != disk_read(st->pdrv, st->buf, sector, count))
+    return false;
+
+  // FNV-1a, but word based (directory data is small, but must be cheap)
+  uint32_t h = st->sig->hash;
+  const uint32_t *p = (uint32_t*)st->buf;
+  for (unsigned i = 0; i < count * 512 / sizeof(uint32_t); i++)
+    h = (h ^ p[i]) * FNV_PRIME;
+  st->sig->hash = h;
+  st->sig->size += count * 512;
+  return true;
+}
+
+bool dircache_signature(const DIR *d, uint8_t *buf, unsigned bufsize, t_dirsig *sig) {
+  t_sigstate st = { .pdrv = d->obj.fs->pdrv, .buf = buf, .sig = sig };
+  sig->sclust = d->obj.sclust;
+  sig->size = 0;
+  sig->hash = FNV_BASIS;
+  return fext_walk_dir(d, bufsize / 512, hash_run, &st);
+}
+
+static bool valid_header(const t_dircache_header *hdr, const char *path, const t_dirsig *sig) {
+  return !memcmp(hdr->signature, DIRCACHE_SIGNATURE, sizeof(hdr->signature)) &&
+         hdr->version == DIRCACHE_VERSION &&
+         hdr->count <= DIRLIST_MAX_ENTRIES && hdr->arena_used <= DIRLIST_ARENA_SIZE &&
+         !memcmp(&hdr->sig, sig, sizeof(*sig)) &&
+         !strncmp(hdr->path, path, sizeof(hdr->path));
+}
+
+bool dircache_probe(const char *path) {
+  char fn[64];
+  cache_filename(fn, sizeof(fn), path);
+
+  FIL fd;
+  if (FR_OK != f_open(&fd, fn, FA_READ))
+    return false;
+
+  t_dircache_header hdr;
+  UINT rdbytes;
+  bool ret = FR_OK == f_read(&fd, &hdr, sizeof(hdr), &rdbytes) && rdbytes == sizeof(hdr) &&
+             !memcmp(hdr.signature, DIRCACHE_SIGNATURE, sizeof(hdr.signature)) &&
+             !strncmp(hdr.path, path, sizeof(hdr.path));
+  f_close(&fd);
+  return ret;
+}
+
+bool dircache_load(const char *path, const t_dirsig *sig, t_dirlist *dl) {
+  char fn[64];
+  cache_filename(fn, sizeof(fn), path);
+
+  FIL fd;
+  if (FR_OK != f_open(&fd, fn, FA_READ))
+    return false;
+
+  bool ret = false;
+  t_dircache_header hdr;
+  UINT rdbytes;
+  if (FR_OK == f_read(&fd, &hdr, sizeof(hdr), &rdbytes) && rdbytes == sizeof(hdr) &&
+      valid_header(&hdr, path, sig)) {
+
+    // Entries and names are read straight into place, in big chunks.
+    const uint32_t esize = hdr.count * sizeof(t_dirent);
+    const uint32_t aoff = DIRCACHE_HDR_SIZE + ALIGN512(esize);
+    t_file_extents fe;
+    fext_map(&fe, &fd);
+    if (FR_OK == fext_read(&fe, DIRCACHE_HDR_SIZE, dl->entries, esize, &rdbytes) && rdbytes == esize &&
+        FR_OK == fext_read(&fe, aoff, dl->arena, hdr.arena_used, &rdbytes) && rdbytes == hdr.arena_used) {
+
+      // Do not trust offsets blindly, a bad entry could point anywhere.
+      ret = true;
+      for (unsigned i = 0; i < hdr.count && ret; i++)
+        ret = dl->entries[i].name + dl->entries[i].keyoff < hdr.arena_used;
+
+      dl->count = ret ? hdr.count : 0;
+      dl->arena_used = ret ? hdr.arena_used : 0;
+      dl->visible = 0;
+      dl->merged = 0;
+    }
+  }
+
+  f_close(&fd);
+  return ret;
+}
+
+bool dircache_save(const char *path, const t_dirsig *sig, const t_dirlist *dl) {
+  char fn[64];
+  cache_filename(fn, sizeof(fn), path);
+  create_basepath(fn);
+
+  FIL fd;
+  if (FR_OK != f_open(&fd, fn, FA_WRITE | FA_CREATE_ALWAYS))
+    return false;
+
+  // Allocate it contiguously if possible, so it can be loaded in one go.
+  const uint32_t esize = dl->count * sizeof(t_dirent);
+  const uint32_t aoff = DIRCACHE_HDR_SIZE + ALIGN512(esize);
+  f_expand(&fd, aoff + dl->arena_used, 1);
+
+  // Blank the header first, preallocated clusters might hold an old one.
+  t_dircache_header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  UINT wrbytes;
+  bool ret =
+    FR_OK == f_write(&fd, &hdr, sizeof(hdr), &wrbytes) && wrbytes == sizeof(hdr) &&
+    FR_OK == f_sync(&fd) &&
+    FR_OK == f_write(&fd, dl->entries, esize, &wrbytes) && wrbytes == esize &&
+    FR_OK == f_lseek(&fd, aoff) &&
+    FR_OK == f_write(&fd, dl->arena, dl->arena_used, &wrbytes) && wrbytes == dl->arena_used &&
+    FR_OK == f_sync(&fd);
+
+  if (ret) {
+    memcpy(hdr.signature, DIRCACHE_SIGNATURE, sizeof(hdr.signature));
+    hdr.version = DIRCACHE_VERSION;
+    hdr.count = dl->count;
+    hdr.arena_used = dl->arena_used;
+    hdr.sig = *sig;
+    strncpy(hdr.path, path, sizeof(hdr.path) - 1);
+    ret = FR_OK == f_lseek(&fd, 0) &&
+          FR_OK == f_write(&fd, &hdr, sizeof(hdr), &wrbytes) && wrbytes == sizeof(hdr);
+  }
+
+  f_close(&fd);
+  return ret;
+}
+
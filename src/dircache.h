@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DIRCACHE_H_
+#define _DIRCACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dirlist.h"
+#include "fatfs/ff.h"
+
+// Persistent directory listing cache. Sorted listings are stored in a file
+// per directory, and are only used if the raw directory data is unchanged.
+
+#define DIRCACHE_MIN_ENTRIES     128     // Smaller dirs are quick to list
+
+typedef struct {
+  uint32_t sclust;        // Directory start cluster
+  uint32_t size;          // Directory size (bytes)
+  uint32_t hash;          // Raw directory contents hash
+} t_dirsig;
+
+// Calculates the directory signature, using `buf` to read its data.
+bool dircache_signature(const DIR *d, uint8_t *buf, unsigned bufsize, t_dirsig *sig);
+
+// Checks whether there is a cache file for the path (without validating it),
+// so that the signature is only calculated if it can be of any use.
+bool dircache_probe(const char *path);
+
+// Loads a cached (sorted) listing, only if the signature matches.
+bool dircache_load(const char *path, const t_dirsig *sig, t_dirlist *dl);
+
+// Writes the sorted listing to the cache.
+bool dircache_save(const char *path, const t_dirsig *sig, const t_dirlist *dl);
+
+#endif
+
@@ -33,6 +33,10 @@
 #define DIRSAV_CFG_ISSDHC_OFF          22
 #define DIRSAV_CFG_MUTEX_OFF           23
 
+// Driver flags (stored in drv_issdhc)
+#define DIRSAV_DRV_SDHC                0x01
+#define DIRSAV_DRV_CMD23               0x02
+
 #ifndef __ASSEMBLER__
 
 // Config: loaded on every load to SRAM, can change (ie. SD sector).
@@ -43,7 +47,7 @@ typedef struct {
   uint32_t memory_size;                // Memory size in bytes the game declared.
   uint32_t base_sector;                // Sector number where the contiguous save file lives.
   uint16_t drv_rca;                    // SD card RCA id (16 bit)
-  uint8_t  drv_issdhc;                 // Boolean (is SDHC card)
+  uint8_t  drv_issdhc;                 // Driver flags (SDHC card, CMD23 support)
   uint8_t  sd_mutex;                   // Mutex value (set to one when DS is using the SD card)
 } t_dirsave_config;
 
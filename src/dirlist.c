@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "dirlist.h"
+#include "common.h"
+#include "utf_util.h"
+#include "fatfs/ff.h"
+
+#define ALIGN2(x) (((x) + 1) & ~1U)
+
+void dirlist_reset(t_dirlist *dl) {
+  dl->count = 0;
+  dl->visible = 0;
+  dl->arena_used = 0;
+  dl->merged = 0;
+  dl->recoff = 0;
+}
+
+bool dirlist_add(t_dirlist *dl, const char *name, uint32_t filesize, unsigned attr) {
+  if (dl->count >= DIRLIST_MAX_ENTRIES)
+    return false;
+
+  // The sort key is at most one u16 per name byte (plus terminator).
+  unsigned nlen = strlen(name) + 1;
+  unsigned keyoff = ALIGN2(nlen);
+  if (dl->arena_used + keyoff + nlen * sizeof(uint16_t) > DIRLIST_ARENA_SIZE)
+    return false;
+
+  t_dirent *e = &dl->entries[dl->count++];
+  e->filesize = filesize;
+  e->name = dl->arena_used;
+  e->keyoff = keyoff;
+  e->attr = attr;
+
+  char *dst = (char*)&dl->arena[e->name];
+  memcpy(dst, name, nlen);
+  unsigned klen = sortable_utf8_u16(name, (uint16_t*)&dst[keyoff]);
+  dl->arena_used += keyoff + (klen + 1) * sizeof(uint16_t);
+  return true;
+}
+
+static int strcmp16(const uint16_t *a, const uint16_t *b) {
+  while (*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a - *b;
+}
+
+// Sort records carry a packed key prefix: a group byte followed by the first
+// 7 key chars (one byte each). Wide chars (>= 0xFF) and anything after them
+// become 0xFF, so that prefixes compare just like the full keys do, and only
+// equal prefixes need to look at the keys.
+_Static_assert (DIRLIST_SORTBUF_SIZE >= 2 * DIRLIST_MAX_ENTRIES * sizeof(t_sortrec),
+                "Sort buffer too small");
+
+void sortrec_init(t_sortrec *r, const uint16_t *key, unsigned group, unsigned idx) {
+  uint8_t p[8];
+  p[0] = group;
+  for (unsigned i = 1; i < 8; i++) {
+    unsigned c = *key;
+    if (c >= 0xFF) {
+      memset(&p[i], 0xFF, 8 - i);
+      break;
+    }
+    p[i] = c;
+    if (c)
+      key++;
+  }
+  r->hi = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+  r->lo = (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+  r->idx = idx;
+}
+
+static inline bool sortrec_le(const t_sortrec *a, const t_sortrec *b, t_sortkey_fn getkey, const void *ctx) {
+  if (a->hi != b->hi)
+    return a->hi < b->hi;
+  if (a->lo != b->lo)
+    return a->lo < b->lo;
+
+  // Same prefix: keys are identical if they ended within the prefix,
+  // otherwise compare them (the 7 prefix chars can be skipped if not wide).
+  const unsigned last = a->lo & 0xFF;
+  if (!last)
+    return true;
+  const unsigned skip = last == 0xFF ? 0 : 7;
+  return strcmp16(getkey(a->idx, ctx) + skip, getkey(b->idx, ctx) + skip) <= 0;
+}
+
+// Bottom-up merge sort (stable), all memory accesses are sequential.
+t_sortrec *sortrec_sort(t_sortrec *src, t_sortrec *tmp, unsigned n, t_sortkey_fn getkey, const void *ctx) {
+  for (unsigned width = 1; width < n; width *= 2) {
+    for (unsigned lo = 0; lo < n; lo += 2 * width) {
+      unsigned mid = MIN(lo + width, n), hi = MIN(lo + 2 * width, n);
+      unsigned i = lo, j = mid, o = lo;
+
+      // Already ordered runs (quite common) are just copied over.
+      if (mid < hi && !sortrec_le(&src[mid - 1], &src[mid], getkey, ctx)) {
+        while (i < mid && j < hi) {
+          if (sortrec_le(&src[i], &src[j], getkey, ctx))
+            tmp[o++] = src[i++];
+          else
+            tmp[o++] = src[j++];
+        }
+      }
+      while (i < mid)
+        tmp[o++] = src[i++];
+      while (j < hi)
+        tmp[o++] = src[j++];
+    }
+
+    t_sortrec *t = src;
+    src = tmp;
+    tmp = t;
+  }
+  return src;
+}
+
+static const uint16_t *dirent_key(unsigned idx, const void *ctx) {
+  const t_dirlist *dl = (const t_dirlist*)ctx;
+  return dirlist_key(dl, &dl->entries[idx]);
+}
+
+void dirlist_merge(t_dirlist *dl, void *tmpbuf) {
+  // Sorted records live in one half of the buffer, the merge goes to the other.
+  t_sortrec *buf = (t_sortrec*)tmpbuf;
+  t_sortrec *cur = &buf[dl->recoff];
+  t_sortrec *out = &buf[dl->recoff ^ DIRLIST_MAX_ENTRIES];
+  const unsigned m = dl->merged, n = dl->count - m;
+  if (!n)
+    return;
+
+  for (unsigned i = m; i < dl->count; i++) {
+    // Directories come up first.
+    const t_dirent *e = &dl->entries[i];
+    sortrec_init(&cur[i], dirlist_key(dl, e), (e->attr & AM_DIR) ? 0 : 1, i);
+  }
+  const t_sortrec *pend = sortrec_sort(&cur[m], &out[m], n, dirent_key, dl);
+
+  // The new records might already be in the output half, that is fine since
+  // they are always read ahead of the output position (and stay in place).
+  unsigned i = 0, j = 0, o = 0;
+  while (i < m && j < n) {
+    if (sortrec_le(&cur[i], &pend[j], dirent_key, dl))
+      out[o++] = cur[i++];
+    else
+      out[o++] = pend[j++];
+  }
+  while (i < m)
+    out[o++] = cur[i++];
+  if (pend != &out[m]) {
+    while (j < n)
+      out[o++] = pend[j++];
+  }
+
+  dl->merged = dl->count;
+  dl->recoff ^= DIRLIST_MAX_ENTRIES;
+}
+
+// Fills the jump index from the order table (which is sorted).
+static void dirlist_index(t_dirlist *dl) {
+  uint32_t *jumps = &dl->jumps[0][0];
+  unsigned s = 0;
+  for (unsigned i = 0; i < dl->visible; i++) {
+    const t_dirent *e = &dl->entries[dl->order[i]];
+    const unsigned es = ((e->attr & AM_DIR) ? 0 : DIRLIST_JUMP_BUCKETS + 1) +
+                        dirlist_bucket(*dirlist_key(dl, e));
+    while (s <= es)
+      jumps[s++] = i;
+  }
+  while (s < 2 * (DIRLIST_JUMP_BUCKETS + 1))
+    jumps[s++] = dl->visible;
+}
+
+static bool key_startswith(const uint16_t *key, const uint16_t *prefix) {
+  while (*prefix && *key == *prefix) {
+    key++;
+    prefix++;
+  }
+  return !*prefix;
+}
+
+int dirlist_seek(const t_dirlist *dl, const uint16_t *prefix) {
+  const unsigned b = dirlist_bucket(*prefix);
+  for (unsigned g = 0; g < 2; g++) {
+    // Lower bound of the prefix, within the bucket.
+    unsigned lo = dl->jumps[g][b], hi = dl->jumps[g][b + 1];
+    while (lo < hi) {
+      const unsigned mid = (lo + hi) / 2;
+      if (strcmp16(dirlist_key(dl, &dl->entries[dl->order[mid]]), prefix) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo < dl->jumps[g][b + 1] && key_startswith(dirlist_key(dl, &dl->entries[dl->order[lo]]), prefix))
+      return lo;
+  }
+  return -1;
+}
+
+void dirlist_view(t_dirlist *dl, const void *tmpbuf, bool hide_hidden) {
+  const t_sortrec *recs = &((const t_sortrec*)tmpbuf)[dl->recoff];
+  unsigned cnt = 0;
+  for (unsigned i = 0; i < dl->merged; i++) {
+    unsigned idx = recs[i].idx;
+    if ((dl->entries[idx].attr & AM_HID) && hide_hidden)
+      continue;
+    dl->order[cnt++] = idx;
+  }
+  dl->visible = cnt;
+  dirlist_index(dl);
+}
+
+void dirlist_sort(t_dirlist *dl, void *tmpbuf) {
+  // Sort records first, then apply the permutation to the entries.
+  dirlist_merge(dl, tmpbuf);
+  const t_sortrec *sorted = &((const t_sortrec*)tmpbuf)[dl->recoff];
+  for (unsigned i = 0; i < dl->count; i++)
+    dl->order[i] = sorted[i].idx;
+
+  // Follow the permutation cycles, so that each entry is moved only once.
+  for (unsigned i = 0; i < dl->count; i++) {
+    if (dl->order[i] == i)
+      continue;
+    t_dirent tmp = dl->entries[i];
+    unsigned j = i;
+    while (dl->order[j] != i) {
+      unsigned next = dl->order[j];
+      dl->entries[j] = dl->entries[next];
+      dl->order[j] = j;
+      j = next;
+    }
+    dl->entries[j] = tmp;
+    dl->order[j] = j;
+  }
+
+  // Records point to the old entry slots now.
+  dl->merged = 0;
+  dl->recoff = 0;
+}
+
+void dirlist_filter(t_dirlist *dl, bool hide_hidden) {
+  unsigned cnt = 0;
+  for (unsigned i = 0; i < dl->count; i++) {
+    if ((dl->entries[i].attr & AM_HID) && hide_hidden)
+      continue;
+    dl->order[cnt++] = i;
+  }
+  dl->visible = cnt;
+  dirlist_index(dl);
+}
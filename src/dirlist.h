@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DIRLIST_H_
+#define _DIRLIST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Directory listing store, used by the file browser. Entries are small fixed
+// size records, their names (utf-8) and sort keys (u16) are packed in a
+// string arena, so that memory usage depends on the actual name lengths.
+
+#define DIRLIST_MAX_ENTRIES    (64*1024)
+#define DIRLIST_ARENA_SIZE     (10*1024*1024)
+#define DIRLIST_SORTBUF_SIZE   (DIRLIST_MAX_ENTRIES * 24)   // Temp buffer for sorting
+#define DIRLIST_JUMP_BUCKETS   28     // Key initials: symbols/digits, 'a' to 'z', others
+
+typedef struct {
+  uint32_t filesize;
+  uint32_t name;            // Arena offset of the name (NULL terminated)
+  uint16_t keyoff;          // Sort key offset (from the name, u16 aligned)
+  uint16_t attr;            // FatFs attributes (AM_DIR, AM_HID...)
+} t_dirent;
+
+typedef struct {
+  uint32_t count;                         // Number of entries
+  uint32_t arena_used;                    // Bytes used in the arena
+  uint32_t visible;                       // Entries in the order table
+  uint32_t merged;                        // Entries in the sorted records
+  uint32_t recoff;                        // Sorted records (sort buffer offset)
+  uint32_t order[DIRLIST_MAX_ENTRIES];    // Visible (filtered) entry indices
+  // Jump index: first visible entry for each group (dirs, files) and key
+  // initial bucket. The last slot is the end of the group.
+  uint32_t jumps[2][DIRLIST_JUMP_BUCKETS + 1];
+  t_dirent entries[DIRLIST_MAX_ENTRIES];
+  uint8_t arena[DIRLIST_ARENA_SIZE];
+} t_dirlist;
+
+_Static_assert (sizeof(t_dirent) == 12, "t_dirent must be 12 bytes");
+
+// Sort records: a packed prefix of the sort key plus an index, so that most
+// comparisons are resolved without reading the keys (nor moving any entries).
+typedef struct {
+  uint32_t hi, lo;          // Group byte and the first key chars
+  uint32_t idx;             // Entry index
+} t_sortrec;
+
+typedef const uint16_t *(*t_sortkey_fn)(unsigned idx, const void *ctx);
+
+// Groups are sorted first (lower first), then by key.
+void sortrec_init(t_sortrec *r, const uint16_t *key, unsigned group, unsigned idx);
+
+// Sorts `n` records, `tmp` must also hold `n` records. The key callback is
+// only used for records with equal prefixes. Returns the sorted buffer.
+t_sortrec *sortrec_sort(t_sortrec *src, t_sortrec *tmp, unsigned n, t_sortkey_fn getkey, const void *ctx);
+
+void dirlist_reset(t_dirlist *dl);
+
+// Adds an entry, returns false if the store is full.
+bool dirlist_add(t_dirlist *dl, const char *name, uint32_t filesize, unsigned attr);
+
+// Sorts the entries (directories first, then by sort key). Entries are
+// reordered in place, so that sorted lists can be stored and reloaded as is.
+// Needs a word aligned temporary buffer (DIRLIST_SORTBUF_SIZE bytes).
+void dirlist_sort(t_dirlist *dl, void *tmpbuf);
+
+// Progressive sorting, so that lists can be shown while still being filled.
+// Merges the entries added since the last call into the sorted records,
+// which live in `tmpbuf` (it must be preserved until dirlist_sort is called).
+void dirlist_merge(t_dirlist *dl, void *tmpbuf);
+
+// Builds the order table from the merged entries (without moving them).
+void dirlist_view(t_dirlist *dl, const void *tmpbuf, bool hide_hidden);
+
+// Builds the order table (visible entries) from the sorted entries.
+void dirlist_filter(t_dirlist *dl, bool hide_hidden);
+
+// Both dirlist_view and dirlist_filter build the jump index too, so that
+// visible entries can be looked up by key prefix (binary search within the
+// initial's bucket). Returns the first visible entry (directories first)
+// whose key starts with `prefix`, or -1 if there is none.
+int dirlist_seek(const t_dirlist *dl, const uint16_t *prefix);
+
+// Key initial bucket (as used in the jump index).
+static inline unsigned dirlist_bucket(uint16_t c) {
+  return c < 'a' ? 0 : c <= 'z' ? c - 'a' + 1 : DIRLIST_JUMP_BUCKETS - 1;
+}
+
+static inline t_dirent *dirlist_get(t_dirlist *dl, unsigned n) {
+  return &dl->entries[dl->order[n]];
+}
+
+static inline const char *dirlist_name(const t_dirlist *dl, const t_dirent *e) {
+  return (const char*)&dl->arena[e->name];
+}
+
+static inline const uint16_t *dirlist_key(const t_dirlist *dl, const t_dirent *e) {
+  return (const uint16_t*)&dl->arena[e->name + e->keyoff];
+}
+
+#endif
+
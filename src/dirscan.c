@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "dirscan.h"
+#include "fatfs/diskio.h"
+#include "common.h"
+
+// Entry parsing follows FatFs (dir_read and get_fileinfo) closely, so that
+// listings are identical (names, attributes and sizes).
+
+#define SECTOR_SIZE     512
+#define SZDIRE          32
+
+#define MAX_DIR         0x200000     // Max size of FAT directories
+#define MAX_DIR_EX      0x10000000   // Max size of exFAT directories
+
+#define DDEM            0xE5         // Deleted entry mark
+#define RDDEM           0x05         // Replacement for names starting with DDEM
+#define LLEF            0x40         // Last LFN entry flag
+#define AM_VOL          0x08
+#define AM_LFN          0x0F
+#define AM_MASK         0x3F
+#define AM_MASKX        0x37
+#define NS_BODY         0x08         // Lower case flags (body and extension)
+#define NS_EXT          0x10
+
+#define ET_FILEDIR      0x85         // exFAT entry types
+#define ET_STREAM       0xC0
+#define ET_FILENAME     0xC1
+
+#define SFN_BUF         12           // FF_SFN_BUF
+#define LFN_BUF         255          // FF_LFN_BUF
+
+#define is_surrogate(c) ((c) >= 0xD800 && (c) <= 0xDFFF)
+
+static const uint8_t lfn_offs[] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+
+static inline uint16_t ld16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t ld32(const uint8_t *p) {
+  return ld16(p) | (ld16(&p[2]) << 16);
+}
+
+// Encodes a UTF-16 char (or surrogate pair) in UTF-8, as FatFs does.
+// Returns zero on buffer overflow or bad encoding.
+static unsigned put_utf8(uint32_t chr, char *buf, unsigned szb) {
+  if (chr < 0x80) {
+    if (szb < 1)
+      return 0;
+    buf[0] = chr;
+    return 1;
+  }
+  if (chr < 0x800) {
+    if (szb < 2)
+      return 0;
+    buf[0] = 0xC0 | (chr >> 6 & 0x1F);
+    buf[1] = 0x80 | (chr & 0x3F);
+    return 2;
+  }
+  if (chr < 0x10000) {
+    if (szb < 3 || is_surrogate(chr))
+      return 0;
+    buf[0] = 0xE0 | (chr >> 12 & 0x0F);
+    buf[1] = 0x80 | (chr >> 6 & 0x3F);
+    buf[2] = 0x80 | (chr & 0x3F);
+    return 3;
+  }
+  if (szb < 4)
+    return 0;
+  uint32_t hc = ((chr & 0xFFFF0000) - 0xD8000000) >> 6;
+  chr = (chr & 0xFFFF) - 0xDC00;
+  if (hc >= 0x100000 || chr >= 0x400)
+    return 0;
+  chr = (hc | chr) + 0x10000;
+  buf[0] = 0xF0 | (chr >> 18 & 0x07);
+  buf[1] = 0x80 | (chr >> 12 & 0x3F);
+  buf[2] = 0x80 | (chr >> 6 & 0x3F);
+  buf[3] = 0x80 | (chr & 0x3F);
+  return 4;
+}
+
+// Converts `n` UTF-16 chars (stops at NULL), returns zero if invalid.
+static unsigned utf16_to_utf8(const uint16_t *s, unsigned n, char *out) {
+  unsigned di = 0;
+  uint16_t hs = 0;
+  for (unsigned i = 0; i < n && s[i]; i++) {
+    if (!hs && is_surrogate(s[i])) {
+      hs = s[i];
+      continue;
+    }
+    unsigned nw = put_utf8(((uint32_t)hs << 16) | s[i], &out[di], LFN_BUF - di);
+    if (!nw)
+      return 0;
+    di += nw;
+    hs = 0;
+  }
+  if (hs)
+    return 0;
+  out[di] = 0;
+  return di;
+}
+
+static uint8_t sum_sfn(const uint8_t *e) {
+  uint8_t sum = 0;
+  for (unsigned i = 0; i < 11; i++)
+    sum = (sum >> 1) + (sum << 7) + e[i];
+  return sum;
+}
+
+// Picks the LFN chars from an LFN entry, returns false if invalid.
+static bool pick_lfn(uint16_t *lfn, const uint8_t *e) {
+  if (ld16(&e[26]))
+    return false;
+
+  unsigned i = ((e[0] & ~LLEF) - 1) * 13;
+  uint16_t wc = 1;
+  for (unsigned s = 0; s < 13; s++) {
+    uint16_t uc = ld16(&e[lfn_offs[s]]);
+    if (wc) {
+      if (i >= FF_MAX_LFN + 1)
+        return false;
+      lfn[i++] = wc = uc;
+    }
+    else if (uc != 0xFFFF)
+      return false;
+  }
+
+  if ((e[0] & LLEF) && wc) {
+    if (i >= FF_MAX_LFN + 1)
+      return false;
+    lfn[i] = 0;
+  }
+  return true;
+}
+
+// Builds the name from the SFN entry (with its case flags).
+static void sfn_name(const uint8_t *e, char *out) {
+  unsigned di = 0;
+  for (unsigned si = 0; si < 11; ) {
+    uint16_t wc = e[si++];
+    if (wc == ' ')
+      continue;
+    if (wc == RDDEM)
+      wc = DDEM;
+    if (si == 9 && di < SFN_BUF)
+      out[di++] = '.';
+    wc = ff_oem2uni(wc, FF_CODE_PAGE);
+    unsigned nw = wc ? put_utf8(wc, &out[di], SFN_BUF - di) : 0;
+    if (!nw) {
+      di = 0;
+      break;
+    }
+    di += nw;
+  }
+
+  if (!di)
+    out[di++] = '?';
+  else {
+    uint8_t lcf = NS_BODY;
+    for (unsigned i = 0; i < di; i++) {
+      if (out[i] == '.')
+        lcf = NS_EXT;
+      if (out[i] >= 'A' && out[i] <= 'Z' && (e[12] & lcf))
+        out[i] += 0x20;
+    }
+  }
+  out[di] = 0;
+}
+
+// Parses a FAT entry, returns false at the end of the directory.
+static bool parse_fat(t_dirscan *ds, const uint8_t *e, t_dirlist *dl) {
+  uint8_t b = e[0];
+  if (!b)
+    return false;
+
+  const unsigned attr = e[11] & AM_MASK;
+  if (b == DDEM || b == '.' || (attr & ~AM_ARC) == AM_VOL) {
+    ds->ord = 0xFF;
+    return true;
+  }
+
+  if (attr == AM_LFN) {
+    if (b & LLEF) {
+      ds->sum = e[13];
+      b &= ~LLEF;
+      ds->ord = b;
+    }
+    ds->ord = (b == ds->ord && ds->sum == e[13] && pick_lfn(ds->lfn, e)) ? ds->ord - 1 : 0xFF;
+    return true;
+  }
+
+  // SFN entry, use the LFN if it is valid and converts fine.
+  char name[LFN_BUF + 1];
+  const bool haslfn = !ds->ord && ds->sum == sum_sfn(e);
+  ds->ord = 0xFF;
+  if (!haslfn || !utf16_to_utf8(ds->lfn, FF_MAX_LFN + 1, name))
+    sfn_name(e, name);
+
+  return dirlist_add(dl, name, ld32(&e[28]), attr);
+}
+
+static uint16_t xdir_sum(const uint8_t *set) {
+  const unsigned szblk = (set[1] + 1) * SZDIRE;
+  uint16_t sum = 0;
+  for (unsigned i = 0; i < szblk; i++) {
+    if (i == 2)
+      i++;      // Skip the checksum field
+    else
+      sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + set[i];
+  }
+  return sum;
+}
+
+// Emits the entry for a complete exFAT entry set.
+static bool emit_xset(t_dirscan *ds, t_dirlist *dl) {
+  const uint8_t *set = ds->set;
+  if (xdir_sum(set) != ld16(&set[2])) {
+    ds->failed = true;
+    return false;
+  }
+
+  // Name chars live in the name entries, after their 2 byte header.
+  uint16_t wname[FF_MAX_LFN + 1];
+  const unsigned nc = set[SZDIRE + 3];
+  for (unsigned i = 0; i < nc; i++)
+    wname[i] = ld16(&set[(i / 15 + 2) * SZDIRE + 2 + (i % 15) * 2]);
+  char name[LFN_BUF + 1];
+  if (!utf16_to_utf8(wname, nc, name))
+    strcpy(name, "?");
+
+  const unsigned attr = ld16(&set[4]) & AM_MASKX;
+  return dirlist_add(dl, name, (attr & AM_DIR) ? 0 : ld32(&set[SZDIRE + 24]), attr);
+}
+
+// Parses an exFAT entry, returns false at the end of the directory (or on
+// bad entry sets, which also make f_readdir fail, so they set `failed`).
+static bool parse_exfat(t_dirscan *ds, const uint8_t *e, t_dirlist *dl) {
+  if (ds->setlen) {
+    // Stream extension first, then the name entries.
+    const uint8_t expected = ds->setpos == 1 ? ET_STREAM : ET_FILENAME;
+    if (e[0] != expected ||
+        (ds->setpos == 1 && (e[3] + 44U) / 15 * SZDIRE > ds->setlen * SZDIRE)) {
+      ds->failed = true;
+      return false;
+    }
+
+    memcpy(&ds->set[ds->setpos * SZDIRE], e, SZDIRE);
+    if (++ds->setpos < ds->setlen)
+      return true;
+    ds->setlen = 0;
+    return emit_xset(ds, dl);
+  }
+
+  if (!e[0])
+    return false;
+  if (e[0] == ET_FILEDIR) {
+    const unsigned setlen = e[1] + 1;
+    if (setlen < 3 || setlen > DIRSCAN_MAX_SET) {
+      ds->failed = true;
+      return false;
+    }
+    memcpy(ds->set, e, SZDIRE);
+    ds->setlen = setlen;
+    ds->setpos = 1;
+  }
+  return true;
+}
+
+void dirscan_init(t_dirscan *ds, bool exfat) {
+  ds->exfat = exfat;
+  ds->done = false;
+  ds->failed = false;
+  ds->scanned = 0;
+  ds->ord = ds->sum = 0xFF;
+  ds->setpos = ds->setlen = 0;
+}
+
+bool dirscan_parse(t_dirscan *ds, const uint8_t *data, unsigned count, t_dirlist *dl) {
+  const uint32_t maxdir = ds->exfat ? MAX_DIR_EX : MAX_DIR;
+  for (unsigned i = 0; i < count && !ds->done; i++, data += SZDIRE) {
+    if (ds->scanned >= maxdir)
+      ds->done = true;
+    else if (!(ds->exfat ? parse_exfat(ds, data, dl) : parse_fat(ds, data, dl)))
+      ds->done = true;
+    ds->scanned += SZDIRE;
+  }
+  return !ds->done;
+}
+
+bool dirscan_open(t_dirscan *ds, const DIR *d, uint8_t *buf, unsigned bufsize) {
+  dirscan_init(ds, d->obj.fs->fs_type == FS_EXFAT);
+  ds->buf = buf;
+  ds->bufsecs = bufsize / SECTOR_SIZE;
+  return ds->bufsecs && fext_dir_open(&ds->it, d);
+}
+
+bool dirscan_step(t_dirscan *ds, t_dirlist *dl, unsigned maxsecs) {
+  uint32_t sector, count;
+  if (ds->done)
+    return false;
+  if (!fext_dir_next(&ds->it, MIN(maxsecs, ds->bufsecs), &sector, &count) ||
+      (count && RES_OK != disk_read(ds->it.fs->pdrv, ds->buf, sector, count)))
+    ds->failed = true;
+  if (ds->failed || !count) {
+    ds->done = true;
+    return false;
+  }
+
+  return dirscan_parse(ds, ds->buf, count * SECTOR_SIZE / SZDIRE, dl);
+}
+
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DIRSCAN_H_
+#define _DIRSCAN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dirlist.h"
+#include "fileextent.h"
+#include "fatfs/ff.h"
+
+// Bulk directory reader: reads the directory sectors with multi-block reads
+// and parses the raw FAT/exFAT entries straight into a dirlist. It produces
+// the same entries f_readdir() would (skips deleted entries, volume labels
+// and dot entries, falls back to the short name on bad LFNs, etc).
+
+#define DIRSCAN_MAX_SET      19      // exFAT entry set: file + stream + 17 names
+
+typedef struct {
+  t_fext_dirit it;
+  uint8_t *buf;                      // Sector buffer (for multi-block reads)
+  unsigned bufsecs;
+  uint32_t scanned;                  // Directory bytes parsed so far
+  bool exfat;
+  bool done;
+  bool failed;                       // Read error or corrupt entries (incomplete listing)
+  // FAT: LFN being assembled (as in FatFs)
+  uint8_t ord, sum;
+  uint16_t lfn[FF_MAX_LFN + 1];
+  // exFAT: entry set being assembled
+  uint8_t setpos, setlen;
+  uint8_t set[DIRSCAN_MAX_SET * 32];
+} t_dirscan;
+
+// Prepares the scan of an open directory. Returns false if the directory
+// cannot be scanned like this (use f_readdir then).
+bool dirscan_open(t_dirscan *ds, const DIR *d, uint8_t *buf, unsigned bufsize);
+
+// Reads up to `maxsecs` more directory sectors and adds their entries to the
+// list. Returns false once the directory is over (also on read errors and
+// corrupt entries, which set `failed`, or if the list is full).
+bool dirscan_step(t_dirscan *ds, t_dirlist *dl, unsigned maxsecs);
+
+// Resets the parser state (dirscan_open does it too).
+void dirscan_init(t_dirscan *ds, bool exfat);
+
+// Parses a chunk of raw directory entries (used by dirscan_step). Entries
+// can span several chunks. Returns false at the end of the directory.
+bool dirscan_parse(t_dirscan *ds, const uint8_t *data, unsigned count, t_dirlist *dl);
+
+#endif
+
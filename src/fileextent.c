@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fileextent.h"
+#include "fatfs/diskio.h"
+#include "common.h"
+
+#define SECTOR_SIZE     512
+
+static inline uint32_t clust2sect(const FATFS *fs, uint32_t clst) {
+  return fs->database + fs->csize * (clst - 2);
+}
+
+// Reads the FAT entry for a cluster (FAT16/FAT32/exFAT). Caches the FAT
+// sector in sbuf. Returns zero on read errors.
+static uint32_t next_cluster(const FATFS *fs, uint8_t *sbuf, uint32_t *cursect, uint32_t clst) {
+  const unsigned esize = fs->fs_type == FS_FAT16 ? 2 : 4;
+  const uint32_t sect = fs->fatbase + clst / (SECTOR_SIZE / esize);
+  if (sect != *cursect) {
+    if (RES_OK != disk_read(fs->pdrv, sbuf, sect, 1))
+      return 0;
+    *cursect = sect;
+  }
+
+  const uint8_t *e = &sbuf[(clst * esize) % SECTOR_SIZE];
+  if (esize == 2)
+    return e[0] | (e[1] << 8);
+
+  uint32_t v = e[0] | (e[1] << 8) | (e[2] << 16) | (e[3] << 24);
+  return fs->fs_type == FS_FAT32 ? v & 0x0FFFFFFF : v;
+}
+
+bool fext_map(t_file_extents *fe, FIL *fd) {
+  const FATFS *fs = fd->obj.fs;
+  const uint32_t fsize = f_size(fd);
+  const uint32_t csize = fs->csize * SECTOR_SIZE;
+  uint32_t clst = fd->obj.sclust;
+
+  fe->fd = fd;
+  fe->mapped = 0;
+  fe->count = 0;
+
+  if (!fsize || !clst)
+    return false;
+
+  // exFAT contiguous files have no FAT chain at all.
+  if (fs->fs_type == FS_EXFAT && (fd->obj.stat & 3) == 2) {
+    fe->ext[0].offset = 0;
+    fe->ext[0].sector = clust2sect(fs, clst);
+    fe->ext[0].count = (fsize + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    fe->count = 1;
+    fe->mapped = fsize;
+    return true;
+  }
+
+  // FAT12 is not worth it, and avoid reading a FAT that is not written back yet.
+  // (the chain status is only valid for exFAT files)
+  if (fs->fs_type == FS_FAT12 || fs->wflag ||
+      (fs->fs_type == FS_EXFAT && (fd->obj.stat & 3) == 3))
+    return false;
+
+  uint8_t sbuf[SECTOR_SIZE];
+  uint32_t cursect = ~0U;
+  uint32_t offset = 0;
+  while (clst >= 2 && clst < fs->n_fatent) {
+    const uint32_t sect = clust2sect(fs, clst);
+    t_file_extent *last = fe->count ? &fe->ext[fe->count - 1] : NULL;
+    if (last && last->sector + last->count == sect)
+      last->count += fs->csize;         // Contiguous cluster, grow the extent
+    else if (fe->count < MAX_FILE_EXTENTS) {
+      fe->ext[fe->count].offset = offset;
+      fe->ext[fe->count].sector = sect;
+      fe->ext[fe->count].count = fs->csize;
+      fe->count++;
+    }
+    else
+      break;                            // Out of extents, map partially.
+
+    offset += csize;
+    fe->mapped = MIN(offset, fsize);
+    if (offset >= fsize)
+      break;
+
+    clst = next_cluster(fs, sbuf, &cursect, clst);
+  }
+
+  return fe->count != 0;
+}
+
+FRESULT fext_read(t_file_extents *fe, uint32_t offset, void *buf, UINT btr, UINT *br) {
+  const uint32_t fsize = f_size(fe->fd);
+  uint8_t *ptr = (uint8_t*)buf;
+
+  *br = 0;
+  if (offset >= fsize)
+    return FR_OK;
+  btr = MIN(btr, fsize - offset);
+
+  unsigned e = 0;
+  while (btr) {
+    unsigned cnt;
+    if (!(offset % SECTOR_SIZE) && btr >= SECTOR_SIZE && offset + SECTOR_SIZE <= fe->mapped) {
+      // Find the extent, read as many sectors as possible in one go.
+      while (offset >= fe->ext[e].offset + fe->ext[e].count * SECTOR_SIZE)
+        e++;
+      const uint32_t sidx = (offset - fe->ext[e].offset) / SECTOR_SIZE;
+      const uint32_t scnt = MIN(fe->ext[e].count - sidx, MIN(btr, fe->mapped - offset) / SECTOR_SIZE);
+      if (RES_OK != disk_read(fe->fd->obj.fs->pdrv, ptr, fe->ext[e].sector + sidx, scnt))
+        return FR_DISK_ERR;
+      cnt = scnt * SECTOR_SIZE;
+    }
+    else {
+      // Partial sectors (or unmapped fragments) are read using FatFs.
+      cnt = (offset % SECTOR_SIZE) && offset < fe->mapped ?
+            MIN(btr, SECTOR_SIZE - (offset % SECTOR_SIZE)) : btr;
+      UINT rdbytes;
+      FRESULT res = f_lseek(fe->fd, offset);
+      if (res == FR_OK)
+        res = f_read(fe->fd, ptr, cnt, &rdbytes);
+      if (res != FR_OK)
+        return res;
+      if (rdbytes != cnt)
+        return FR_INT_ERR;
+    }
+
+    ptr += cnt;
+    offset += cnt;
+    btr -= cnt;
+    *br += cnt;
+  }
+
+  return FR_OK;
+}
+
+
+bool fext_dir_open(t_fext_dirit *it, const DIR *d) {
+  const FATFS *fs = d->obj.fs;
+  it->fs = fs;
+  it->clst = d->obj.sclust;
+  it->sector = it->count = 0;
+  it->cursect = ~0U;
+  it->maxclst = fs->n_fatent;           // Guards against looped chains
+
+  if (fs->wflag)
+    return false;
+
+  if (!it->clst) {
+    // FAT12/16 root directory has a fixed size (and lives outside the data area)
+    if (fs->fs_type != FS_FAT32 && fs->fs_type != FS_EXFAT) {
+      it->sector = fs->dirbase;
+      it->count = fs->n_rootdir * 32 / SECTOR_SIZE;
+      it->clst = ~0U;
+      return true;
+    }
+    it->clst = fs->dirbase;
+  }
+  else if (fs->fs_type == FS_EXFAT && (d->obj.stat & 3) == 2) {
+    // Contiguous exFAT directories have no FAT chain.
+    it->sector = clust2sect(fs, it->clst);
+    it->count = (d->obj.objsize + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    it->clst = ~0U;
+    return true;
+  }
+  else if (fs->fs_type == FS_FAT12 || (fs->fs_type == FS_EXFAT && (d->obj.stat & 3) == 3))
+    return false;
+
+  return true;
+}
+
+bool fext_dir_next(t_fext_dirit *it, unsigned maxsecs, uint32_t *sector, uint32_t *count) {
+  const FATFS *fs = it->fs;
+
+  // Follow the cluster chain, merging contiguous clusters (up to maxsecs).
+  while (it->count < maxsecs) {
+    if (it->clst < 2 || it->clst >= fs->n_fatent || !it->maxclst)
+      break;
+    const uint32_t sect = clust2sect(fs, it->clst);
+    if (it->count && it->sector + it->count != sect)
+      break;
+    if (!it->count)
+      it->sector = sect;
+    it->count += fs->csize;
+    it->maxclst--;
+    it->clst = next_cluster(fs, it->sbuf, &it->cursect, it->clst);
+  }
+
+  if (!it->count) {
+    // Chains must end with an EOC mark (not with a free entry or error).
+    *count = 0;
+    return it->clst >= fs->n_fatent;
+  }
+
+  *sector = it->sector;
+  *count = MIN(it->count, maxsecs);
+  it->sector += *count;
+  it->count -= *count;
+  return true;
+}
+
+bool fext_walk_dir(const DIR *d, unsigned maxsecs, fext_run_fn cb, void *arg) {
+  t_fext_dirit it;
+  if (!maxsecs || !fext_dir_open(&it, d))
+    return false;
+
+  while (1) {
+    uint32_t sector, count;
+    if (!fext_dir_next(&it, maxsecs, &sector, &count))
+      return false;
+    if (!count)
+      return true;
+    if (!cb(sector, count, arg))
+      return false;
+  }
+}
+
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FILEEXTENT_H_
+#define _FILEEXTENT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fatfs/ff.h"
+
+// Extent map for (mostly) contiguous files. The cluster chain is resolved
+// once, so that reads can be issued as big multi-block reads straight to the
+// SD card, instead of going cluster by cluster through FatFs.
+
+#define MAX_FILE_EXTENTS     32
+
+typedef struct {
+  uint32_t offset;     // File offset (in bytes)
+  uint32_t sector;     // First sector (LBA)
+  uint32_t count;      // Number of sectors
+} t_file_extent;
+
+typedef struct {
+  FIL *fd;
+  uint32_t mapped;     // File bytes covered by the extents (from offset zero)
+  unsigned count;
+  t_file_extent ext[MAX_FILE_EXTENTS];
+} t_file_extents;
+
+// Resolves the extents of an open (read only) file. Files with too many
+// fragments are mapped partially. Returns false if nothing could be mapped
+// (reads will still work, using FatFs).
+bool fext_map(t_file_extents *fe, FIL *fd);
+
+// Reads data from a mapped file at the given offset, akin to f_read().
+// Whole sectors are read directly from disk, the rest goes through FatFs.
+// The file pointer is only meaningful after the function uses FatFs.
+FRESULT fext_read(t_file_extents *fe, uint32_t offset, void *buf, UINT btr, UINT *br);
+
+// Directory sectors iterator, walks the directory in runs of contiguous
+// sectors. Returns false if the directory cannot be walked like this (the
+// on-disk FAT cannot be trusted or it is not supported).
+typedef struct {
+  const FATFS *fs;
+  uint32_t clst;       // Next cluster in the chain (EOC if there is no chain)
+  uint32_t sector;     // Current run (sectors not returned yet)
+  uint32_t count;
+  uint32_t cursect;    // FAT sector cached in sbuf
+  uint32_t maxclst;
+  uint8_t sbuf[512];
+} t_fext_dirit;
+
+bool fext_dir_open(t_fext_dirit *it, const DIR *d);
+
+// Returns the next run of sectors (no longer than `maxsecs`), `count` is
+// zero at the end of the directory. Returns false on errors.
+bool fext_dir_next(t_fext_dirit *it, unsigned maxsecs, uint32_t *sector, uint32_t *count);
+
+// Walks the sectors of an open directory, calling `cb` for each run of
+// contiguous sectors (no longer than `maxsecs`). Returns false on errors
+// (or if `cb` fails), and if the on-disk FAT cannot be trusted.
+typedef bool (*fext_run_fn)(uint32_t sector, uint32_t count, void *arg);
+bool fext_walk_dir(const DIR *d, unsigned maxsecs, fext_run_fn cb, void *arg);
+
+#endif
+
@@ -79,6 +79,9 @@
 
 #define REG_IE           (*((volatile uint16_t *) 0x04000200))
 
+#define REG_TMxD(n)      (*((volatile uint16_t *)(0x04000100 + 4*(n))))
+#define REG_TMxCNT(n)    (*((volatile uint16_t *)(0x04000102 + 4*(n))))
+
 #define DMA_SAD(n)       (*(((volatile uint32_t *)(0x040000B0) + (n) * 3)))
 #define DMA_DAD(n)       (*(((volatile uint32_t *)(0x040000B4) + (n) * 3)))
 #define DMA_CTL(n)       (*(((volatile uint32_t *)(0x040000B8) + (n) * 3)))
@@ -44,6 +44,7 @@ typedef struct {
 
   uint32_t drv_issdhc;                 // Boolean (is SDHC card)
   uint32_t drv_rca;                    // SD card RCA id
+  uint32_t drv_cmd23;                  // Boolean (card supports CMD23)
 
   uint32_t menu_hotkey;                // Magic key combo to trigger menu
   uint32_t menu_lang;                  // Menu language code
@@ -21,6 +21,7 @@
 #include <string.h>
 
 #include "gbahw.h"
+#include "compiler.h"
 #include "save.h"
 #include "patchengine.h"
 #include "settings.h"
@@ -28,6 +29,7 @@
 #include "fonts/font_render.h"
 #include "supercard_driver.h"
 #include "fatfs/ff.h"
+#include "fileextent.h"
 #include "directsave.h"
 #include "common.h"
 #include "util.h"
@@ -36,6 +38,7 @@
 // Here we have the ROM loading routines.
 
 #define LOAD_BS     (8*1024)     // Load in 8KB chunks
+#define LOAD_BATCH  (16*1024)    // ROMs are loaded in 16KB batches (see ldstage)
 
 #define GBA_ROM_ADDR                  ((uint8_t *)0x08000000)
 #define GBA_ROM_ADDR16(addr, value)   *((volatile uint16_t *)(0x08000000 + addr)) = (value)
@@ -140,6 +143,7 @@ void load_ingame_menu(
   // Patch the menu header to provide necessary data.
   igm->drv_issdhc = sc_issdhc();              // SD driver data (no init happens)
   igm->drv_rca = sc_rca();
+  igm->drv_cmd23 = sc_cmd23();
   igm->menu_hotkey = hotk;                    // Configured hotkey
   igm->menu_lang = lang_id;                   // Use the current lang id
   igm->menu_use_directsave = useds;           // DirectSave in use
@@ -170,7 +174,7 @@ void load_directsave_config(const t_dirsave_info *dsinfo) {
     .nrandom = 0xdeadbeef ^ (uint32_t)dsinfo,
     .memory_size = dsinfo->save_size,
     .base_sector = dsinfo->sector_lba,
-    .drv_issdhc = sc_issdhc(),
+    .drv_issdhc = (sc_issdhc() ? DIRSAV_DRV_SDHC : 0) | (sc_cmd23() ? DIRSAV_DRV_CMD23 : 0),
     .drv_rca = sc_rca(),
     .sd_mutex = 0
   };
@@ -201,10 +205,72 @@ unsigned preload_gba_rom(const char *fn, uint32_t fs, t_rom_header *romh) {
   return err ? ERR_LOAD_BADROM : 0;
 }
 
+// ROM loading staging buffer. Each batch is read with a single multi-block
+// read (using the file extent map) and then copied to SDRAM with a single
+// mode switch (the SD interface must be unmapped).
+static uint32_t ldstage[LOAD_BATCH / 4] EWRAM_BSS;
+static t_file_extents ldextents EWRAM_BSS;
+
+static void stage_flush(uint8_t *dst, const uint32_t *buf, unsigned size) {
+  set_supercard_mode(MAPPED_SDRAM, true, false);
+  if (use_slowld)
+    rom_copy_write16(dst, buf, size);
+  else
+    dma_memcpy32(dst, buf, size / 4);
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+}
+
+// Benchmarks ROM loading (SD to SDRAM) over the same file, using either the
+// batched path (extent mapped reads) or the legacy one (8KB f_read blocks,
+// with a mode switch per block).
+// Returns the load speed in KiB/s (zero if aborted, negative on error).
+__attribute__((noinline))
+int sdbench_load(const char *fn, uint8_t *dst, unsigned maxsize, bool batched, progress_abort_fn progcb) {
+  FIL fd;
+  if (FR_OK != f_open(&fd, fn, FA_READ))
+    return -1;
+
+  const unsigned size = MIN(f_size(&fd), maxsize) & ~(LOAD_BATCH - 1);
+  const unsigned bs = batched ? LOAD_BATCH : LOAD_BS;
+  const unsigned start_frame = frame_count;
+  if (batched)
+    fext_map(&ldextents, &fd);
+  for (unsigned offset = 0; offset < size; offset += bs) {
+    UINT rdbytes;
+    uint32_t tmp[LOAD_BS/4];
+    uint32_t *buf = batched ? ldstage : tmp;
+    FRESULT res = batched ? fext_read(&ldextents, offset, buf, bs, &rdbytes) :
+                            f_read(&fd, buf, bs, &rdbytes);
+    if (FR_OK != res || rdbytes != bs) {
+      f_close(&fd);
+      return -1;
+    }
+    stage_flush(&dst[offset], buf, bs);
+
+    if (!(offset & 0x3FFFF) && progcb(offset, size)) {
+      f_close(&fd);
+      return 0;
+    }
+  }
+  const unsigned end_frame = frame_count;
+  f_close(&fd);
+
+  if (!size)
+    return -1;
+  return (size / 1024) * 1000 / frames_ms(end_frame - start_frame);
+}
+
+// Patch builder used to generate patches on the fly (and its op log) and
+// compiled patch list (these are quite big, so they are kept in EWRAM).
+static t_patch_builder ldpbuilder EWRAM_BSS;
+static uint32_t ldoplog[MAX_PATCH_OPS * 2] EWRAM_BSS;
+static t_patch_wlist ldwlist EWRAM_BSS;
+
 __attribute__((noinline))
 unsigned load_gba_rom(
   const char *fn, uint32_t fs,
   const t_patch *ptch,
+  bool genpatches,
   const t_dirsave_info *dsinfo,
   bool ingame_menu,
   const t_rtc_info *rtcinfo,
@@ -213,6 +279,8 @@ unsigned load_gba_rom(
 ) {
 
   bool use_rtc_patches = rtcinfo != NULL;
+  // Generate patches while loading, only if none were provided.
+  t_patch_builder *pb = (genpatches && !ptch) ? &ldpbuilder : NULL;
 
   // Determine how much ROM space we need for the IGM and DirSav payloads
   const unsigned igm_reqsz = ingame_menu_payload.menu_rsize + font_block_size();
@@ -251,6 +319,14 @@ unsigned load_gba_rom(
   ds_addr += GBA_ROM_BASE;
   igm_addr += GBA_ROM_BASE;
 
+  // If the patches are known in advance, apply them to each block while it is
+  // still in the bounce buffer (rather than patching SDRAM afterwards).
+  // Failing to compile them (too many writes) must not boot the game unpatched.
+  const bool blkpatch = ptch != NULL;
+  if (blkpatch && !patch_compile(&ldwlist, ptch, true, use_rtc_patches,
+                                 ingame_menu ? igm_addr : 0, dsinfo ? ds_addr : 0))
+    return ERR_LOAD_BADROM;
+
   // Install the menu before loading the ROM, otherwise we overwrite relevant assets.
   if (ingame_menu) {
     char sfn[MAX_FN_LEN];
@@ -275,58 +351,58 @@ unsigned load_gba_rom(
 
   // Calculate progress bar steps, carefully consider the gap (if any).
   const uint32_t load_steps = (gap_end <= fs  ? (fs - (gap_end - gap_start)) :
-                               gap_start < fs ? (fs - gap_start)             : fs) / LOAD_BS;
+                               gap_start < fs ? (fs - gap_start)             : fs) / LOAD_BATCH;
   uint32_t steps = 0;
 
   // Honor fast loading (switch mirror if appropriate)
   slowsd = use_slowld;
 
+  // Resolve the cluster chain upfront, to read the ROM in big chunks.
+  fext_map(&ldextents, &fd);
+
+  // Without patches the gap is always placed after the ROM, so the whole ROM
+  // is streamed through the patch engine in the first loop below.
+  if (pb)
+    patchengine_init(pb, fs, ldoplog, sizeof(ldoplog) / sizeof(ldoplog[0]));
+
   uint8_t *ptr = (uint8_t*)(GBA_ROM_ADDR);
-  for (uint32_t offset = 0; offset < gap_start; offset += LOAD_BS, steps++) {
-    if (progress && (steps & (31)) == 0)
+  for (uint32_t offset = 0; offset < gap_start; offset += LOAD_BATCH, steps++) {
+    if (progress && (steps & (15)) == 0)
       progress(steps, load_steps);
 
-    unsigned toread = MIN(LOAD_BS, gap_start - offset);
+    unsigned toread = MIN(LOAD_BATCH, gap_start - offset);
     UINT rdbytes;
-    uint32_t tmp[LOAD_BS/4];
-    if (FR_OK != f_read(&fd, tmp, toread, &rdbytes)) {
+    if (FR_OK != fext_read(&ldextents, offset, ldstage, toread, &rdbytes)) {
       slowsd = true;
       f_close(&fd);
       return ERR_LOAD_BADROM;
     }
 
-    set_supercard_mode(MAPPED_SDRAM, true, false);
-    if (use_slowld)
-      rom_copy_write16(&ptr[offset], tmp, toread);
-    else
-      dma_memcpy32(&ptr[offset], tmp, toread/4);
-    set_supercard_mode(MAPPED_SDRAM, true, true);
+    // Scan the block while we have it handy (only the bytes within the ROM)
+    if (pb && offset < fs)
+      patchengine_process_rom(ldstage, MIN(toread, fs - offset), pb, NULL);
+    if (blkpatch)
+      patch_apply_wlist(&ldwlist, (uint8_t*)ldstage, toread, offset);
+
+    stage_flush(&ptr[offset], ldstage, toread);
   }
   // Skip over the gap
-  if (FR_OK != f_lseek(&fd, gap_end)) {
-    slowsd = true;
-    f_close(&fd);
-    return ERR_LOAD_BADROM;
-  }
-  for (uint32_t offset = gap_end; offset < fs; offset += LOAD_BS, steps++) {
-    if (progress && (steps & (31)) == 0)
+  for (uint32_t offset = gap_end; offset < fs; offset += LOAD_BATCH, steps++) {
+    if (progress && (steps & (15)) == 0)
       progress(steps, load_steps);
 
-    unsigned toread = MIN(LOAD_BS, fs - offset);
+    unsigned toread = MIN(LOAD_BATCH, fs - offset);
     UINT rdbytes;
-    uint32_t tmp[LOAD_BS/4];
-    if (FR_OK != f_read(&fd, tmp, toread, &rdbytes)) {
+    if (FR_OK != fext_read(&ldextents, offset, ldstage, toread, &rdbytes)) {
       slowsd = true;
       f_close(&fd);
       return ERR_LOAD_BADROM;
     }
 
-    set_supercard_mode(MAPPED_SDRAM, true, false);
-    if (use_slowld)
-      rom_copy_write16(&ptr[offset], tmp, toread);
-    else
-      dma_memcpy32(&ptr[offset], tmp, toread/4);
-    set_supercard_mode(MAPPED_SDRAM, true, true);
+    if (blkpatch)
+      patch_apply_wlist(&ldwlist, (uint8_t*)ldstage, toread, offset);
+
+    stage_flush(&ptr[offset], ldstage, toread);
   }
   progress(1, 1);  // Mark as complete
 
@@ -335,6 +411,25 @@ unsigned load_gba_rom(
   // Close the file, not super necessary really :P
   f_close(&fd);
 
+  if (pb) {
+    // Finish patch generation and cache them, so that we don't scan again.
+    patchengine_finalize(pb);
+    write_patches_cache(fn, &pb->p);
+    ptch = &pb->p;
+
+    // The menu and RTC were speculatively requested, drop them if unsupported.
+    if (!ptch->irqh_ops)
+      ingame_menu = false;
+    if (!ptch->rtc_ops) {
+      use_rtc_patches = false;
+      rtcinfo = NULL;
+    }
+
+    // Compile them now, while the SD card is still accessible.
+    if (!patch_compile(&ldwlist, ptch, true, use_rtc_patches, ingame_menu ? igm_addr : 0, dsinfo ? ds_addr : 0))
+      return ERR_LOAD_BADROM;
+  }
+
   // Proceed to patch the ROM
   set_supercard_mode(MAPPED_SDRAM, true, false);
 
@@ -344,8 +439,14 @@ unsigned load_gba_rom(
 
   // Actually apply patches
   if (ptch) {
-    patch_apply_rom(GBA_ROM_ADDR, MAX_GBA_ROM_SIZE, 0, true, ptch, use_rtc_patches,
-                    ingame_menu ? igm_addr : 0, dsinfo ? ds_addr : 0);
+    if (blkpatch) {
+      // Loaded blocks are patched already, only patch what falls outside of them.
+      const uint32_t tail = MAX(gap_end, fs);
+      patch_apply_wlist(&ldwlist, &ptr[gap_start], gap_end - gap_start, gap_start);
+      patch_apply_wlist(&ldwlist, &ptr[tail], MAX_GBA_ROM_SIZE - tail, tail);
+    }
+    else
+      patch_apply_wlist(&ldwlist, GBA_ROM_ADDR, MAX_GBA_ROM_SIZE, 0);   // Generated while loading
     if (rtcinfo)
       load_rtcclock_data(rtcinfo);
   }
@@ -390,6 +491,11 @@ unsigned flash_gba_nor(
   uint32_t dsaddr  =  ds_flashoffset ? 0x08000000 +  ds_flashoffset : FLASH_DIRSAV_PAYLOAD_W0;
   uint32_t igmaddr = igm_flashoffset ? 0x08000000 + igm_flashoffset : FLASH_IGM_TRAMPOLINE_W0;
 
+  // Compile the patches once, they are applied to each chunk. Do not touch
+  // the flash at all if they cannot be compiled (too many writes).
+  if (!patch_compile(&ldwlist, ptch, false, rtc_patches, ingame_menu ? igmaddr : 0, dirsaving ? dsaddr : 0))
+    return ERR_FLASH_OP;
+
   FIL fd;
   FRESULT res = f_open(&fd, fn, FA_READ);
   if (res != FR_OK)
@@ -422,18 +528,18 @@ unsigned flash_gba_nor(
         return ERR_LOAD_BADROM;
       }
 
-      dma_memcpy32(&scratch[offset], tmp, toread/4);
-    }
+      // Patch the block before it leaves the bounce buffer, don't need WAITCNT patches
+      patch_apply_wlist(&ldwlist, (uint8_t*)tmp, toread, absoff);
 
-    // Patch ROM, don't need WAITCNT patches
-    patch_apply_rom(scratch, ssize, bigoff, false, ptch, rtc_patches, ingame_menu ? igmaddr : 0, dirsaving ? dsaddr : 0);
+      // Copy (partial) DirSav / IGM trampoline payloads if necessary
+      if (dirsaving && ds_flashoffset)
+        payload_apply_rom((uint8_t*)tmp, toread, absoff, directsave_payload, directsave_payload_size, ds_flashoffset);
 
-    // Copy (partial) DirSav / IGM trampoline payloads if necessary
-    if (dirsaving && ds_flashoffset)
-      payload_apply_rom(scratch, ssize, bigoff, directsave_payload, directsave_payload_size, ds_flashoffset);
+      if (ingame_menu && igm_flashoffset)
+        payload_apply_rom((uint8_t*)tmp, toread, absoff, ingame_trampoline_payload, ingame_trampoline_payload_size, igm_flashoffset);
 
-    if (ingame_menu && igm_flashoffset)
-      payload_apply_rom(scratch, ssize, bigoff, ingame_trampoline_payload, ingame_trampoline_payload_size, igm_flashoffset);
+      dma_memcpy32(&scratch[offset], tmp, toread/4);
+    }
 
     // Wait until erasing is complete (if it didn't complete in the meantime)
     while (1) {
@@ -578,26 +684,21 @@ unsigned load_extemu_rom(const char *fn, uint32_t fs, const t_emu_loader *ldinfo
   // Proceed to load the ROM now.
   if (FR_OK != f_open(&fd, fn, FA_READ))
     return ERR_LOAD_BADROM;
+  fext_map(&ldextents, &fd);
 
-  for (uint32_t offset = 0; offset < fs; offset += LOAD_BS) {
+  for (uint32_t offset = 0; offset < fs; offset += LOAD_BATCH) {
     if (progress && (offset & (64*1024-1)) == 0)
       progress(offset, fs);
 
     UINT rdbytes;
-    uint32_t tmp[LOAD_BS/4];
-    if (FR_OK != f_read(&fd, tmp, LOAD_BS, &rdbytes)) {
+    if (FR_OK != fext_read(&ldextents, offset, ldstage, LOAD_BATCH, &rdbytes)) {
       f_close(&fd);
       return ERR_LOAD_BADROM;
     }
 
-    // Copy data into the ROM (disable SD interface to avoid collisions!)
-    set_supercard_mode(MAPPED_SDRAM, true, false);
-    if (use_slowld)
-      rom_copy_write16(ptr, tmp, LOAD_BS);
-    else
-      dma_memcpy32(ptr, tmp, LOAD_BS/4);
-    set_supercard_mode(MAPPED_SDRAM, true, true);
-    ptr += LOAD_BS;
+    // Copy data into the ROM (disables SD interface to avoid collisions!)
+    stage_flush(ptr, ldstage, LOAD_BATCH);
+    ptr += LOAD_BATCH;
   }
 
   // Close the file, not super necessary really :P
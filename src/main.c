@@ -153,6 +153,7 @@ static int main_gba() {
   // Load patchdb info.
   set_supercard_mode(MAPPED_SDRAM, true, false);
   memset(&pdbinfo, 0, sizeof(pdbinfo));
+  patchmem_validate((uint8_t*)ROM_PATCHDB_U8, PATCH_DB_MAX_SIZE);
   patchmem_dbinfo((uint8_t*)ROM_PATCHDB_U8, &pdbinfo.patch_count, pdbinfo.version, pdbinfo.date, pdbinfo.creator);
   set_supercard_mode(MAPPED_SDRAM, true, true);
 
@@ -183,6 +184,7 @@ static int main_gba() {
     }
     unsigned cframe = frame_count;
     menu_render(frame_count - prev_frame);
+    menu_work();
 
     wait_for_vblank();    // Avoid tearing.
     menu_flip();
@@ -19,8 +19,10 @@
 #include <string.h>
 
 #include "gbahw.h"
+#include "compiler.h"
 #include "patchengine.h"
 #include "fatfs/ff.h"
+#include "fileextent.h"
 #include "common.h"
 #include "settings.h"
 #include "util.h"
@@ -35,6 +37,9 @@
 #include "flash_mgr.h"
 #include "sha256.h"
 #include "supercard_driver.h"
+#include "dirlist.h"
+#include "dircache.h"
+#include "dirscan.h"
 
 #include "res/icons.h"
 #include "res/logo.h"
@@ -70,9 +75,10 @@ enum {
 #endif
 };
 
-#define BROWSER_MAXFN_CNT     (16*1024)
 #define RECENT_MAXFN_CNT          (200)
 #define BROWSER_ROWS                 8
+#define BROWSER_SCANBUF_SIZE  (128*1024)    // Directory reads (scratch area)
+#define BROWSER_JUMP_MAXLEN         16    // Jump picker prefix length
 #define RECENT_ROWS                  9
 #define NORGAMES_ROWS                8
 
@@ -132,8 +138,9 @@ enum {
   DefsLoadPol  = 15,
   DefsSavePol  = 16,
   DefsPrefDS   = 17,
-  SettSave     = 18,
-  SettMAX      = 18,
+  DefsPatchLd  = 18,
+  SettSave     = 19,
+  SettMAX      = 19,
 };
 
 enum {
@@ -226,6 +233,7 @@ typedef struct {
   t_patch patches_cache;              // Loaded patches (from patch engine's cache)
   bool patches_datab_found;           // Whether we had a patch match in the database
   bool patches_cache_found;           // Same but for the patch cache
+  bool patches_onload;                // Patches will be generated while loading the ROM
   // Patching configuration
   t_patch_policy patch_type;          // Patching type
   bool use_dsaving;                   // Whether we use direct-saving mode
@@ -271,7 +279,11 @@ static struct {
     int seloff;                   // Entry at the top of the list
     int maxentries;               // Total file/dir count in current dir
     int dispentries;              // Maximum number of visible entries (filtered)
+    bool loading;                 // The list is still being loaded (and sorted)
     uint16_t selhist[16];         // History of directory offsets
+    int jumpsel, jumpoff;         // Selector/offset before opening the jump picker
+    uint8_t jumplen;              // Jump picker prefix length (zero if closed)
+    char jump[BROWSER_JUMP_MAXLEN];  // Jump picker prefix (folded ASCII)
   } browser;
 
   // Flash ROM browser state
@@ -280,6 +292,7 @@ static struct {
     int seloff;                   // Entry at the top of the list
     uint8_t maxentries;           // Total file/dir count in current dir
     uint8_t usedblks, freeblks;   // NOR usage info
+    uint16_t order[FLASHG_MAXFN_CNT];  // Game indices, sorted by name
   } fbrowser;
 
   // UI settings
@@ -301,6 +314,8 @@ static struct {
   struct {
     int selector;                 // Render panel
     char tstr[64];                // Temp message render
+    bool has_bench;               // Benchmark results available
+    t_sdbench_results bench;      // Last benchmark results
   } info;
 } smenu;
 
@@ -365,16 +380,7 @@ static struct {
       unsigned fs;
     } pdb_ld;
   } p;
-} spop;
-
-typedef struct {
-  uint32_t filesize;
-  uint16_t isdir;
-  uint16_t attr;
-  char fname[MAX_FN_LEN];
-  uint16_t sortname[MAX_FN_LEN];       // Pre-decoded and sort-friendly name.
-} t_centry;
-_Static_assert (sizeof(t_centry) % 4 == 0, "t_centry must be word-friendly");
+} spop EWRAM_BSS;                   // Too big for IWRAM (cleared by menu_init)
 
 typedef struct {
   uint32_t fname_offset;     // Basename offset in fpath (precalculated!)
@@ -384,21 +390,23 @@ _Static_assert (sizeof(t_rentry) % 4 == 0, "t_rentry must be word-friendly");
 
 // Pointer to SDRAM, where we place some data:
 //  - Scratch area 2MiB (for FW updates)
-//  - File list order (~64KiB)
-//  - Browser file information (~13MB)
+//  - Browser directory listing (~11MiB, names and sort keys in an arena)
+//  - Directory scanner state (~2KiB)
 //  - Recently played ROMs table (~64KiB)
 //  - Font data (placed by the bootloader at the 15..16MB range)
 // At the end of the SDRAM, ro-data can be loaded by the loader.
 #define scratch_mem_size (2*1024*1024)
 typedef struct {
   uint8_t scratch[scratch_mem_size];
-  t_centry *fileorder[BROWSER_MAXFN_CNT];
-  t_centry fentries[BROWSER_MAXFN_CNT];
+  t_dirlist dirlist;
+  t_dirscan dirscan;
   t_rentry rentries[RECENT_MAXFN_CNT];
   t_reg_entry_max nordata;
 } t_sdram_state;
 
 _Static_assert (sizeof(t_sdram_state) <= 14.5*1024*1024, "scratch SDRAM doesn't exceed 14.5MB");
+_Static_assert (scratch_mem_size >= DIRLIST_SORTBUF_SIZE + BROWSER_SCANBUF_SIZE,
+                "scratch area can hold the sort buffer and the directory scan buffer");
 
 t_sdram_state *sdr_state = (t_sdram_state*)0x08000000;
 uint8_t *hiscratch = (uint8_t*)ROM_HISCRATCH_U8;
@@ -434,33 +442,13 @@ bool is_superfw(const t_rom_header *h) {
   return !memcmp(&h->data[SUPERFW_COMMENT_DOFFSET], "SUPERFW~DAVIDGF", 16);
 }
 
-static int strcmp16(const uint16_t *a, const uint16_t *b) {
-  while (*a && *a == *b) {
-    a++;
-    b++;
-  }
-  return *a - *b;
+// Returns the n-th NOR game, in browsing (sorted) order.
+static inline t_flash_game_entry *fbrowser_entry(unsigned n) {
+  return &sdr_state->nordata.games[smenu.fbrowser.order[n]];
 }
 
-__attribute__((noinline))
-int filesort(const void *a, const void *b) {
-  const t_centry *ca = *(t_centry**)a;
-  const t_centry *cb = *(t_centry**)b;
-
-  // Directories some up first.
-  if (ca->isdir != cb->isdir)
-    return cb->isdir - ca->isdir;
-
-  // Other files are string-ordered
-  return strcmp16(ca->sortname, cb->sortname);
-}
-
-__attribute__((noinline))
-int romsort(const void *a, const void *b) {
-  const t_flash_game_entry *ca = (t_flash_game_entry*)a;
-  const t_flash_game_entry *cb = (t_flash_game_entry*)b;
-
-  return strcasecmp(&ca->game_name[ca->bnoffset], &cb->game_name[cb->bnoffset]);
+static const uint16_t *norgame_key(unsigned idx, const void *ctx) {
+  return &((const uint16_t*)ctx)[idx * MAX_FN_LEN];
 }
 
 static void loadrom_progress(unsigned done, unsigned total) {
@@ -490,42 +478,27 @@ static bool loadrom_progress_abort(unsigned done, unsigned total) {
 
 
 bool generate_patches_progress(const char *fn, unsigned fs) {
-  // Open ROM and load it in the SDRAM. We load it in 4MB chunks. Not ideal but
-  // we want to preserve the data loaded in the SDRAM (ie. fonts).
+  // Stream the ROM through the patch engine in small blocks. The engine carries
+  // its state across blocks, so no need to stage the ROM in SDRAM.
   FIL fd;
   FRESULT res = f_open(&fd, fn, FA_READ);
   if (res != FR_OK)
     return false;
 
-  t_patch_builder pb;
-  patchengine_init(&pb, fs);
-  const unsigned max_hiscratch = 8*1024*1024;
-
-  for (unsigned i = 0; i < fs; i += max_hiscratch) {
-    for (unsigned j = 0; j < max_hiscratch && i + j < fs; j += 4096) {
-      UINT rdbytes;
-      uint32_t tmp[4096/4];
-      if (FR_OK != f_read(&fd, tmp, sizeof(tmp), &rdbytes))
-        return false;
-
-      set_supercard_mode(MAPPED_SDRAM, true, false);
-      dma_memcpy32(&hiscratch[j], tmp, sizeof(tmp)/4);
-      set_supercard_mode(MAPPED_SDRAM, true, true);
-      if (j & ~0xFFFF)
-        loadrom_progress((i*2 + j) >> 8, fs >> 7);
-    }
-    // Amount to process.
-    unsigned blksize = MIN(max_hiscratch, fs - i);
+  // The op log lives in the SDRAM scratch area, so it can hold lots of ops.
+  static t_patch_builder pb EWRAM_BSS;
+  patchengine_init(&pb, fs, (uint32_t*)sdr_state->scratch, scratch_mem_size / sizeof(uint32_t));
 
-    void upd_pe_prog(unsigned prog) {
-      unsigned p = i*2 + blksize + prog*4;
-      loadrom_progress(p >> 8, fs >> 7);
-    }
+  for (unsigned i = 0; i < fs; i += 4096) {
+    UINT rdbytes;
+    uint32_t tmp[4096/4];
+    if (FR_OK != f_read(&fd, tmp, sizeof(tmp), &rdbytes))
+      return false;
 
     // Process patches. Adds them to the existing patchset.
-    set_supercard_mode(MAPPED_SDRAM, true, false);
-    patchengine_process_rom((uint32_t*)hiscratch, blksize, &pb, upd_pe_prog);
-    set_supercard_mode(MAPPED_SDRAM, true, true);
+    patchengine_process_rom(tmp, rdbytes, &pb, NULL);
+    if (!(i & 0xFFFF))
+      loadrom_progress(i >> 8, fs >> 8);
   }
 
   f_close(&fd);
@@ -601,6 +574,11 @@ static const t_patch * get_game_patch(const t_load_gba_info *info) {
          info->patch_type == PatchEngine   && info->patches_cache_found ? &info->patches_cache : NULL;
 }
 
+// Whether the patches are still to be generated (by the loader).
+static bool game_patch_pending(const t_load_gba_info *info) {
+  return info->patch_type == PatchEngine && !info->patches_cache_found && info->patches_onload;
+}
+
 bool ingame_menu_avail_sdram(const t_load_gba_info *info) {
   const t_patch *p = get_game_patch(info);
   // Necessary size to load the IGM (+fonts +cheats)
@@ -613,6 +591,10 @@ bool ingame_menu_avail_sdram(const t_load_gba_info *info) {
       return false;   // Too big to fit the menu!
   }
 
+  // Patches not generated yet, the loader will drop the menu if unsupported.
+  if (game_patch_pending(info))
+    return true;
+
   // Check if the patches exist and have proper IRQ support.
   return p && p->irqh_ops > 0;
 }
@@ -659,13 +641,13 @@ bool dirsav_avail_flash(const t_load_gba_info *info) {
 
 bool rtcemu_avail(const t_load_gba_info *info) {
   const t_patch *p = get_game_patch(info);
-  return (p && p->rtc_ops);
+  return (p && p->rtc_ops) || game_patch_pending(info);
 }
 
 static bool prepare_gba_info(
   t_load_gba_info *info, const t_rom_load_settings *st,
   const char *fn, uint32_t fs,
-  bool load_sdram
+  bool load_sdram, bool gen_onload
 ) {
   // Pre-load ROM header
   if (preload_gba_rom(fn, fs, &info->romh))
@@ -695,10 +677,12 @@ static bool prepare_gba_info(
   info->patches_cache_found = load_rom_patches(fn, &info->patches_cache);
   if (!info->patches_cache_found)
     info->patches_cache_found = load_cached_patches(fn, &info->patches_cache);
+  // Patches can also be generated on the fly while loading the ROM (SDRAM only).
+  info->patches_onload = load_sdram && gen_onload && !info->patches_cache_found;
 
   // If PatchAuto is selected, resolve it. Downgrade if not found.
   if (st->patch_policy == PatchAuto) {
-    if (info->patches_cache_found)
+    if (info->patches_cache_found || info->patches_onload)
       info->patch_type = PatchEngine;      // Try existing patches
     else if (info->patches_datab_found)
       info->patch_type = PatchDatabase;    // Try the database then
@@ -711,7 +695,7 @@ static bool prepare_gba_info(
       info->patch_type = PatchNone;
   }
   else if (st->patch_policy == PatchEngine) {
-    if (!info->patches_cache_found)
+    if (!info->patches_cache_found && !info->patches_onload)
       info->patch_type = PatchNone;
   }
   else
@@ -781,7 +765,7 @@ static void prepare_gba_settings(t_load_gba_lcfg *data, bool uses_dsaving, uint3
 }
 
 
-static void browser_open_gba(const char *fn, uint32_t fs, bool prompt_patchgen) {
+static void browser_open_gba(const char *fn, uint32_t fs, bool prompt_patchgen, bool gen_onload) {
   if (fs > MAX_GBA_ROM_SIZE) {
     // The ROM is too big to be loaded!
     spop.alert_msg = msgs[lang_id][MSG_ERR_TOOBIG];
@@ -801,7 +785,7 @@ static void browser_open_gba(const char *fn, uint32_t fs, bool prompt_patchgen)
     // The config file can be partial, hence the defaults.
     load_rom_settings(fn, &ld_sett, &lh_sett);
 
-    if (!prepare_gba_info(&spop.p.load.i, &ld_sett, fn, fs, true))
+    if (!prepare_gba_info(&spop.p.load.i, &ld_sett, fn, fs, true, gen_onload))
       spop.alert_msg = msgs[lang_id][MSG_ERR_READ];
     else {
       const t_rom_header *rmh = &spop.p.load.i.romh;
@@ -845,14 +829,14 @@ static void browser_open_gba(const char *fn, uint32_t fs, bool prompt_patchgen)
 }
 
 void patch_gen_callback(bool confirm) {
-  // Generate patches if confirm was selected
-  if (confirm) {
+  // Generate patches if confirm was selected (unless the loader can do it for us)
+  if (confirm && !patchgen_onload) {
     generate_patches_progress(spop.p.load.i.romfn, spop.p.load.i.romfs);
     spop.alert_msg = msgs[lang_id][MSG_PATCHGEN_OK];
   }
 
   // Either way, show the popup screen afterwards without prompt
-  browser_open_gba(spop.p.load.i.romfn, spop.p.load.i.romfs, false);
+  browser_open_gba(spop.p.load.i.romfn, spop.p.load.i.romfs, false, confirm && patchgen_onload);
 }
 
 const t_emu_loader * get_emu_info(const char *ext) {
@@ -867,7 +851,7 @@ static void load_patchdb_action(bool confirm) {
   if (confirm) {
     FIL fd;
     FRESULT res = f_open(&fd, spop.p.pdb_ld.fn, FA_READ);
-    if (res != FR_OK) {
+    if (res != FR_OK || spop.p.pdb_ld.fs > PATCH_DB_MAX_SIZE) {
       spop.alert_msg = msgs[lang_id][MSG_ERR_GENERIC];
       return;
     } else {
@@ -884,7 +868,18 @@ static void load_patchdb_action(bool confirm) {
         set_supercard_mode(MAPPED_SDRAM, true, true);
       }
     }
-    spop.alert_msg = msgs[lang_id][MSG_OK_GENERIC];
+
+    // Reject malformed DBs (or unordered ones that claim to be sorted).
+    set_supercard_mode(MAPPED_SDRAM, true, false);
+    bool dbok = patchmem_validate((uint8_t*)ROM_PATCHDB_U8, spop.p.pdb_ld.fs);
+    if (!dbok)
+      *(volatile uint32_t*)ROM_PATCHDB_U8 = 0;    // Invalidate signature
+    memset(&pdbinfo, 0, sizeof(pdbinfo));
+    if (dbok)
+      patchmem_dbinfo((uint8_t*)ROM_PATCHDB_U8, &pdbinfo.patch_count, pdbinfo.version, pdbinfo.date, pdbinfo.creator);
+    set_supercard_mode(MAPPED_SDRAM, true, true);
+
+    spop.alert_msg = msgs[lang_id][dbok ? MSG_OK_GENERIC : MSG_ERR_GENERIC];
   }
 }
 
@@ -1078,7 +1073,7 @@ static void browser_open(const char *fn, uint32_t fs) {
   unsigned l = strlen(fn);
   if (!strcasecmp(&fn[l-4], ".gba"))
     // GBA ROMs (most likely)
-    browser_open_gba(fn, fs, true);
+    browser_open_gba(fn, fs, true, false);
   else if (!strcasecmp(&fn[l-4], ".sav")) {
     spop.pop_num = POPUP_SAVFILE;
     spop.selector = SavMAX;
@@ -1135,7 +1130,7 @@ static void browser_open(const char *fn, uint32_t fs) {
           unsigned guesstype = guess_file_type((uint8_t*)tmphdr);
           switch (guesstype) {
           case FileTypeGBA:
-            browser_open_gba(fn, fs, true); break;
+            browser_open_gba(fn, fs, true, false); break;
           case FileTypeGB:
             start_emu_game(get_emu_info("gbc"), fn, fs);
             break;
@@ -1160,54 +1155,159 @@ static void browser_open(const char *fn, uint32_t fs) {
   }
 }
 
-static void browser_reload_filter() {
-  // Instead of sorting the actual list of files, which requires moving lots
-  // of memory, we use a list of pointers.
-  unsigned fcount = 0;
-  for (unsigned i = 0; i < smenu.browser.maxentries; i++) {
-    if ((sdr_state->fentries[i].attr & AM_HID) && hide_hidden)
-      continue;
+// Directories are listed progressively: the first entries are shown right
+// away, the rest are read (and merged into the sorted list) between frames.
+#define BROWSER_LOAD_MINMERGE       32   // Entries read before showing the list
+#define BROWSER_LOAD_MAXVCOUNT     150   // Stop reading entries past this line
+#define BROWSER_LOAD_STEPSECS        4   // Directory sectors read per step
+#define BROWSER_NOSEL              (~0U)
 
-    sdr_state->fileorder[fcount++] = &sdr_state->fentries[i];
-  }
+static DIR browser_dir;
+static bool browser_scan;     // Using dirscan (otherwise f_readdir)
+static bool browser_failed;   // Reading failed, the listing is incomplete
+
+// Returns the selected entry (its name arena offset, which never changes).
+static uint32_t browser_selected_id() {
+  if (smenu.browser.selector < 0 || smenu.browser.selector >= smenu.browser.dispentries)
+    return BROWSER_NOSEL;
+  return dirlist_get(&sdr_state->dirlist, smenu.browser.selector)->name;
+}
 
-  heapsort4(sdr_state->fileorder, fcount, sizeof(t_centry*) / sizeof(uint32_t), filesort);
+// Rebuilds the visible list. The selected entry (if any) keeps its row, so
+// that the cursor does not jump around while the list is still growing.
+static void browser_update_list(uint32_t selid) {
+  t_dirlist *dl = &sdr_state->dirlist;
+  const int row = smenu.browser.selector - smenu.browser.seloff;
+  if (smenu.browser.loading)
+    dirlist_view(dl, sdr_state->scratch, hide_hidden);
+  else
+    dirlist_filter(dl, hide_hidden);    // Entries are already sorted
+  int fcount = dl->visible;
+  smenu.browser.dispentries = fcount;
+  smenu.browser.maxentries = dl->count;
+
+  if (selid != BROWSER_NOSEL) {
+    for (int i = 0; i < fcount; i++) {
+      if (dirlist_get(dl, i)->name == selid) {
+        smenu.browser.selector = i;
+        smenu.browser.seloff = MAX(0, i - row);
+        return;
+      }
+    }
+  }
 
   if (smenu.browser.selector >= fcount)
     smenu.browser.selector = fcount - 1;
+  if (smenu.browser.selector < 0 && fcount)
+    smenu.browser.selector = 0;
   smenu.browser.seloff = MAX(0, smenu.browser.selector - BROWSER_ROWS / 2);
-  smenu.browser.dispentries = fcount;
+}
+
+// Reads more directory entries (the next one, or the next `maxsecs` sectors
+// worth of them when scanning), returns false at the end of the dir. Read
+// errors end it too, but they also set browser_failed.
+static bool browser_load_next(unsigned maxsecs) {
+  if (browser_scan) {
+    const bool more = dirscan_step(&sdr_state->dirscan, &sdr_state->dirlist, maxsecs);
+    browser_failed = sdr_state->dirscan.failed;
+    return more;
+  }
+
+  FILINFO info;
+  if (f_readdir(&browser_dir, &info) != FR_OK) {
+    browser_failed = true;
+    return false;
+  }
+  if (!info.fname[0])
+    return false;
+
+  // TODO: Support 4GB+ files?
+  return dirlist_add(&sdr_state->dirlist, info.fname, (uint32_t)info.fsize, info.fattrib);
+}
+
+// Sorts the complete list in place and caches it (if big enough, and only if
+// it was read without errors).
+static void browser_load_done(uint32_t selid) {
+  t_dirlist *dl = &sdr_state->dirlist;
+  dirlist_sort(dl, sdr_state->scratch);
+
+  // The signature is calculated now that the sort records are not needed.
+  t_dirsig sig;
+  if (!browser_failed && dl->count >= DIRCACHE_MIN_ENTRIES &&
+      dircache_signature(&browser_dir, sdr_state->scratch, scratch_mem_size, &sig))
+    dircache_save(smenu.browser.cpath, &sig, dl);
+
+  f_closedir(&browser_dir);
+  smenu.browser.loading = false;
+  browser_update_list(selid);
+}
+
+// Reads one more entry, merging the new ones once the list grows by 25%
+// (this keeps the total merging cost linear).
+static void browser_load_step() {
+  t_dirlist *dl = &sdr_state->dirlist;
+  if (!browser_load_next(BROWSER_LOAD_STEPSECS)) {
+    // Stick to the first entry if the user did not move.
+    browser_load_done(smenu.browser.selector > 0 ? browser_selected_id() : BROWSER_NOSEL);
+    return;
+  }
+
+  if (dl->count - dl->merged >= MAX(BROWSER_LOAD_MINMERGE, dl->merged / 4)) {
+    const uint32_t selid = smenu.browser.selector > 0 ? browser_selected_id() : BROWSER_NOSEL;
+    dirlist_merge(dl, sdr_state->scratch);
+    browser_update_list(selid);
+  }
+}
+
+// Completes any pending directory listing right away.
+static void browser_load_finish() {
+  if (smenu.browser.loading) {
+    const uint32_t selid = browser_selected_id();
+    while (browser_load_next(~0U));
+    browser_load_done(selid);
+  }
 }
 
 // Loads a new directory list in the ROM browser.
 // TODO: Implement filtering (.gba/.rom/.bin... etc) using settings
 static void browser_reload() {
   smenu.anim_state = 0;
+  smenu.browser.jumplen = 0;
+  if (smenu.browser.loading) {
+    f_closedir(&browser_dir);
+    smenu.browser.loading = false;
+  }
 
-  unsigned fcount = 0;
-  DIR d;
-  if (FR_OK != f_opendir(&d, smenu.browser.cpath))
+  if (FR_OK != f_opendir(&browser_dir, smenu.browser.cpath))
     return;   // FIXME: Implement error reporting!
+  smenu.browser.dispentries = 0;
+
+  // Big directories are cached (sorted), as long as they remain unchanged.
+  t_dirlist *dl = &sdr_state->dirlist;
+  t_dirsig sig;
+  if (dircache_probe(smenu.browser.cpath) &&
+      dircache_signature(&browser_dir, sdr_state->scratch, scratch_mem_size, &sig) &&
+      dircache_load(smenu.browser.cpath, &sig, dl)) {
+    f_closedir(&browser_dir);
+    browser_update_list(BROWSER_NOSEL);
+    return;
+  }
 
-  while (1) {
-    FILINFO info;
-    if (f_readdir(&d, &info) != FR_OK || !info.fname[0])
-      break;
+  // Raw directory sectors are parsed in bulk, unless the FAT is not usable.
+  dirlist_reset(dl);
+  browser_failed = false;
+  browser_scan = dirscan_open(&sdr_state->dirscan, &browser_dir,
+                              &sdr_state->scratch[DIRLIST_SORTBUF_SIZE], BROWSER_SCANBUF_SIZE);
 
-    if (fcount >= BROWSER_MAXFN_CNT)
-      break;
-
-    t_centry *e = &sdr_state->fentries[fcount++];
-    e->filesize = (uint32_t) info.fsize;  // TODO: Support 4GB+ files?
-    e->isdir = (info.fattrib & AM_DIR) ? 1 : 0;
-    e->attr = info.fattrib;
-    dma_memcpy16(e->fname, info.fname, MAX_FN_LEN/2);
-    sortable_utf8_u16(info.fname, e->sortname);
+  // Read the first entries now (so there is something to show), the rest is
+  // loaded by menu_work(). Restoring a selector needs the full list though.
+  smenu.browser.loading = true;
+  if (smenu.browser.selector)
+    browser_load_finish();
+  else {
+    while (smenu.browser.loading && !dl->merged)
+      browser_load_step();
   }
-  smenu.browser.maxentries = fcount;
-
-  // Filter and sort list of files/dirs
-  browser_reload_filter();
 }
 
 // Loads NOR game entries so they can be browsed.
@@ -1230,8 +1330,19 @@ static void flashbrowser_reload() {
   }
   smenu.fbrowser.freeblks = NOR_GAMEBLOCK_COUNT - smenu.fbrowser.usedblks;
 
-  smenu.fbrowser.maxentries = sdr_state->nordata.gamecnt;
-  heapsort4(sdr_state->nordata.games, smenu.fbrowser.maxentries, sizeof(t_flash_game_entry) / sizeof(uint32_t), romsort);
+  // Sort an index using the names sort keys, entries stay in place.
+  uint16_t *keys = (uint16_t*)sdr_state->scratch;
+  t_sortrec *recs = (t_sortrec*)&keys[FLASHG_MAXFN_CNT * MAX_FN_LEN];
+  const unsigned cnt = sdr_state->nordata.gamecnt;
+  for (unsigned i = 0; i < cnt; i++) {
+    const t_flash_game_entry *e = &sdr_state->nordata.games[i];
+    sortable_utf8_u16(&e->game_name[e->bnoffset], &keys[i * MAX_FN_LEN]);
+    sortrec_init(&recs[i], &keys[i * MAX_FN_LEN], 0, i);
+  }
+  const t_sortrec *sorted = sortrec_sort(recs, &recs[cnt], cnt, norgame_key, keys);
+  for (unsigned i = 0; i < cnt; i++)
+    smenu.fbrowser.order[i] = sorted[i].idx;
+  smenu.fbrowser.maxentries = cnt;
   #endif
 }
 
@@ -1423,7 +1534,7 @@ void render_flashbrowser(volatile uint8_t *frame) {
       if (smenu.fbrowser.seloff + i >= smenu.fbrowser.maxentries)
         break;
 
-      t_flash_game_entry *e = &sdr_state->nordata.games[smenu.fbrowser.seloff + i];
+      t_flash_game_entry *e = fbrowser_entry(smenu.fbrowser.seloff + i);
       render_icon(2, (i+1)*16, ICON_GBACART);
 
       // Animate the row entries if they are too long!
@@ -1459,18 +1570,20 @@ void render_browser(volatile uint8_t *frame) {
   // Render bar below to show path URI
   dma_memset16(&frame[240*144], dup8(FG_COLOR), 240*16/2);
 
-  if (!smenu.browser.dispentries)
-    draw_central_text(msgs[lang_id][MSG_BROW_EMPTY], frame, SCREEN_WIDTH/2, SCREEN_HEIGHT/2-8);
-  else {
+  if (!smenu.browser.dispentries) {
+    if (!smenu.browser.loading)
+      draw_central_text(msgs[lang_id][MSG_BROW_EMPTY], frame, SCREEN_WIDTH/2, SCREEN_HEIGHT/2-8);
+  } else {
     for (unsigned i = 0; i < BROWSER_ROWS; i++) {
       if (smenu.browser.seloff + i >= smenu.browser.dispentries)
         break;
 
-      t_centry *e = sdr_state->fileorder[smenu.browser.seloff + i];
+      const t_dirent *e = dirlist_get(&sdr_state->dirlist, smenu.browser.seloff + i);
+      const char *fname = dirlist_name(&sdr_state->dirlist, e);
 
       unsigned iconidx = (e->attr & AM_HID) ? ((e->attr & AM_DIR) ? ICON_HFOLDER : ICON_HFILE) :
                          (e->attr & AM_DIR) ? ICON_FOLDER :
-                         guessicon(e->fname);
+                         guessicon(fname);
 
       render_icon(2, (i+1)*16, iconidx);
 
@@ -1480,21 +1593,39 @@ void render_browser(volatile uint8_t *frame) {
 
       // Animate the row entries if they are too long!
       if (i == smenu.browser.selector - smenu.browser.seloff)
-        draw_text_ovf_rotate(e->fname, frame, 20, (1 + i) * 16,
+        draw_text_ovf_rotate(fname, frame, 20, (1 + i) * 16,
                              SCREEN_WIDTH - 26 - font_width(szstr), &smenu.anim_state);
       else
-        draw_text_ovf(e->fname, frame, 20, (1 + i) * 16, SCREEN_WIDTH - 26 - font_width(szstr));
+        draw_text_ovf(fname, frame, 20, (1 + i) * 16, SCREEN_WIDTH - 26 - font_width(szstr));
     }
 
     for (unsigned i = 0; i < 240; i += 16)
       render_icon_trans(i, (smenu.browser.selector - smenu.browser.seloff + 1)*16, 63);
   }
 
-  // Draw path, cut left part if necessary.
-  draw_text_leftovf(smenu.browser.cpath, frame, 8, 144, SCREEN_WIDTH - 8);
+  if (smenu.browser.jumplen) {
+    // Jump picker prefix, the last char is the one being picked.
+    char jstr[BROWSER_JUMP_MAXLEN + 3];
+    unsigned n = 0;
+    for (unsigned i = 0; i < smenu.browser.jumplen; i++) {
+      const char c = smenu.browser.jump[i];
+      if (i == smenu.browser.jumplen - 1U)
+        jstr[n++] = '[';
+      jstr[n++] = (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+    }
+    jstr[n++] = ']';
+    jstr[n] = 0;
+    draw_box_full(frame, 2, 16 + font_width(jstr), 144, 160, FG_COLOR, HI_COLOR);
+    draw_text_ovf(jstr, frame, 8, 144, SCREEN_WIDTH - 8);
+  }
+  else {
+    // Draw path, cut left part if necessary.
+    draw_text_leftovf(smenu.browser.cpath, frame, 8, 144, SCREEN_WIDTH - 8);
+  }
 
   char selinfo[16];
-  npf_snprintf(selinfo, sizeof(selinfo), "%u/%d", smenu.browser.selector + 1, smenu.browser.dispentries);
+  npf_snprintf(selinfo, sizeof(selinfo), "%u/%d%s", smenu.browser.selector + 1, smenu.browser.dispentries,
+               smenu.browser.loading ? "+" : "");
   draw_rightj_text(selinfo, frame, SCREEN_WIDTH - 1, 1);
 }
 
@@ -1680,8 +1811,8 @@ void render_filemgr(volatile uint8_t *frame) {
   // Draw the file name and the options available
   draw_box_outline(frame, 2, 240-2, 18, 158, FG_COLOR);
 
-  t_centry *e = sdr_state->fileorder[smenu.browser.selector];
-  const char *bn = file_basename(e->fname);
+  const t_dirent *e = dirlist_get(&sdr_state->dirlist, smenu.browser.selector);
+  const char *bn = file_basename(dirlist_name(&sdr_state->dirlist, e));
 
   unsigned twidth = font_width(bn);
   if (twidth > SCREEN_WIDTH - 20)
@@ -1737,7 +1868,7 @@ void render_gba_norload(volatile uint8_t *frame) {
   draw_text_ovf("⯇", frame, 10, 23, 64);
   draw_rightj_text("⯈", frame, SCREEN_WIDTH - 10, 23);
 
-  t_flash_game_entry *e = &sdr_state->nordata.games[smenu.fbrowser.selector];
+  t_flash_game_entry *e = fbrowser_entry(smenu.fbrowser.selector);
   if (spop.submenu == GbaLoadPopInfo) {
     int save_type = GET_GATTR_SAVEM(e->gattrs);
     render_gbarom_info(frame, e->game_name, false, (const char*)&e->gamecode, e->gamever, save_type);
@@ -1931,6 +2062,11 @@ void render_settings(volatile uint8_t *frame) {
   }
 
   if (msk & 0x40000) {
+    draw_text_ovf(msgs[lang_id][MSG_LOADER_PGLOAD], frame, 8, offy + rowh*optcnt, 224);
+    draw_central_text(msgs[lang_id][patchgen_onload ? MSG_KNOB_ENABLED : MSG_KNOB_DISABLED], frame, colx, offy + rowh*optcnt++);
+  }
+
+  if (msk & 0x80000) {
     draw_button_box(frame, 20, 220, 112, 132, smenu.set.selector == SettSave);
     draw_central_text(msgs[lang_id][MSG_UIS_SAVE], frame, 132, 114);
   }
@@ -1954,6 +2090,7 @@ void render_settings(volatile uint8_t *frame) {
                         smenu.set.selector == DefsLoadPol  ? MSG_DEF_LOADP_I0 + (autoload_default ^ 1) :
                         smenu.set.selector == DefsSavePol  ? MSG_DEF_SAVEP_I0 + (autosave_default ^ 1) :
                         smenu.set.selector == DefsPrefDS   ? MSG_LOADER_PREFDSI :
+                        smenu.set.selector == DefsPatchLd  ? MSG_LOADER_PGLOADI :
                         MSG_EMPTY;
     draw_text_ovf_rotate(msgs[lang_id][help_msg], frame, 4, SCREEN_HEIGHT - 18, 232, &smenu.anim_state);
   }
@@ -2041,6 +2178,36 @@ void render_info(volatile uint8_t *frame) {
     npf_snprintf(tmp, sizeof(tmp), "Card ID: %02x | %04x", sd_info.manufacturer, sd_info.oemid);
     draw_central_text(tmp, frame, 120, 110);
     break;
+  case 4:
+    {
+      const t_sd_stats *st = sdcard_get_stats();
+      npf_snprintf(tmp, sizeof(tmp), "Rd: %lu ops | %lu rtr | %lu err", st->rd_ops, st->rd_retries, st->rd_errors);
+      draw_central_text(tmp, frame, 120, 70);
+      npf_snprintf(tmp, sizeof(tmp), "Wr: %lu ops | %lu rtr | %lu err", st->wr_ops, st->wr_retries, st->wr_errors);
+      draw_central_text(tmp, frame, 120, 88);
+      npf_snprintf(tmp, sizeof(tmp), "Latency: %lu | %lu us", st->rd_lat_us, st->wr_busy_us);
+      draw_central_text(tmp, frame, 120, 106);
+      npf_snprintf(tmp, sizeof(tmp), "Timeouts: %lu | %lu ms", st->rd_tmo_ms, st->wr_tmo_ms);
+      draw_central_text(tmp, frame, 120, 124);
+    }
+    break;
+  case 5:
+    if (!smenu.info.has_bench)
+      draw_central_text("No benchmark results", frame, 120, 95);
+    else {
+      const t_sdbench_results *r = &smenu.info.bench;
+      npf_snprintf(tmp, sizeof(tmp), "Random 512B: %u IOPS", r->rnd_iops);
+      draw_central_text(tmp, frame, 120, 58);
+      npf_snprintf(tmp, sizeof(tmp), "Seq: %u | %u | %u KiB/s", r->seq_kbs[0], r->seq_kbs[1], r->seq_kbs[2]);
+      draw_central_text(tmp, frame, 120, 74);
+      npf_snprintf(tmp, sizeof(tmp), "Write: %u | %u KiB/s", r->wr_kbs[0], r->wr_kbs[1]);
+      draw_central_text(tmp, frame, 120, 90);
+      npf_snprintf(tmp, sizeof(tmp), "FatFs: %u rd | %u wr KiB/s", r->fread_kbs, r->fwrite_kbs);
+      draw_central_text(tmp, frame, 120, 106);
+      npf_snprintf(tmp, sizeof(tmp), "SDRAM DMA: %u KiB/s", r->dma_kbs);
+      draw_central_text(tmp, frame, 120, 122);
+    }
+    break;
   }
 
   // Flashing info
@@ -2148,6 +2315,12 @@ void menu_render(unsigned fcnt) {
   }
 }
 
+// Keeps loading the current directory until the frame is almost over.
+void menu_work() {
+  while (smenu.browser.loading && REG_VCOUNT < BROWSER_LOAD_MAXVCOUNT)
+    browser_load_step();
+}
+
 void menu_flip() {
   for (unsigned i = 0; i < objnum; i++) {
     MEM_OAM[i*4+0] = fobjs[i].y | 0x2000;  // Use 256 entries palette
@@ -2166,8 +2339,8 @@ void menu_init(int sram_testres) {
 
   // Reset the file browser as well.
   strcpy(smenu.browser.cpath, "/");
+  flashbrowser_reload();    // Uses the scratch area, do it before browsing
   browser_reload();
-  flashbrowser_reload();
 
   // Load recent ROMs (we could disable this for speed)
   recent_reload();
@@ -2225,17 +2398,22 @@ void start_flash_update(const char *fn, unsigned fwsize, bool validate_superfw)
     // Loading file...
     spop.p.update.curr_state = FlashingLoading;
     menu_render(1); menu_flip();
+    t_file_extents fe;
+    fext_map(&fe, &fd);
+    sdcard_set_verified_reads(true);
     for (unsigned i = 0; i < fwsize; i += 4*1024) {
       UINT rdbytes;
       unsigned tord = fwsize >= i + 4*1024 ? 4*1024 : fwsize - i;
       uint32_t tmp[1024];
-      if (FR_OK != f_read(&fd, tmp, tord, &rdbytes) || rdbytes != tord) {
+      if (FR_OK != fext_read(&fe, i, tmp, tord, &rdbytes) || rdbytes != tord) {
+        sdcard_set_verified_reads(false);
         spop.alert_msg = msgs[lang_id][MSG_FWUP_ERRRD];
         return;
       }
       // Copy (ensure aligned copy!)
       dma_memcpy32(&sdr_state->scratch[i], tmp, 1024);
     }
+    sdcard_set_verified_reads(false);
     spop.p.update.curr_state = FlashingChecking;
     menu_render(1); menu_flip();
 
@@ -2331,7 +2509,7 @@ static void keypress_popup_loadgba(unsigned newkeys) {
     }
 
     // Handle the different cases where the user attempts to select an invalid option.
-    if (!spop.p.load.i.patches_cache_found && spop.p.load.i.patch_type == PatchEngine)
+    if (!spop.p.load.i.patches_cache_found && !spop.p.load.i.patches_onload && spop.p.load.i.patch_type == PatchEngine)
       spop.p.load.i.patch_type = PatchDatabase;  // Might be invalid, handled below.
     if (!spop.p.load.i.patches_datab_found && spop.p.load.i.patch_type == PatchDatabase)
       spop.p.load.i.patch_type = PatchNone;
@@ -2380,7 +2558,7 @@ static void keypress_popup_loadgba(unsigned newkeys) {
     // If the database has no entry, then do not let the user select that mode.
     if (!spop.p.load.i.patches_datab_found && spop.p.load.i.patch_type == PatchDatabase)
       spop.p.load.i.patch_type = PatchEngine;  // Might be invalid, handled below.
-    if (!spop.p.load.i.patches_cache_found && spop.p.load.i.patch_type == PatchEngine)
+    if (!spop.p.load.i.patches_cache_found && !spop.p.load.i.patches_onload && spop.p.load.i.patch_type == PatchEngine)
       spop.p.load.i.patch_type = PatchNone;
 
     if (!dirsav_avail_sdram(&spop.p.load.i))
@@ -2474,6 +2652,7 @@ static void keypress_popup_loadgba(unsigned newkeys) {
 
       unsigned err = load_gba_rom(
         spop.p.load.i.romfn, spop.p.load.i.romfs, p,
+        game_patch_pending(&spop.p.load.i),
         spop.p.load.l.sram_save_type == SaveDirect ? &dsinfo : NULL,
         spop.p.load.i.ingame_menu_enabled,
         spop.p.load.i.rtc_patch_enabled ? &rtci : NULL,
@@ -2606,11 +2785,13 @@ static void keypress_popup_norwrite(unsigned newkeys) {
         flashmgr_allocate_blocks(ne.blkmap, blkcnt, (t_reg_entry*)&sdr_state->nordata);
 
         // Go ahead and start the flasher-loader with patching support.
+        sdcard_set_verified_reads(true);
         unsigned errc = flash_gba_nor(info->romfn, info->romfs, &info->romh, p,
                                       info->use_dsaving, info->ingame_menu_enabled,
                                       info->rtc_patch_enabled,
                                       ne.blkmap, loadrom_progress,
                                       sdr_state->scratch, scratch_mem_size);
+        sdcard_set_verified_reads(false);
         if (errc)
           spop.alert_msg = msgs[lang_id][errc == ERR_LOAD_BADROM ? MSG_ERR_READ : MSG_ERR_NORUPD];
         else {
@@ -2637,7 +2818,7 @@ static void keypress_popup_norload(unsigned newkeys) {
   if (newkeys & KEY_BUTTDOWN)
     spop.selector = MIN(GBALdSetCNT - 1, spop.selector + 1);
 
-  const t_flash_game_entry *e = &sdr_state->nordata.games[smenu.fbrowser.selector];
+  const t_flash_game_entry *e = fbrowser_entry(smenu.fbrowser.selector);
   bool uses_dsave = e->gattrs & GATTR_SAVEDS;
   bool uses_igm   = e->gattrs & GATTR_IGM;
   bool uses_rtc   = e->gattrs & GATTR_RTC;
@@ -2705,7 +2886,7 @@ static void keypress_popup_norload(unsigned newkeys) {
 
   if (newkeys & KEY_BUTTA) {
     if (spop.submenu == GbaLoadPopInfo) {
-      const t_flash_game_entry *e = &sdr_state->nordata.games[smenu.fbrowser.selector];
+      const t_flash_game_entry *e = fbrowser_entry(smenu.fbrowser.selector);
       const int stype = GET_GATTR_SAVEM(e->gattrs);
       const EnumSavetype st = stype < 0 ? SaveTypeNone : stype;
       bool uses_dsave = e->gattrs & GATTR_SAVEDS;
@@ -2751,7 +2932,7 @@ static void keypress_popup_norload(unsigned newkeys) {
         .rtcts = spop.p.norld.l.rtcval
       };
 
-      const t_flash_game_entry *e = &sdr_state->nordata.games[smenu.fbrowser.selector];
+      const t_flash_game_entry *e = fbrowser_entry(smenu.fbrowser.selector);
 
       // We load the loading settings to ensure we do not overwrite them.
       load_rom_settings(e->game_name, &ld_sett, NULL);
@@ -2778,14 +2959,15 @@ static void keypress_popup_filemgr(unsigned newkeys) {
     spop.selector = MIN(FiMgrCNT - 1, spop.selector + 1);
 
   if (newkeys & KEY_BUTTA) {
-    t_centry *e = sdr_state->fileorder[smenu.browser.selector];
+    t_dirent *e = dirlist_get(&sdr_state->dirlist, smenu.browser.selector);
     switch (spop.selector) {
     case FiMgrDelete:
       {
         void remove_file_action(bool confirm) {
           char tmpfn[MAX_FN_LEN];
           strcpy(tmpfn, smenu.browser.cpath);
-          strcat(tmpfn, sdr_state->fileorder[smenu.browser.selector]->fname);
+          strcat(tmpfn, dirlist_name(&sdr_state->dirlist,
+                        dirlist_get(&sdr_state->dirlist, smenu.browser.selector)));
 
           if (confirm) {
             if (FR_OK != f_unlink(tmpfn))
@@ -2808,7 +2990,7 @@ static void keypress_popup_filemgr(unsigned newkeys) {
       {
         char tmpfn[MAX_FN_LEN];
         strcpy(tmpfn, smenu.browser.cpath);
-        strcat(tmpfn, sdr_state->fileorder[smenu.browser.selector]->fname);
+        strcat(tmpfn, dirlist_name(&sdr_state->dirlist, e));
 
         if (FR_OK == f_chmod(tmpfn, e->attr ^ AM_HID, AM_HID))
           e->attr ^= AM_HID;
@@ -2825,7 +3007,7 @@ static void keypress_popup_filemgr(unsigned newkeys) {
       else {
         char path[MAX_FN_LEN];
         strcpy(path, smenu.browser.cpath);
-        strcat(path, e->fname);
+        strcat(path, dirlist_name(&sdr_state->dirlist, e));
 
         // Load default loading settings if any.
         t_rom_load_settings ld_sett = {
@@ -2836,7 +3018,7 @@ static void keypress_popup_filemgr(unsigned newkeys) {
         };
         load_rom_settings(path, &ld_sett, NULL);
 
-        if (!prepare_gba_info(&spop.p.norwr.i, &ld_sett, path, e->filesize, false))
+        if (!prepare_gba_info(&spop.p.norwr.i, &ld_sett, path, e->filesize, false, false))
           spop.alert_msg = msgs[lang_id][MSG_ERR_READ];
         else {
           spop.pop_num = POPUP_GBA_NORWRITE;
@@ -2896,6 +3078,100 @@ static void keypress_menu_recent(unsigned newkeys) {
     smenu.recent.seloff = smenu.recent.selector - RECENT_ROWS + 1;
 }
 
+// Jump picker: the cursor jumps to the first entry whose sort key starts with
+// the picked prefix (see dirlist_seek), so moving around huge directories
+// takes a few key presses. Only plain ASCII chars can be picked.
+static int browser_jump_seek() {
+  uint16_t key[BROWSER_JUMP_MAXLEN + 1];
+  for (unsigned i = 0; i < smenu.browser.jumplen; i++)
+    key[i] = (uint8_t)smenu.browser.jump[i];
+  key[smenu.browser.jumplen] = 0;
+  return dirlist_seek(&sdr_state->dirlist, key);
+}
+
+static void browser_jump_to(int pos) {
+  smenu.browser.selector = pos;
+  smenu.browser.seloff = MAX(0, MIN(pos, smenu.browser.dispentries - BROWSER_ROWS));
+  smenu.anim_state = 0;
+}
+
+// Picks the previous/next char (in key order) for the last prefix position,
+// skipping those without matching entries.
+static void browser_jump_cycle(int dir) {
+  char *c = &smenu.browser.jump[smenu.browser.jumplen - 1];
+  const char orig = *c;
+  do {
+    *c += dir;
+    if (*c >= 'A' && *c <= 'Z')
+      *c = dir > 0 ? 'Z' + 1 : 'A' - 1;   // Keys are case folded
+    if (*c < ' ')
+      *c = '~';
+    else if (*c > '~')
+      *c = ' ';
+
+    const int pos = browser_jump_seek();
+    if (pos >= 0) {
+      browser_jump_to(pos);
+      return;
+    }
+  } while (*c != orig);
+}
+
+static void browser_jump_open() {
+  const t_dirent *e = dirlist_get(&sdr_state->dirlist, smenu.browser.selector);
+  const uint16_t c = *dirlist_key(&sdr_state->dirlist, e);
+  smenu.browser.jumpsel = smenu.browser.selector;
+  smenu.browser.jumpoff = smenu.browser.seloff;
+  smenu.browser.jumplen = 1;
+  smenu.browser.jump[0] = (c >= ' ' && c <= '~') ? c : ' ';
+
+  const int pos = browser_jump_seek();
+  if (pos >= 0)
+    browser_jump_to(pos);
+  else
+    browser_jump_cycle(1);
+}
+
+static void keypress_browser_jump(unsigned newkeys) {
+  if (newkeys & KEY_BUTTB) {
+    // Cancel, go back to the original entry.
+    smenu.browser.selector = smenu.browser.jumpsel;
+    smenu.browser.seloff = smenu.browser.jumpoff;
+    smenu.browser.jumplen = 0;
+  }
+  else if (newkeys & (KEY_BUTTA | KEY_BUTTSTA))
+    smenu.browser.jumplen = 0;
+  else if (newkeys & (KEY_BUTTL | KEY_BUTTR)) {
+    // Previous/next initial (drops the rest of the prefix).
+    smenu.browser.jumplen = 1;
+    browser_jump_cycle((newkeys & KEY_BUTTL) ? -1 : 1);
+  }
+  else if (newkeys & (KEY_BUTTUP | KEY_BUTTDOWN))
+    browser_jump_cycle((newkeys & KEY_BUTTUP) ? -1 : 1);
+  else if (newkeys & KEY_BUTTRIGHT) {
+    // Type ahead: the next char comes from the selected entry.
+    const t_dirent *e = dirlist_get(&sdr_state->dirlist, smenu.browser.selector);
+    const uint16_t *key = dirlist_key(&sdr_state->dirlist, e);
+    const unsigned n = smenu.browser.jumplen;
+    if (n < BROWSER_JUMP_MAXLEN && key[n] >= ' ' && key[n] <= '~') {
+      smenu.browser.jump[smenu.browser.jumplen++] = key[n];
+      const int pos = browser_jump_seek();
+      if (pos >= 0)
+        browser_jump_to(pos);
+      else
+        smenu.browser.jumplen--;    // No match, keep the previous prefix
+    }
+  }
+  else if ((newkeys & KEY_BUTTLEFT) && smenu.browser.jumplen > 1) {
+    smenu.browser.jumplen--;
+    const int pos = browser_jump_seek();
+    if (pos >= 0)
+      browser_jump_to(pos);
+    else
+      smenu.browser.jumplen++;
+  }
+}
+
 static void keypress_menu_browse(unsigned newkeys) {
   if (smenu.browser.dispentries) {
     // Move menu up and down
@@ -2913,9 +3189,10 @@ static void keypress_menu_browse(unsigned newkeys) {
     }
     // Move into a new dir and/or open a file
     if (newkeys & KEY_BUTTA) {
-      t_centry *e = sdr_state->fileorder[smenu.browser.selector];
-      if (e->isdir) {
-        strcat(smenu.browser.cpath, e->fname);
+      const t_dirent *e = dirlist_get(&sdr_state->dirlist, smenu.browser.selector);
+      const char *fname = dirlist_name(&sdr_state->dirlist, e);
+      if (e->attr & AM_DIR) {
+        strcat(smenu.browser.cpath, fname);
         strcat(smenu.browser.cpath, "/");
         // Push selector history and reset it in the new dir
         memmove(&smenu.browser.selhist[1], &smenu.browser.selhist[0],
@@ -2926,8 +3203,10 @@ static void keypress_menu_browse(unsigned newkeys) {
       } else {
         char path[MAX_FN_LEN];
         strcpy(path, smenu.browser.cpath);
-        strcat(path, e->fname);
-        browser_open(path, e->filesize);
+        strcat(path, fname);
+        const uint32_t fs = e->filesize;
+        browser_load_finish();    // Loading might need the scratch area
+        browser_open(path, fs);
       }
     }
     else if (newkeys & KEY_BUTTSEL) {
@@ -2936,6 +3215,8 @@ static void keypress_menu_browse(unsigned newkeys) {
       spop.anim = 0;
       spop.selector = 0;
     }
+    else if (newkeys & KEY_BUTTSTA)
+      browser_jump_open();
   }
   if (newkeys & KEY_BUTTB) {
     // Try to go up in the dir structure
@@ -2972,7 +3253,7 @@ static void keypress_menu_norbrowse(unsigned newkeys) {
     }
 
     if (newkeys & KEY_BUTTA) {
-      t_flash_game_entry *e = &sdr_state->nordata.games[smenu.fbrowser.selector];
+      t_flash_game_entry *e = fbrowser_entry(smenu.fbrowser.selector);
 
       // Use attributes to determine patched save method.
       const bool game_no_save = GET_GATTR_SAVEM(e->gattrs) <= SaveTypeNone;
@@ -3002,10 +3283,11 @@ static void keypress_menu_norbrowse(unsigned newkeys) {
           return;
 
         // Remove game entry, just memmove the other games on top.
+        const unsigned idx = smenu.fbrowser.order[smenu.fbrowser.selector];
         sdr_state->nordata.gamecnt--;
-        memmove32(&sdr_state->nordata.games[smenu.fbrowser.selector],
-                  &sdr_state->nordata.games[smenu.fbrowser.selector + 1],
-                  (sdr_state->nordata.gamecnt - smenu.fbrowser.selector) * sizeof(t_flash_game_entry));
+        memmove32(&sdr_state->nordata.games[idx],
+                  &sdr_state->nordata.games[idx + 1],
+                  (sdr_state->nordata.gamecnt - idx) * sizeof(t_flash_game_entry));
 
         // Go ahead and write a new metadata entry;
         if (!flashmgr_store(ROM_FLASHMETA_ADDR, FLASH_METADATA_SIZE, (t_reg_entry*)&sdr_state->nordata))
@@ -3076,6 +3358,8 @@ static void keypress_menu_settings(unsigned newkeys) {
       autosave_default ^= 1;
     else if (smenu.set.selector == DefsPrefDS)
       autosave_prefer_ds ^= 1;
+    else if (smenu.set.selector == DefsPatchLd)
+      patchgen_onload ^= 1;
     else if (smenu.set.selector == SettFastSD)
       use_slowld ^= 1;
     else if (smenu.set.selector == SettFastEWRAM)
@@ -3174,13 +3458,30 @@ static void keypress_menu_tools(unsigned newkeys) {
     }
     else if (smenu.tools.selector == ToolsSDBench) {
       slowsd = use_slowld;
-      int ret = sdbench_read(loadrom_progress_abort);
+      int ret = sdbench_run(&smenu.info.bench, sd_info.block_cnt, sdr_state->scratch,
+                            scratch_mem_size, loadrom_progress_abort);
       slowsd = true;
       if (ret < 0)
         spop.alert_msg = msgs[lang_id][MSG_ERR_GENERIC];
-      else {
-        unsigned speed = 8*1024*1024 / (unsigned)ret;
+      else if (ret > 0) {
+        // Results are shown in the Info tab and appended to the CSV log.
+        smenu.info.has_bench = true;
+        sdbench_save_log(&smenu.info.bench, &sd_info);
+
+        unsigned speed = smenu.info.bench.seq_kbs[SDBENCH_SEQ_SIZES - 1];
         npf_snprintf(smenu.info.tstr, sizeof(smenu.info.tstr), msgs[lang_id][MSG_BENCHSPD], speed);
+
+        // Compare both ROM loading paths, over the last played ROM (if any).
+        // The batched path goes first, so that any card caching favours the legacy one.
+        if (smenu.recent.maxentries) {
+          const char *fn = sdr_state->rentries[0].fpath;
+          slowsd = use_slowld;
+          int ldnew = sdbench_load(fn, sdr_state->scratch, scratch_mem_size, true, loadrom_progress_abort);
+          int ldold = ldnew > 0 ? sdbench_load(fn, sdr_state->scratch, scratch_mem_size, false, loadrom_progress_abort) : 0;
+          slowsd = true;
+          if (ldold > 0)
+            npf_snprintf(smenu.info.tstr, sizeof(smenu.info.tstr), msgs[lang_id][MSG_BENCHLDSPD], speed, ldnew, ldold);
+        }
         spop.alert_msg = smenu.info.tstr;
       }
     }
@@ -3220,13 +3521,28 @@ static void keypress_menu_tools(unsigned newkeys) {
 
 static void keypress_menu_info(unsigned newkeys) {
   if (newkeys & KEY_BUTTA)
-    smenu.info.selector = (smenu.info.selector + 1) % 4;
+    smenu.info.selector = (smenu.info.selector + 1) % 6;
   if ((newkeys & FLASH_UNLOCK_KEYS) == FLASH_UNLOCK_KEYS)
     enable_flashing = true;
 }
 
 
+// Moving around (and changing dirs) is fine while a directory is loading,
+// anything else might need the full list or the scratch area.
+static bool browsing_keys(unsigned newkeys) {
+  const unsigned navkeys = KEY_BUTTUP | KEY_BUTTDOWN | KEY_BUTTLEFT | KEY_BUTTRIGHT |
+                           KEY_BUTTL | KEY_BUTTR;
+  if (!(newkeys & ~navkeys))
+    return true;
+  return !(newkeys & ~(navkeys | KEY_BUTTA | KEY_BUTTB)) &&
+         smenu.menu_tab == MENUTAB_ROMBROWSE && !spop.pop_num &&
+         !spop.alert_msg && !spop.qpop.message && !spop.rtcpop.callback;
+}
+
 void menu_keypress(unsigned newkeys) {
+  if (smenu.browser.loading && !browsing_keys(newkeys))
+    browser_load_finish();
+
   if (spop.alert_msg) {
     // Modal message pop up!
     if (newkeys & (KEY_BUTTA | KEY_BUTTB))
@@ -3295,7 +3611,10 @@ void menu_keypress(unsigned newkeys) {
       };
       keyfns[spop.pop_num](newkeys);
     }
-  } else {
+  }
+  else if (smenu.browser.jumplen)
+    keypress_browser_jump(newkeys);   // Browser jump picker (modal too)
+  else {
     // Menu change via trigger buttons
     int mintab = (recent_menu && smenu.recent.maxentries) ? MENUTAB_RECENT : MENUTAB_ROMBROWSE;
     if (newkeys & KEY_BUTTL)
@@ -24,7 +24,11 @@
 #include "util.h"
 #include "save.h"
 #include "supercard_driver.h"
+#include "fileextent.h"
+#include "nanoprintf.h"
+#include "gbahw.h"
 #include "fatfs/ff.h"
+#include "fatfs/diskio.h"
 
 static const uint32_t start_seed = 0xdeadbeef;
 static uint32_t lcg32(uint32_t s) {
@@ -135,29 +139,170 @@ int check_peding_sram_test() {
   return -1;
 }
 
-// Tests the SD card by reading blocks (directly) and discarding the data.
-NOINLINE int sdbench_read(progress_abort_fn progcb) {
-  // Just read consecutive blocks without repeating them (to avoid any caching)
-  // Assume ~1MB/s read rate, aim for 8 seconds aprox. Read 8MiB in 8KiB blocks.
+// SD/storage benchmark suite. Raw reads go to the driver directly (to avoid
+// the diskio cache), raw writes go through diskio (to keep it coherent) and
+// only ever touch the sectors of a temporary (contiguous) file.
+
+#define BENCH_BUF_BLOCKS        16                    // 8KiB requests (on stack)
+#define BENCH_RND_READS        512
+#define BENCH_SEQ_BYTES        (2*1024*1024)
+#define BENCH_FILE_BYTES       (1024*1024)
+#define BENCH_DMA_BYTES        (8*1024*1024)
+#define BENCH_PHASES             9
+
+static const unsigned bench_seq_blocks[SDBENCH_SEQ_SIZES] = { 1, 4, 16 };
+
+// Converts frames to milliseconds, do math in 1K microseconds.
+unsigned frames_ms(unsigned frames) {
+  return MAX(1, (frames * 17067) >> 10);
+}
+
+static unsigned rate_kbs(unsigned bytes, unsigned start_frame) {
+  return (bytes / 1024) * 1000 / frames_ms(frame_count - start_frame);
+}
+
+// Writes the file sectors directly, using 8KiB requests.
+static int bench_raw_write(const t_file_extents *fe, const uint32_t *buf, unsigned *kbs) {
+  unsigned bytes = 0;
   unsigned start_frame = frame_count;
-  for (unsigned i = 0; i < 1024; i++) {
-    uint32_t buf[8 * 1024 / sizeof(uint32_t)];
-    const unsigned blkcnt = sizeof(buf) / 512;
+  for (unsigned i = 0; i < fe->count; i++) {
+    for (unsigned b = 0; b < fe->ext[i].count; b += BENCH_BUF_BLOCKS) {
+      unsigned cnt = MIN(BENCH_BUF_BLOCKS, fe->ext[i].count - b);
+      if (RES_OK != disk_write(0, (const BYTE*)buf, fe->ext[i].sector + b, cnt))
+        return -1;
+      bytes += cnt * 512;
+    }
+  }
+  *kbs = rate_kbs(bytes, start_frame);
+  return 1;
+}
+
+// FatFs level read/write tests, plus raw writes (with and without pre-erase).
+static int bench_file(FIL *fd, t_sdbench_results *res, uint32_t *buf, progress_abort_fn progcb) {
+  UINT bytes;
+  if (FR_OK != f_expand(fd, BENCH_FILE_BYTES, 1))
+    return -1;
 
-    unsigned ret = sdcard_read_blocks((uint8_t*)buf, i * blkcnt, blkcnt);
-    if (ret)
+  unsigned start_frame = frame_count;
+  for (unsigned off = 0; off < BENCH_FILE_BYTES; off += BENCH_BUF_BLOCKS * 512)
+    if (FR_OK != f_write(fd, buf, BENCH_BUF_BLOCKS * 512, &bytes) || bytes != BENCH_BUF_BLOCKS * 512)
       return -1;
+  if (FR_OK != f_sync(fd))
+    return -1;
+  res->fwrite_kbs = rate_kbs(BENCH_FILE_BYTES, start_frame);
+  if (progcb(5, BENCH_PHASES))
+    return 0;
 
-    // Update progress every now and then (aim for 0.25s)
-    if (!(i & 0x1F)) {
-      if (progcb(i, 1024))
-        return 0;
-    }
+  f_lseek(fd, 0);
+  start_frame = frame_count;
+  for (unsigned off = 0; off < BENCH_FILE_BYTES; off += BENCH_BUF_BLOCKS * 512)
+    if (FR_OK != f_read(fd, buf, BENCH_BUF_BLOCKS * 512, &bytes) || bytes != BENCH_BUF_BLOCKS * 512)
+      return -1;
+  res->fread_kbs = rate_kbs(BENCH_FILE_BYTES, start_frame);
+  if (progcb(6, BENCH_PHASES))
+    return 0;
+
+  t_file_extents fe;
+  if (!fext_map(&fe, fd) || fe.mapped != BENCH_FILE_BYTES)
+    return -1;
+
+  for (unsigned i = 0; i < 2; i++) {
+    #ifdef SD_PREERASE_BLOCKS_WRITE
+    sdcard_set_preerase(i);
+    #endif
+    int ret = bench_raw_write(&fe, buf, &res->wr_kbs[i]);
+    #ifdef SD_PREERASE_BLOCKS_WRITE
+    sdcard_set_preerase(true);
+    #endif
+    if (ret < 0)
+      return -1;
+    if (progcb(7 + i, BENCH_PHASES))
+      return 0;
   }
-  unsigned end_frame = frame_count;
 
-  // Return milliseconds, do math in 1K microseconds.
-  return ((end_frame - start_frame) * 17067) >> 10;
+  return 1;
+}
+
+// Runs the whole suite. Returns 1 on success, 0 if aborted and -1 on error.
+NOINLINE int sdbench_run(t_sdbench_results *res, uint32_t card_blocks,
+                         uint8_t *dst, unsigned maxsize, progress_abort_fn progcb) {
+  uint32_t buf[BENCH_BUF_BLOCKS * 512 / sizeof(uint32_t)];
+  memset32(res, 0, sizeof(*res));
+  memset32(buf, 0x5A5A5A5A, sizeof(buf));
+  if (!card_blocks)
+    return -1;
+
+  // Random single block reads, all over the card.
+  uint32_t rnd = start_seed;
+  unsigned start_frame = frame_count;
+  for (unsigned i = 0; i < BENCH_RND_READS; i++) {
+    rnd = lcg32(rnd);
+    if (sdcard_read_blocks((uint8_t*)buf, rnd % card_blocks, 1))
+      return -1;
+  }
+  res->rnd_iops = BENCH_RND_READS * 1000 / frames_ms(frame_count - start_frame);
+  if (progcb(1, BENCH_PHASES))
+    return 0;
+
+  // Sequential reads at different request sizes (on different areas, so
+  // that the card cannot cache anything).
+  for (unsigned i = 0; i < SDBENCH_SEQ_SIZES; i++) {
+    const unsigned blkcnt = bench_seq_blocks[i];
+    const uint32_t base = i * (BENCH_SEQ_BYTES / 512);
+    start_frame = frame_count;
+    for (unsigned b = 0; b < BENCH_SEQ_BYTES / 512; b += blkcnt)
+      if (sdcard_read_blocks((uint8_t*)buf, base + b, blkcnt))
+        return -1;
+    res->seq_kbs[i] = rate_kbs(BENCH_SEQ_BYTES, start_frame);
+    if (progcb(2 + i, BENCH_PHASES))
+      return 0;
+  }
+
+  // File level and write tests, on a temporary file.
+  FIL fd;
+  f_mkdir(SUPERFW_DIR);
+  if (FR_OK != f_open(&fd, SDBENCH_TMP_FILEPATH, FA_READ | FA_WRITE | FA_CREATE_ALWAYS))
+    return -1;
+  int ret = bench_file(&fd, res, buf, progcb);
+  f_close(&fd);
+  f_unlink(SDBENCH_TMP_FILEPATH);
+  if (ret <= 0)
+    return ret;
+
+  // SDRAM copy rate (DMA from IWRAM), the SD interface must be unmapped.
+  const unsigned dmasize = MIN(maxsize, BENCH_DMA_BYTES) & ~(sizeof(buf) - 1);
+  set_supercard_mode(MAPPED_SDRAM, true, false);
+  start_frame = frame_count;
+  for (unsigned i = 0; i < BENCH_DMA_BYTES; i += sizeof(buf))
+    dma_memcpy32(&dst[i % dmasize], buf, sizeof(buf) / 4);
+  res->dma_kbs = rate_kbs(BENCH_DMA_BYTES, start_frame);
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+
+  return 1;
+}
+
+// Appends the results to the CSV log (with a header if the log is new).
+bool sdbench_save_log(const t_sdbench_results *res, const t_card_info *card) {
+  FIL fd;
+  f_mkdir(SUPERFW_DIR);
+  if (FR_OK != f_open(&fd, SDBENCH_LOG_FILEPATH, FA_WRITE | FA_OPEN_APPEND))
+    return false;
+
+  char tmp[256];
+  unsigned len = 0;
+  if (!f_size(&fd))
+    len = npf_snprintf(tmp, sizeof(tmp), "version,card_id,sdhc,size_mib,rnd_iops,"
+                       "seq1_kbs,seq4_kbs,seq16_kbs,fwrite_kbs,fread_kbs,"
+                       "wr_kbs,wr_preerase_kbs,dma_kbs\n");
+  len += npf_snprintf(&tmp[len], sizeof(tmp) - len, "%08x,%02x%04x,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n",
+                      (unsigned)VERSION_WORD, card->manufacturer, card->oemid, card->sdhc ? 1 : 0,
+                      (unsigned)(card->block_cnt / 2048), res->rnd_iops,
+                      res->seq_kbs[0], res->seq_kbs[1], res->seq_kbs[2],
+                      res->fwrite_kbs, res->fread_kbs, res->wr_kbs[0], res->wr_kbs[1], res->dma_kbs);
+
+  UINT wrbytes;
+  bool ok = (FR_OK == f_write(&fd, tmp, len, &wrbytes) && wrbytes == len);
+  return (FR_OK == f_close(&fd)) && ok;
 }
 
 
@@ -27,6 +27,7 @@
 #include "crc.h"
 #include "dldi_patcher.h"
 #include "fatfs/ff.h"
+#include "fileextent.h"
 
 // This is used to validate the NDS header and ensure we do not overwrite
 // random places in RAM and cause some funny business.
@@ -169,10 +170,10 @@ unsigned load_nds(const char *filename, const void *dldi_driver) {
   // begining of the main ram, then move it to VRAM-D. The ARM7 knows how to copy it if needed.
   uint8_t *arm7_addr = arm7_on_wram ? (uint8_t*)((uintptr_t)MAINRAM_TMP_WRAM7_ADDR) :
                                       (uint8_t*)((uintptr_t)hdr->arm7_load_addr);
-  if (FR_OK != f_lseek(&fd, hdr->arm7_rom_offset))
-    return ERR_FILE_ACCESS;
-  if (FR_OK != f_read(&fd, arm7_addr, hdr->arm7_load_size, &rdbytes) ||
-                      rdbytes != hdr->arm7_load_size)
+  t_file_extents fe;
+  fext_map(&fe, &fd);
+  if (FR_OK != fext_read(&fe, hdr->arm7_rom_offset, arm7_addr, hdr->arm7_load_size, &rdbytes) ||
+                         rdbytes != hdr->arm7_load_size)
     return ERR_FILE_ACCESS;
 
   if (dldi_driver) {
@@ -196,10 +197,8 @@ unsigned load_nds(const char *filename, const void *dldi_driver) {
 
   // Proceed to load the arm9 payload now
   uint8_t *arm9_addr = (uint8_t*)((uintptr_t)hdr->arm9_load_addr);
-  if (FR_OK != f_lseek(&fd, hdr->arm9_rom_offset))
-    return ERR_FILE_ACCESS;
-  if (FR_OK != f_read(&fd, arm9_addr, hdr->arm9_load_size, &rdbytes) ||
-                      rdbytes != hdr->arm9_load_size)
+  if (FR_OK != fext_read(&fe, hdr->arm9_rom_offset, arm9_addr, hdr->arm9_load_size, &rdbytes) ||
+                         rdbytes != hdr->arm9_load_size)
     return ERR_FILE_ACCESS;
 
   f_close(&fd);
@@ -35,6 +35,7 @@
 #include "compiler.h"
 #include "common.h"
 #include "util.h"
+#include "sha256.h"
 #include "fatfs/ff.h"
 #include "patchengine.h"
 
@@ -64,10 +65,28 @@
 
 // Savetype function signatures.
 #include "save_signatures.h"
+// Generated word dispatch table (see tools/sigtable-gen.py)
+#include "pe_sigtable.h"
 
 #define THUMB_LDR_BACKOFF    256      // 8bit imm (scaled by 4 really)
 #define ARM_LDR_BACKOFF     1024      // 12bit imm (not scaled)
 
+// The scanner reads past the current word, ensure the carried window covers it.
+#define FITS_LOOKAHEAD(x)    (sizeof(x) <= PE_LOOKAHEAD_WORDS * sizeof(uint32_t))
+_Static_assert(ARM_LDR_BACKOFF < PE_LDRTGT_WINDOW && THUMB_LDR_BACKOFF < PE_LDRTGT_WINDOW,
+               "LDR target window is too small for LDR reaches");
+_Static_assert(FITS_LOOKAHEAD(t_flash_setup_info_v1) && FITS_LOOKAHEAD(t_flash_setup_info_v2) &&
+               FITS_LOOKAHEAD(eeprom_v1_read_sig) && FITS_LOOKAHEAD(eeprom_v2_read_sig) &&
+               FITS_LOOKAHEAD(eeprom_v1_write_sig) && FITS_LOOKAHEAD(eeprom_v2_write_sig) &&
+               FITS_LOOKAHEAD(eeprom_v3_write_sig) && FITS_LOOKAHEAD(eeprom_v4_write_sig) &&
+               FITS_LOOKAHEAD(flash_v1_read_sig) && FITS_LOOKAHEAD(flash_v2_read_sig) &&
+               FITS_LOOKAHEAD(flash_v3_read_sig) && FITS_LOOKAHEAD(flash_v1_ident_sig) &&
+               FITS_LOOKAHEAD(flash_v2_ident_sig) && FITS_LOOKAHEAD(flash_v1_verify_sig) &&
+               FITS_LOOKAHEAD(flash_v2_verify_sig) && FITS_LOOKAHEAD(flash_v3_verify_sig) &&
+               FITS_LOOKAHEAD(siirtc_probe_sig) && FITS_LOOKAHEAD(siirtc_reset_sync) &&
+               FITS_LOOKAHEAD(siirtc_getstatus_sig) && FITS_LOOKAHEAD(siirtc_getdatetime_sig),
+               "Signature lookahead exceeds the carried window");
+
 #define OPC_WR_BUF      0x0
 #define OPC_NOP_THUMB   0x1
 #define OPC_NOP_ARM     0x2
@@ -108,50 +127,74 @@ static bool match_sig_prefix(const uint32_t *p, const uint16_t *sig, unsigned si
   return true;
 }
 
-// Start and target expressed in half-word offsets
-static bool find_thumb_ldrpc(const uint16_t *rom, unsigned start, unsigned target) {
-  for (unsigned i = start; i < target; i++) {
-    unsigned opc = rom[i] >> 11;
-    if (opc == 0x09) {
-      // LDR rX, [pc + imm8*4]
-      unsigned imm8 = rom[i] & 0xFF;
-      unsigned tgtaddr = (i & ~1) + imm8 * 2 + 2;
-      // Check for target (addr + off == target)
-      if (tgtaddr == target)
-        return true;
-    }
-  }
-  return false;
+// PC-relative loads can only reach forward, so as words are scanned we flag
+// the literal pool words they load (as a ring bitmap, indexed by word position).
+// A constant is then validated by checking its own flag, no back-scan needed.
+static inline void ldrtgt_mark(uint32_t *ldrtgt, unsigned pos) {
+  pos &= (PE_LDRTGT_WINDOW - 1);
+  ldrtgt[pos >> 5] |= (1U << (pos & 31));
 }
 
-// Start and target expressed in word offsets
-static bool find_arm_ldrpc(const uint32_t *rom, unsigned start, unsigned target) {
-  for (unsigned i = start; i < target; i++) {
-    unsigned opc = (rom[i] >> 20) & 0xFF;
-    unsigned rn  = (rom[i] >> 16) & 0x0F;
-    if (opc == 0x59 && rn == 15) {
-      // LDR rX, [pc + imm]
-      unsigned imm12 = rom[i] & 0xFFF;
-      if ((imm12 & 3) == 0) {    // Aligned load from pool
-        unsigned tgtaddr = i + (imm12 >> 2) + 2;
-        // Check for target (addr + off == target)
-        if (tgtaddr == target)
-          return true;
-      }
-    }
+// Records the targets of any LDR rX, [pc + off] found in the word at `pos`.
+static inline void ldrtgt_record(uint32_t *ldrtgt, unsigned pos, uint32_t w) {
+  // Thumb: LDR rX, [pc + imm8*4] (both half-words). PC is word aligned.
+  if (((w >> 11) & 0x1F) == 0x09)
+    ldrtgt_mark(ldrtgt, pos + (w & 0xFF) + 1);
+  if ((w >> 27) == 0x09)
+    ldrtgt_mark(ldrtgt, pos + ((w >> 16) & 0xFF) + 1);
+  // ARM: LDR rX, [pc + imm12], only aligned loads from the pool (within reach).
+  if (((w >> 16) & 0xFFF) == 0x59F && (w & 3) == 0 && ((w & 0xFFF) >> 2) + 2 <= ARM_LDR_BACKOFF)
+    ldrtgt_mark(ldrtgt, pos + ((w & 0xFFF) >> 2) + 2);
+}
+
+// Checks (and clears, so the ring slot can be reused) whether `pos` is loaded by some LDR.
+static inline bool ldrtgt_take(uint32_t *ldrtgt, unsigned pos) {
+  pos &= (PE_LDRTGT_WINDOW - 1);
+  uint32_t m = ldrtgt[pos >> 5], b = 1U << (pos & 31);
+  ldrtgt[pos >> 5] = m & ~b;
+  return m & b;
+}
+
+// Words skipped by the scanner must still go through the LDR target record.
+static inline void ldrtgt_skip(uint32_t *ldrtgt, unsigned pos, const uint32_t *w, unsigned cnt) {
+  for (unsigned j = 1; j <= cnt; j++) {
+    ldrtgt_take(ldrtgt, pos + j);
+    ldrtgt_record(ldrtgt, pos + j, w[j]);
   }
-  return false;
+}
+
+// Op types, in the order they are placed in the patch set.
+#define OPTYPE_WCNT     0
+#define OPTYPE_SAVE     1
+#define OPTYPE_IRQH     2
+#define OPTYPE_RTC      3
+
+static inline unsigned op_type(uint32_t op) {
+  switch (op >> 28) {
+  case OPC_WR_BUF:
+    return ((op >> 25) & 7) ? OPTYPE_IRQH : OPTYPE_WCNT;
+  case OPC_RTC_HD:
+    return OPTYPE_RTC;
+  default:
+    return OPTYPE_SAVE;
+  };
+}
+
+// Ops are just appended to the log (in ROM order), and sorted at finalize.
+// WAITCNT ops cannot use the last few slots (save/IRQ/RTC ops are critical).
+static inline void push_op(t_patch_builder *patchb, uint32_t op) {
+  unsigned rsv = (op >> 25) ? 0 : MIN(patchb->opcap, PE_OPLOG_RESERVED);
+  if (patchb->opcnt < patchb->opcap - rsv)
+    patchb->ops[patchb->opcnt++] = op;
 }
 
 ARM_CODE IWRAM_CODE NOINLINE
-static void push_save_handler(t_patch *patch, unsigned savetype, unsigned hndltype, uint32_t addr) {
-  memmove32(&patch->op[patch->wcnt_ops+patch->save_ops+1],
-            &patch->op[patch->wcnt_ops+patch->save_ops], (patch->irqh_ops + patch->rtc_ops) * 4);
-  patch->op[patch->wcnt_ops + patch->save_ops++] = addr | (savetype << 28) | (hndltype << 25);
+static void push_save_handler(t_patch_builder *patchb, unsigned savetype, unsigned hndltype, uint32_t addr) {
+  push_op(patchb, addr | (savetype << 28) | (hndltype << 25));
 }
 
-static void push_rtc_handler(t_patch *patch, unsigned hndltype, uint32_t addr) {
-  patch->op[patch->wcnt_ops + patch->save_ops + patch->irqh_ops + patch->rtc_ops++] = addr | (OPC_RTC_HD << 28) | (hndltype << 25);
+static void push_rtc_handler(t_patch_builder *patchb, unsigned hndltype, uint32_t addr) {
+  push_op(patchb, addr | (OPC_RTC_HD << 28) | (hndltype << 25));
 }
 
 static inline bool isromaddr(uint32_t addr) {
@@ -192,21 +235,57 @@ static inline bool isflash128k(uint16_t did) {
 #define FLASHINFO_VALIDSIZE(st) \
   ((st)->flash_size == (st)->sector_count * (st)->sector_size)
 
-static void filter_save_ops(t_patch *p, unsigned optype) {
-  // Filter save ops to match the specified type.
-  for (unsigned i = 0; i < p->save_ops; i++)
-    if ((p->op[p->wcnt_ops + i] >> 28) != optype) {
-      memmove32(&p->op[p->wcnt_ops + i], &p->op[p->wcnt_ops + i + 1],
-                (p->save_ops - 1 - i + p->irqh_ops + p->rtc_ops) * 4);
-      p->save_ops--;
-      i--;
-    }
+static void filter_save_ops(t_patch_builder *patchb, unsigned optype) {
+  // Filter save ops to match the specified type (in a single pass).
+  unsigned cnt = 0;
+  for (unsigned i = 0; i < patchb->opcnt; i++) {
+    uint32_t op = patchb->ops[i];
+    if (op_type(op) != OPTYPE_SAVE || (op >> 28) == optype)
+      patchb->ops[cnt++] = op;
+  }
+  patchb->opcnt = cnt;
+}
+
+// Places the logged ops in the patch set, grouped by type (stable counting
+// sort, so each group keeps the ROM order). If they do not fit, WAITCNT ops
+// are dropped first.
+static void sort_ops(t_patch_builder *patchb) {
+  t_patch *p = &patchb->p;
+  unsigned cnt[4] = {0};
+  for (unsigned i = 0; i < patchb->opcnt; i++)
+    cnt[op_type(patchb->ops[i])]++;
+
+  unsigned room = MAX_PATCH_OPS;
+  const unsigned prio[4] = { OPTYPE_SAVE, OPTYPE_IRQH, OPTYPE_RTC, OPTYPE_WCNT };
+  for (unsigned i = 0; i < 4; i++) {
+    cnt[prio[i]] = MIN(cnt[prio[i]], room);
+    room -= cnt[prio[i]];
+  }
+
+  unsigned pos[4], end[4];
+  for (unsigned i = 0, acc = 0; i < 4; i++) {
+    pos[i] = acc;
+    acc += cnt[i];
+    end[i] = acc;
+  }
+  for (unsigned i = 0; i < patchb->opcnt; i++) {
+    unsigned t = op_type(patchb->ops[i]);
+    if (pos[t] < end[t])
+      p->op[pos[t]++] = patchb->ops[i];
+  }
+
+  p->wcnt_ops = cnt[OPTYPE_WCNT];
+  p->save_ops = cnt[OPTYPE_SAVE];
+  p->irqh_ops = cnt[OPTYPE_IRQH];
+  p->rtc_ops = cnt[OPTYPE_RTC];
 }
 
-void patchengine_init(t_patch_builder *patchb, unsigned filesize) {
+void patchengine_init(t_patch_builder *patchb, unsigned filesize, uint32_t *oplog, unsigned oplogcnt) {
   memset(patchb, 0, sizeof(*patchb));
 
   patchb->filesize = filesize;
+  patchb->ops = oplog;
+  patchb->opcap = oplogcnt;
 
   // Since we mostly patch WAITCNT constants, generate a program that zeroes out a 32 bit word
   patchb->p.prgs[0].length = 4;
@@ -234,17 +313,31 @@ void patchengine_init(t_patch_builder *patchb, unsigned filesize) {
   memcpy(patchb->p.prgs[3].data, flash128_stub, sizeof(flash128_stub));
 }
 
+static void pe_flush_pending(t_patch_builder *patchb, unsigned cnt);
+
 void patchengine_finalize(t_patch_builder *patchb) {
   t_patch *p = &patchb->p;
-  if (patchb->save_type_guess == 0 && p->save_ops == 0)
+
+  // Scan the remaining words, with zero padding as lookahead.
+  if (patchb->pendcnt) {
+    memset32(&patchb->pend[patchb->pendcnt], 0, PE_LOOKAHEAD_WORDS * sizeof(uint32_t));
+    pe_flush_pending(patchb, patchb->pendcnt);
+  }
+
+  unsigned save_ops = 0;
+  for (unsigned i = 0; i < patchb->opcnt; i++)
+    if (op_type(patchb->ops[i]) == OPTYPE_SAVE)
+      save_ops++;
+
+  if (patchb->save_type_guess == 0 && save_ops == 0)
     p->save_mode = SaveTypeNone;         // No saving strings nor signatures found!
   else if (patchb->save_type_guess == GUESS_SRAM) {
     p->save_mode = SaveTypeSRAM;
-    filter_save_ops(p, 0xF);             // Clear all save opcodes!
+    filter_save_ops(patchb, 0xF);             // Clear all save opcodes!
   }
   else if (patchb->save_type_guess == GUESS_EEPROM) {
     p->save_mode = SaveTypeEEPROM64K;
-    filter_save_ops(p, OPC_EEPROM_HD);   // Clear other opcodes but EEPROM
+    filter_save_ops(patchb, OPC_EEPROM_HD);   // Clear other opcodes but EEPROM
   }
   else if (patchb->save_type_guess == GUESS_FLASH ||
            patchb->save_type_guess == GUESS_FLASH64 ||
@@ -252,18 +345,20 @@ void patchengine_finalize(t_patch_builder *patchb) {
     // Guess flash size.
     p->save_mode = (patchb->save_type_guess == GUESS_FLASH128) ? SaveTypeFlash1024K
                                                                : SaveTypeFlash512K;
-    filter_save_ops(p, OPC_FLASH_HD);    // Filter all opcodes but FLASH
+    filter_save_ops(patchb, OPC_FLASH_HD);    // Filter all opcodes but FLASH
   }
-  else if (p->save_ops == 0 && (patchb->save_type_guess & GUESS_SRAM)) {
+  else if (save_ops == 0 && (patchb->save_type_guess & GUESS_SRAM)) {
     // Could not find any signatures, but SRAM looks promising.
     p->save_mode = SaveTypeSRAM;
   }
   else {
     // Multiple types, or not a clue, fallback to SRAM
     p->save_mode = SaveTypeSRAM;
-    filter_save_ops(p, 0xF);             // Clear all save opcodes!
+    filter_save_ops(patchb, 0xF);             // Clear all save opcodes!
   }
 
+  sort_ops(patchb);
+
   // Process any FLASH_IDEN_HNDLR handlers into program patches.
   // These stub out the ident function to return some hardcoded device ID.
   for (unsigned i = 0; i < p->save_ops; i++) {
@@ -284,8 +379,8 @@ void patchengine_finalize(t_patch_builder *patchb) {
   }
 
   // Clear all the ops at the end (if any)
-  for (unsigned i = p->wcnt_ops + p->save_ops + p->irqh_ops + p->rtc_ops; i < MAX_PATCH_OPS; i++)
-    p->op[i] = 0;
+  const unsigned numops = p->wcnt_ops + p->save_ops + p->irqh_ops + p->rtc_ops;
+  memset(&p->op[numops], 0, (MAX_PATCH_OPS - numops) * sizeof(uint32_t));
 
   // If the rom is big, annotate the trailing data.
   if (patchb->filesize >= MAX_ROM_SIZE_IGM && patchb->ldatacnt >= 4096) {
@@ -302,15 +397,20 @@ void patchengine_finalize(t_patch_builder *patchb) {
   }
 }
 
-// Generates a patch set from a given ROM.
-// Walks a ROM (or chunk of a ROM) and looks for certain constants to calculate
-// WAITCNT, IRQ and save patches. Generate a patch structure out of it.
+// Scans `cnt` words at the current stream position (patchb->baseaddr).
+// Looks for certain constants to calculate WAITCNT, IRQ and save patches.
+// The buffer must be readable for PE_LOOKAHEAD_WORDS past its end.
 ARM_CODE IWRAM_CODE NOINLINE
-bool patchengine_process_rom(const uint32_t *rom, unsigned romsize, t_patch_builder *patchb, void(*progresscb)(unsigned)) {
-  const uint16_t *rom16 = (uint16_t*)rom;
-  t_patch *patch = &patchb->p;
+static void pe_scan(t_patch_builder *patchb, const uint32_t *rom, unsigned cnt, void(*progresscb)(unsigned)) {
+  uint32_t *ldrtgt = patchb->ldrtgt;
+  const unsigned base = patchb->baseaddr / sizeof(uint32_t);
+
+  unsigned i;
+  for (i = patchb->skip; i < cnt; i++) {
+    // Whether some previous LDR loads this word, and record this word's LDR targets.
+    bool ldrref = ldrtgt_take(ldrtgt, base + i);
+    ldrtgt_record(ldrtgt, base + i, rom[i]);
 
-  for (unsigned i = 0; i < romsize / sizeof(uint32_t); i++) {
     // Count the number of identical words
     if (patchb->ldata == rom[i])
       patchb->ldatacnt += 4;
@@ -319,127 +419,123 @@ bool patchengine_process_rom(const uint32_t *rom, unsigned romsize, t_patch_buil
       patchb->ldatacnt = 0;
     }
 
-    if (!(i << 17))          // If 15 LSB are zero, callback. The compiler is a bit dumb.
+    if (!(i << 17) && progresscb)   // If 15 LSB are zero, callback.
       progresscb(i);
 
+    // Single table probe to find out which pattern (if any) this word starts.
+    const uint32_t w = rom[i];
+    const unsigned slot = PE_SIG_HASH(w);
+    switch (pe_sig_keys[slot] == w ? pe_sig_ids[slot] : PE_SIG_NONE) {
     // Identify WAITCNT constants, validate them by finding LDR instructions
-    if (rom[i] == WAITCNT_VALUE_EXACT) {
-      unsigned start_pos_thumb = i < THUMB_LDR_BACKOFF ? 0 : i - THUMB_LDR_BACKOFF;
-      unsigned start_pos_arm   = i < ARM_LDR_BACKOFF   ? 0 : i - ARM_LDR_BACKOFF;
-      if (find_thumb_ldrpc(rom16, start_pos_thumb * 2, i * 2) ||
-          find_arm_ldrpc(rom, start_pos_arm, i)) {
+    case PE_SIG_WAITCNT_VALUE_EXACT:
+      if (ldrref) {
         // This constant seems to be used by an LDR rX, [PC + off], most likely
         // a WAITCNT update. We just patch the constant even tho it's not great
-        memmove32(&patch->op[patch->wcnt_ops+1], &patch->op[patch->wcnt_ops],
-                  (patch->save_ops + patch->irqh_ops + patch->rtc_ops) * 4);
-        patch->op[patch->wcnt_ops++] = (i * 4) | (OPC_WR_BUF << 28) | (0 << 25);
+        push_op(patchb, ((base + i) * 4) | (OPC_WR_BUF << 28) | (0 << 25));
       }
-    }
+      break;
     // Identify IRQ handle address, so we can find IRQ hook set.
-    else if (rom[i] == IRQHADDR_VALUE) {
-      unsigned start_pos_thumb = i < THUMB_LDR_BACKOFF ? 0 : i - THUMB_LDR_BACKOFF;
-      unsigned start_pos_arm   = i < ARM_LDR_BACKOFF   ? 0 : i - ARM_LDR_BACKOFF;
-      if (find_thumb_ldrpc(rom16, start_pos_thumb * 2, i * 2) ||
-          find_arm_ldrpc(rom, start_pos_arm, i)) {
+    case PE_SIG_IRQHADDR_VALUE:
+      if (ldrref) {
         // This constant seems to be used by an LDR rX, [PC + off], most likely
         // an IRQ handler write. We just patch the constant to point to the reserved area.
-        patch->op[patch->wcnt_ops + patch->save_ops + patch->irqh_ops++] = (i * 4) | (OPC_WR_BUF << 28) | (1 << 25);
+        push_op(patchb, ((base + i) * 4) | (OPC_WR_BUF << 28) | (1 << 25));
       }
-    }
+      break;
 
     // Find save strings to narrow down save type.
-    else if (rom[i] == SRAM_V_WORD0) {
+    case PE_SIG_SRAM_V_WORD0:
       if (rom[i+1] == SRAM_V_WORD1 || rom[i+1] == SRAM_F_WORD1)
         patchb->save_type_guess |= GUESS_SRAM;
-    }
-    else if (rom[i] == EEPROM_V_WORD0) {
+      break;
+    case PE_SIG_EEPROM_V_WORD0:
       if (rom[i+1] == EEPROM_V_WORD1)
         patchb->save_type_guess |= GUESS_EEPROM;
-    }
-    else if (rom[i] == FLASH_V_WORD0) {
+      break;
+    case PE_SIG_FLASH_V_WORD0:
       if (rom[i+1] == FLASH_V_WORD1)
         patchb->save_type_guess |= GUESS_FLASH;
       else if (rom[i+1] == FLASH512_WORD1)
         patchb->save_type_guess |= GUESS_FLASH64;
       else if (rom[i+1] == FLASH1M_WORD1)
         patchb->save_type_guess |= GUESS_FLASH128;
-    }
-    else if (rom[i] == RTC_V_WORD0) {
+      break;
+    case PE_SIG_RTC_V_WORD0:
       if (rom[i+1] == RTC_V_WORD1)
         patchb->rtc_guess = true;
-    }
+      break;
 
     // Save function prefix matching.
-    else if (rom[i] == eeprom_v1_read_word0) {
+    case PE_SIG_EEPROM_V1_READ_WORD0:
       if (match_sig_prefix(&rom[i], eeprom_v1_read_sig, sizeof(eeprom_v1_read_sig)))
-        push_save_handler(patch, OPC_EEPROM_HD, EEPROM_RD_HNDLR, i * 4);
-    }
-    else if (rom[i] == eeprom_v2_read_word0) {
+        push_save_handler(patchb, OPC_EEPROM_HD, EEPROM_RD_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_EEPROM_V2_READ_WORD0:
       if (match_sig_prefix(&rom[i], eeprom_v2_read_sig, sizeof(eeprom_v2_read_sig)))
-        push_save_handler(patch, OPC_EEPROM_HD, EEPROM_RD_HNDLR, i * 4);
-    }
-    else if (rom[i] == eeprom_v1_write_word0) {
+        push_save_handler(patchb, OPC_EEPROM_HD, EEPROM_RD_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_EEPROM_V1_WRITE_WORD0:
       if (match_sig_prefix(&rom[i], eeprom_v1_write_sig, sizeof(eeprom_v1_write_sig)))
-        push_save_handler(patch, OPC_EEPROM_HD, EEPROM_WR_HNDLR, i * 4);
-    }
-    else if (rom[i] == eeprom_v2_write_word0) {
+        push_save_handler(patchb, OPC_EEPROM_HD, EEPROM_WR_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_EEPROM_V2_WRITE_WORD0:
       if (match_sig_prefix(&rom[i], eeprom_v2_write_sig, sizeof(eeprom_v2_write_sig)))
-        push_save_handler(patch, OPC_EEPROM_HD, EEPROM_WR_HNDLR, i * 4);
-    }
-    else if (rom[i] == eeprom_v3_write_word0) {
+        push_save_handler(patchb, OPC_EEPROM_HD, EEPROM_WR_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_EEPROM_V3_WRITE_WORD0:
       if (match_sig_prefix(&rom[i], eeprom_v3_write_sig, sizeof(eeprom_v3_write_sig)))
-        push_save_handler(patch, OPC_EEPROM_HD, EEPROM_WR_HNDLR, i * 4);
-    }
-    else if (rom[i] == eeprom_v4_write_word0) {
+        push_save_handler(patchb, OPC_EEPROM_HD, EEPROM_WR_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_EEPROM_V4_WRITE_WORD0:
       if (match_sig_prefix(&rom[i], eeprom_v4_write_sig, sizeof(eeprom_v4_write_sig)))
-        push_save_handler(patch, OPC_EEPROM_HD, EEPROM_WR_HNDLR, i * 4);
-    }
+        push_save_handler(patchb, OPC_EEPROM_HD, EEPROM_WR_HNDLR, (base + i) * 4);
+      break;
 
-    else if (rom[i] == flash_v1_read_word0) {
+    case PE_SIG_FLASH_V1_READ_WORD0:
       if (match_sig_prefix(&rom[i], flash_v1_read_sig, sizeof(flash_v1_read_sig)))
-        push_save_handler(patch, OPC_FLASH_HD, FLASH_READ_HNDLR, i * 4);
-    }
-    else if (rom[i] == flash_v23_read_word0) {
+        push_save_handler(patchb, OPC_FLASH_HD, FLASH_READ_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_FLASH_V23_READ_WORD0:
       if (match_sig_prefix(&rom[i], flash_v2_read_sig, sizeof(flash_v2_read_sig)))
-        push_save_handler(patch, OPC_FLASH_HD, FLASH_READ_HNDLR, i * 4);
+        push_save_handler(patchb, OPC_FLASH_HD, FLASH_READ_HNDLR, (base + i) * 4);
       if (match_sig_prefix(&rom[i], flash_v3_read_sig, sizeof(flash_v3_read_sig)))
-        push_save_handler(patch, OPC_FLASH_HD, FLASH_READ_HNDLR, i * 4);
-    }
-    else if (rom[i] == flash_v1_ident_word0) {
+        push_save_handler(patchb, OPC_FLASH_HD, FLASH_READ_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_FLASH_V1_IDENT_WORD0:
       if (match_sig_prefix(&rom[i], flash_v1_ident_sig, sizeof(flash_v1_ident_sig)))
-        push_save_handler(patch, OPC_FLASH_HD, FLASH_IDEN_HNDLR, i * 4);
-    }
-    else if (rom[i] == flash_v2_ident_word0) {
+        push_save_handler(patchb, OPC_FLASH_HD, FLASH_IDEN_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_FLASH_V2_IDENT_WORD0:
       if (match_sig_prefix(&rom[i], flash_v2_ident_sig, sizeof(flash_v2_ident_sig)))
-        push_save_handler(patch, OPC_FLASH_HD, FLASH_IDEN_HNDLR, i * 4);
-    }
-    else if (rom[i] == flash_v1_verify_word0) {
+        push_save_handler(patchb, OPC_FLASH_HD, FLASH_IDEN_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_FLASH_V1_VERIFY_WORD0:
       if (match_sig_prefix(&rom[i], flash_v1_verify_sig, sizeof(flash_v1_verify_sig)))
-        push_save_handler(patch, OPC_FLASH_HD, FLASH_VERF_HNDLR, i * 4);
-    }
-    else if (rom[i] == flash_v23_verify_word0) {
+        push_save_handler(patchb, OPC_FLASH_HD, FLASH_VERF_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_FLASH_V23_VERIFY_WORD0:
       if (match_sig_prefix(&rom[i], flash_v2_verify_sig, sizeof(flash_v2_verify_sig)))
-        push_save_handler(patch, OPC_FLASH_HD, FLASH_VERF_HNDLR, i * 4);
+        push_save_handler(patchb, OPC_FLASH_HD, FLASH_VERF_HNDLR, (base + i) * 4);
       if (match_sig_prefix(&rom[i], flash_v3_verify_sig, sizeof(flash_v3_verify_sig)))
-        push_save_handler(patch, OPC_FLASH_HD, FLASH_VERF_HNDLR, i * 4);
-    }
+        push_save_handler(patchb, OPC_FLASH_HD, FLASH_VERF_HNDLR, (base + i) * 4);
+      break;
 
-    else if (rom[i] == siirtc_probe_reset_sig_word0) {
+    case PE_SIG_SIIRTC_PROBE_RESET_SIG_WORD0:
       if (match_sig_prefix(&rom[i], siirtc_probe_sig, sizeof(siirtc_probe_sig)))
-        push_rtc_handler(patch, RTC_PROBE_HNDLR, i * 4);
+        push_rtc_handler(patchb, RTC_PROBE_HNDLR, (base + i) * 4);
       if (match_sig_prefix(&rom[i], siirtc_reset_sync, sizeof(siirtc_reset_sync)))
-        push_rtc_handler(patch, RTC_RESET_HNDLR, i * 4);
-    }
-    else if (rom[i] == siirtc_getstatus_sig_word0) {
+        push_rtc_handler(patchb, RTC_RESET_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_SIIRTC_GETSTATUS_SIG_WORD0:
       if (match_sig_prefix(&rom[i], siirtc_getstatus_sig, sizeof(siirtc_getstatus_sig)))
-        push_rtc_handler(patch, RTC_STSRD_HNDLR, i * 4);
-    }
-    else if (rom[i] == siirtc_getdatetime_sig_word0) {
+        push_rtc_handler(patchb, RTC_STSRD_HNDLR, (base + i) * 4);
+      break;
+    case PE_SIG_SIIRTC_GETDATETIME_SIG_WORD0:
       if (match_sig_prefix(&rom[i], siirtc_getdatetime_sig, sizeof(siirtc_getdatetime_sig)))
-        push_rtc_handler(patch, RTC_GETTD_HNDLR, i * 4);
-    }
+        push_rtc_handler(patchb, RTC_GETTD_HNDLR, (base + i) * 4);
+      break;
 
-    else {
+    default: {
       // Try to match FLASH setup info data structure (word aligned)
       const t_flash_setup_info_v1 *info1 = (t_flash_setup_info_v1*)&rom[i];
       const t_flash_setup_info_v2 *info2 = (t_flash_setup_info_v2*)&rom[i];
@@ -447,10 +543,10 @@ bool patchengine_process_rom(const uint32_t *rom, unsigned romsize, t_patch_buil
         // Validate Device ID and check that sizes make sense.
         if (FLASHINFO_VALIDSIZE(info2) && valid_flashid(info2->device_id)) {
           // Extract handler info from the table.
-          push_save_handler(patch, OPC_FLASH_HD, FLASH_CLRC_HNDLR, 0x1FFFFFE & info2->erase_chip_fnptr);
-          push_save_handler(patch, OPC_FLASH_HD, FLASH_CLRS_HNDLR, 0x1FFFFFE & info2->erase_sector_fnptr);
-          push_save_handler(patch, OPC_FLASH_HD, FLASH_WRTS_HNDLR, 0x1FFFFFE & info2->program_sector_fnptr);
-          push_save_handler(patch, OPC_FLASH_HD, FLASH_WRBT_HNDLR, 0x1FFFFFE & info2->program_byte_fnptr);
+          push_save_handler(patchb, OPC_FLASH_HD, FLASH_CLRC_HNDLR, 0x1FFFFFE & info2->erase_chip_fnptr);
+          push_save_handler(patchb, OPC_FLASH_HD, FLASH_CLRS_HNDLR, 0x1FFFFFE & info2->erase_sector_fnptr);
+          push_save_handler(patchb, OPC_FLASH_HD, FLASH_WRTS_HNDLR, 0x1FFFFFE & info2->program_sector_fnptr);
+          push_save_handler(patchb, OPC_FLASH_HD, FLASH_WRBT_HNDLR, 0x1FFFFFE & info2->program_byte_fnptr);
           if (info2->device_id) {
             if (isflash128k(info2->device_id))
               patchb->flash128cnt++;
@@ -458,13 +554,14 @@ bool patchengine_process_rom(const uint32_t *rom, unsigned romsize, t_patch_buil
               patchb->flash64cnt++;
           }
         }
+        ldrtgt_skip(ldrtgt, base + i, &rom[i], 9);
         i += 9;    // Avoid matching with v1 as well, save some time too!
       }
       else if (SEEMS_FLASHINFO(info1)) {
         if (FLASHINFO_VALIDSIZE(info1) && valid_flashid(info1->device_id)) {
-          push_save_handler(patch, OPC_FLASH_HD, FLASH_CLRC_HNDLR, 0x1FFFFFE & info2->erase_chip_fnptr);
-          push_save_handler(patch, OPC_FLASH_HD, FLASH_CLRS_HNDLR, 0x1FFFFFE & info2->erase_sector_fnptr);
-          push_save_handler(patch, OPC_FLASH_HD, FLASH_WRTS_HNDLR, 0x1FFFFFE & info2->program_sector_fnptr);
+          push_save_handler(patchb, OPC_FLASH_HD, FLASH_CLRC_HNDLR, 0x1FFFFFE & info2->erase_chip_fnptr);
+          push_save_handler(patchb, OPC_FLASH_HD, FLASH_CLRS_HNDLR, 0x1FFFFFE & info2->erase_sector_fnptr);
+          push_save_handler(patchb, OPC_FLASH_HD, FLASH_WRTS_HNDLR, 0x1FFFFFE & info2->program_sector_fnptr);
           if (info1->device_id) {
             if (isflash128k(info1->device_id))
               patchb->flash128cnt++;
@@ -472,8 +569,60 @@ bool patchengine_process_rom(const uint32_t *rom, unsigned romsize, t_patch_buil
               patchb->flash64cnt++;
           }
         }
+        ldrtgt_skip(ldrtgt, base + i, &rom[i], 8);
         i += 8;
       }
+      break;
+    }
+    }
+  }
+
+  // Carry any skipped words over to the next scan
+  patchb->skip = i - cnt;
+}
+
+// Scans the first `cnt` pending words, which must have lookahead data after them.
+static void pe_flush_pending(t_patch_builder *patchb, unsigned cnt) {
+  pe_scan(patchb, patchb->pend, cnt, NULL);
+  patchb->baseaddr += cnt * sizeof(uint32_t);
+  memmove32(&patchb->pend[0], &patchb->pend[cnt], (patchb->pendcnt - cnt) * sizeof(uint32_t));
+  patchb->pendcnt -= cnt;
+}
+
+// Generates a patch set from a given ROM.
+// Walks a ROM chunk (of any size, multiple of 4 bytes) and accumulates the
+// patches into the builder. Chunks must be fed in order, state is carried
+// across calls so that matches spanning chunks are found too. The last words
+// of each chunk are kept until more data (or patchengine_finalize) arrives.
+bool patchengine_process_rom(const uint32_t *rom, unsigned romsize, t_patch_builder *patchb, void(*progresscb)(unsigned)) {
+  unsigned n = romsize / sizeof(uint32_t);
+
+  if (n >= 2 * PE_LOOKAHEAD_WORDS) {
+    // Finish pending words using the head of this buffer as lookahead.
+    if (patchb->pendcnt) {
+      memcpy32(&patchb->pend[patchb->pendcnt], rom, PE_LOOKAHEAD_WORDS * sizeof(uint32_t));
+      patchb->pendcnt += PE_LOOKAHEAD_WORDS;
+      pe_flush_pending(patchb, patchb->pendcnt - PE_LOOKAHEAD_WORDS);
+      patchb->pendcnt = 0;   // Drop the head, it is scanned in place below.
+    }
+
+    // Scan the buffer in place, keep its tail pending.
+    unsigned cnt = n - PE_LOOKAHEAD_WORDS;
+    pe_scan(patchb, rom, cnt, progresscb);
+    patchb->baseaddr += cnt * sizeof(uint32_t);
+    memcpy32(patchb->pend, &rom[cnt], PE_LOOKAHEAD_WORDS * sizeof(uint32_t));
+    patchb->pendcnt = PE_LOOKAHEAD_WORDS;
+  }
+  else {
+    // Small buffers are accumulated in the pending buffer.
+    for (unsigned off = 0; off < n; ) {
+      unsigned k = MIN(n - off, 2 * PE_LOOKAHEAD_WORDS - patchb->pendcnt);
+      memcpy32(&patchb->pend[patchb->pendcnt], &rom[off], k * sizeof(uint32_t));
+      patchb->pendcnt += k;
+      off += k;
+
+      if (patchb->pendcnt > PE_LOOKAHEAD_WORDS)
+        pe_flush_pending(patchb, patchb->pendcnt - PE_LOOKAHEAD_WORDS);
     }
   }
 
@@ -481,58 +630,87 @@ bool patchengine_process_rom(const uint32_t *rom, unsigned romsize, t_patch_buil
 }
 
 // Generates a patch buffer (for a file) so that it can be loaded later.
+// Only the used ops are written, so the size depends on the op count.
 int serialize_patch(const t_patch *patch, uint8_t *buffer) {
+  const unsigned numops = patch->wcnt_ops + patch->save_ops + patch->irqh_ops + patch->rtc_ops;
+
   // Write the patch into the buffer.
-  memcpy(&buffer[0], "SUPERFWPATCHV01", 16);
-  buffer[16] = patch->wcnt_ops;
-  buffer[17] = patch->save_ops;
-  buffer[18] = patch->save_mode;
-  buffer[19] = patch->irqh_ops;
-  buffer[20] = patch->rtc_ops;
-  buffer[21] = 0;
-  buffer[22] = (patch->hole_size >> 10) & 0xFF;
-  buffer[23] = patch->hole_size >> 18;
-  buffer[24] = (patch->hole_addr >> 10) & 0xFF;
-  buffer[25] = patch->hole_addr >> 18;
-  buffer[26] = 0;
-  buffer[27] = 0;
-  buffer[28] = 0;
-  buffer[29] = 0;
+  memcpy(&buffer[0], "SUPERFWPATCHV02", 16);
+  buffer[16] = patch->wcnt_ops & 0xFF;
+  buffer[17] = patch->wcnt_ops >> 8;
+  buffer[18] = patch->save_ops & 0xFF;
+  buffer[19] = patch->save_ops >> 8;
+  buffer[20] = patch->irqh_ops & 0xFF;
+  buffer[21] = patch->irqh_ops >> 8;
+  buffer[22] = patch->rtc_ops & 0xFF;
+  buffer[23] = patch->rtc_ops >> 8;
+  buffer[24] = patch->save_mode;
+  buffer[25] = MAX_PATCH_PRG;
+  buffer[26] = (patch->hole_size >> 10) & 0xFF;
+  buffer[27] = patch->hole_size >> 18;
+  buffer[28] = (patch->hole_addr >> 10) & 0xFF;
+  buffer[29] = patch->hole_addr >> 18;
   buffer[30] = 0;
   buffer[31] = 0;
   buffer += 32;
 
   memcpy(buffer, patch->prgs, sizeof(patch->prgs));
   buffer += sizeof(patch->prgs);
-  memcpy(buffer, patch->op, sizeof(patch->op));
+  memcpy(buffer, patch->op, numops * sizeof(uint32_t));
 
-  return 32 + sizeof(patch->op) + sizeof(patch->prgs);
+  return 32 + sizeof(patch->prgs) + numops * sizeof(uint32_t);
 }
 
-// Loads a patch from a buffer.
+// Loads a patch from a buffer (V01 patches, with 128 ops, are also supported).
 bool unserialize_patch(const uint8_t *buffer, unsigned size, t_patch *patch) {
-  // Check header anf size
-  if (size != 32 + sizeof(patch->op) + sizeof(patch->prgs))
+  // Check header and size
+  unsigned numops, numprgs;
+  if (size < 32)
     return false;
-  if (memcmp(&buffer[0], "SUPERFWPATCHV01", 16))
+  if (!memcmp(&buffer[0], "SUPERFWPATCHV01", 16)) {
+    patch->wcnt_ops = buffer[16];
+    patch->save_ops = buffer[17];
+    patch->save_mode = buffer[18];
+    patch->irqh_ops = buffer[19];
+    patch->rtc_ops = buffer[20];
+    patch->hole_size = (buffer[22] | (buffer[23] << 8)) << 10;
+    patch->hole_addr = (buffer[24] | (buffer[25] << 8)) << 10;
+    numprgs = 4;
+    numops = 128;
+    if (patch->wcnt_ops + patch->save_ops + patch->irqh_ops + patch->rtc_ops > numops)
+      return false;
+  }
+  else if (!memcmp(&buffer[0], "SUPERFWPATCHV02", 16)) {
+    patch->wcnt_ops = buffer[16] | (buffer[17] << 8);
+    patch->save_ops = buffer[18] | (buffer[19] << 8);
+    patch->irqh_ops = buffer[20] | (buffer[21] << 8);
+    patch->rtc_ops = buffer[22] | (buffer[23] << 8);
+    patch->save_mode = buffer[24];
+    patch->hole_size = (buffer[26] | (buffer[27] << 8)) << 10;
+    patch->hole_addr = (buffer[28] | (buffer[29] << 8)) << 10;
+    numprgs = buffer[25];
+    numops = patch->wcnt_ops + patch->save_ops + patch->irqh_ops + patch->rtc_ops;
+  }
+  else
     return false;
 
-  patch->wcnt_ops = buffer[16];
-  patch->save_ops = buffer[17];
-  patch->save_mode = buffer[18];
-  patch->irqh_ops = buffer[19];
-  patch->rtc_ops = buffer[20];
-  patch->hole_size = (buffer[22] | (buffer[23] << 8)) << 10;
-  patch->hole_addr = (buffer[24] | (buffer[25] << 8)) << 10;
+  if (numops > MAX_PATCH_OPS || numprgs > MAX_PATCH_PRG ||
+      size < 32 + numprgs * sizeof(t_patch_prog) + numops * sizeof(uint32_t))
+    return false;
   buffer += 32;
 
-  memcpy(patch->prgs, buffer, sizeof(patch->prgs));
-  buffer += sizeof(patch->prgs);
-  memcpy(patch->op, buffer, sizeof(patch->op));
+  memset(patch->prgs, 0, sizeof(patch->prgs));
+  memcpy(patch->prgs, buffer, numprgs * sizeof(t_patch_prog));
+  buffer += numprgs * sizeof(t_patch_prog);
+  memset(patch->op, 0, sizeof(patch->op));
+  memcpy(patch->op, buffer, numops * sizeof(uint32_t));
 
   return true;
 }
 
+// Serialized patch buffer (too big for the stack, which lives in IWRAM).
+static uint8_t patchbuf[MAX_PATCH_SERIALIZED] EWRAM_BSS;
+
 bool load_rom_patches(const char *romfn, t_patch *patches) {
   // Look for .patch files next to the ROM.
   char tmp[MAX_FN_LEN];
@@ -544,68 +722,204 @@ bool load_rom_patches(const char *romfn, t_patch *patches) {
   if (FR_OK != f_open(&fd, tmp, FA_READ))
     return false;
 
-  uint8_t buf[1024];
+  uint8_t *buf = patchbuf;
   UINT rdbytes;
-  if (FR_OK != f_read(&fd, buf, sizeof(buf), &rdbytes))
+  if (FR_OK != f_read(&fd, buf, MAX_PATCH_SERIALIZED, &rdbytes))
     return false;
 
   return unserialize_patch(buf, rdbytes, patches);
 }
 
-bool load_cached_patches(const char *romfn, t_patch *patches) {
-  char tmp[MAX_FN_LEN];
-  const char *p = file_basename(romfn);
-  strcpy(tmp, PATCHDB_PATH);
-  strcat(tmp, p);
-
-  // Replace the extension of the ROM with something more fitting.
-  replace_extension(tmp, ".patch");
+// Patch cache: a single file, with a sorted index of ROM fingerprints (so that
+// lookups are just a binary search) followed by the patch records, which are
+// appended in insertion order. Since ROMs are identified by their content,
+// renamed or duplicated ROMs hit the same entry, and modified ROMs miss.
+#define PCACHE_SIGNATURE    "SUPERFWPCACHE01"
+#define PCACHE_HDR_SIZE     32
+#define PCACHE_REC_SIZE     (MAX_PATCH_SERIALIZED)
+#define PCACHE_REC_OFFSET   (PCACHE_HDR_SIZE + PATCH_CACHE_MAXENT * sizeof(t_pcache_entry))
+#define PCACHE_FP_SAMPLES   8
+
+typedef struct {
+  t_rom_fingerprint fp;
+  uint32_t recnum;          // Record number (in the records area)
+  uint32_t checksum;        // Record checksum, to detect stale/corrupted records
+} t_pcache_entry;
+
+typedef struct {
+  char signature[16];
+  uint32_t version;         // Bumped whenever the patch engine output changes
+  uint32_t count;           // Number of (valid) index entries
+  uint32_t reserved[2];
+} t_pcache_header;
+
+_Static_assert(sizeof(t_pcache_header) == PCACHE_HDR_SIZE, "Bad cache header size");
+
+static uint32_t pcache_checksum(const uint8_t *buf, unsigned size) {
+  uint32_t ret = 0x9E3779B9;
+  for (unsigned i = 0; i < size; i++)
+    ret = (ret ^ buf[i]) * 0x01000193;
+  return ret;
+}
 
-  // Try to open the file and process its content.
+// Hashes the ROM size, its first sector (with the header) and a few sampled
+// sectors across the ROM. Just a few SD reads, regardless of the ROM size.
+bool rom_fingerprint(const char *romfn, t_rom_fingerprint *fp) {
   FIL fd;
-  if (FR_OK != f_open(&fd, tmp, FA_READ))
+  if (FR_OK != f_open(&fd, romfn, FA_READ))
     return false;
 
-  uint8_t buf[1024];
+  SHA256_State st;
+  sha256_init(&st);
+  fp->size = f_size(&fd);
+  sha256_transform(&st, &fp->size, sizeof(fp->size));
+
+  for (unsigned i = 0; i <= PCACHE_FP_SAMPLES; i++) {
+    uint8_t buf[512];
+    UINT rdbytes;
+    uint32_t off = (fp->size / (PCACHE_FP_SAMPLES + 1) * i) & ~511U;
+    if (FR_OK != f_lseek(&fd, off) || FR_OK != f_read(&fd, buf, sizeof(buf), &rdbytes)) {
+      f_close(&fd);
+      return false;
+    }
+    sha256_transform(&st, buf, rdbytes);
+  }
+  f_close(&fd);
+
+  uint8_t hash[32];
+  sha256_finalize(&st, hash);
+  memcpy(fp->hash, hash, sizeof(fp->hash));
+  return true;
+}
+
+static bool pcache_read_entry(FIL *fd, unsigned n, t_pcache_entry *e) {
   UINT rdbytes;
-  if (FR_OK != f_read(&fd, buf, sizeof(buf), &rdbytes))
+  return FR_OK == f_lseek(fd, PCACHE_HDR_SIZE + n * sizeof(t_pcache_entry)) &&
+         FR_OK == f_read(fd, e, sizeof(*e), &rdbytes) && rdbytes == sizeof(*e);
+}
+
+static bool pcache_write_entry(FIL *fd, unsigned n, const t_pcache_entry *e) {
+  UINT wrbytes;
+  return FR_OK == f_lseek(fd, PCACHE_HDR_SIZE + n * sizeof(t_pcache_entry)) &&
+         FR_OK == f_write(fd, e, sizeof(*e), &wrbytes) && wrbytes == sizeof(*e);
+}
+
+// Returns the position of the first entry not lower than the fingerprint.
+static int pcache_search(FIL *fd, unsigned count, const t_rom_fingerprint *fp, t_pcache_entry *e, bool *found) {
+  unsigned lo = 0, hi = count;
+  *found = false;
+  while (lo < hi) {
+    unsigned mid = (lo + hi) / 2;
+    if (!pcache_read_entry(fd, mid, e))
+      return -1;
+    int c = memcmp(&e->fp, fp, sizeof(*fp));
+    if (!c) {
+      *found = true;
+      return mid;
+    }
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static bool pcache_valid_header(const t_pcache_header *hdr) {
+  return !memcmp(hdr->signature, PCACHE_SIGNATURE, sizeof(hdr->signature)) &&
+         hdr->version == PATCH_CACHE_VERSION && hdr->count <= PATCH_CACHE_MAXENT;
+}
+
+bool load_cached_patches(const char *romfn, t_patch *patches) {
+  t_rom_fingerprint fp;
+  if (!rom_fingerprint(romfn, &fp))
     return false;
 
-  return unserialize_patch(buf, rdbytes, patches);
+  FIL fd;
+  if (FR_OK != f_open(&fd, PATCH_CACHE_FILE, FA_READ))
+    return false;
+
+  bool ret = false, found;
+  t_pcache_header hdr;
+  t_pcache_entry e;
+  UINT rdbytes;
+  if (FR_OK == f_read(&fd, &hdr, sizeof(hdr), &rdbytes) && rdbytes == sizeof(hdr) &&
+      pcache_valid_header(&hdr) && pcache_search(&fd, hdr.count, &fp, &e, &found) >= 0 && found) {
+
+    uint8_t *buf = patchbuf;
+    if (FR_OK == f_lseek(&fd, PCACHE_REC_OFFSET + e.recnum * PCACHE_REC_SIZE) &&
+        FR_OK == f_read(&fd, buf, PCACHE_REC_SIZE, &rdbytes) && rdbytes == PCACHE_REC_SIZE &&
+        pcache_checksum(buf, PCACHE_REC_SIZE) == e.checksum)
+      ret = unserialize_patch(buf, rdbytes, patches);
+  }
+
+  f_close(&fd);
+  return ret;
 }
 
 bool write_patches_cache(const char *romfn, const t_patch *patches) {
-  char tmp[MAX_FN_LEN];
-  const char *p = file_basename(romfn);
-  strcpy(tmp, PATCHDB_PATH);
-  strcat(tmp, p);
-
-  // Replace the extension of the ROM with something more fitting.
-  replace_extension(tmp, ".patch");
+  t_rom_fingerprint fp;
+  if (!rom_fingerprint(romfn, &fp))
+    return false;
 
   // Attempt to create dirs, should they not exist
   f_mkdir(SUPERFW_DIR);
-  f_mkdir(PATCHDB_PATH);
-  // Delete any existing patch file
-  f_unlink(tmp);
 
-  // Try to open the file and process its content.
   FIL fd;
-  if (FR_OK != f_open(&fd, tmp, FA_WRITE | FA_CREATE_ALWAYS))
+  if (FR_OK != f_open(&fd, PATCH_CACHE_FILE, FA_READ | FA_WRITE | FA_OPEN_ALWAYS))
     return false;
 
-  uint8_t buf[1024];
-  int fs = serialize_patch(patches, buf);
+  // Start over if the cache is invalid, outdated or full.
+  t_pcache_header hdr;
+  UINT rdbytes, wrbytes;
+  if (FR_OK != f_read(&fd, &hdr, sizeof(hdr), &rdbytes) || rdbytes != sizeof(hdr) ||
+      !pcache_valid_header(&hdr) || hdr.count >= PATCH_CACHE_MAXENT) {
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.signature, PCACHE_SIGNATURE, sizeof(hdr.signature));
+    hdr.version = PATCH_CACHE_VERSION;
+  }
 
-  UINT wrbytes;
-  if (FR_OK != f_write(&fd, buf, fs, &wrbytes)) {
-    f_close(&fd);
-    f_unlink(tmp);
-    return false;
+  bool found;
+  t_pcache_entry e;
+  int pos = pcache_search(&fd, hdr.count, &fp, &e, &found);
+  if (pos < 0)
+    goto err;
+
+  // Records have a fixed size (zero padded)
+  uint8_t *buf = patchbuf;
+  memset(buf, 0, PCACHE_REC_SIZE);
+  serialize_patch(patches, buf);
+  if (!found)
+    e.recnum = hdr.count;
+  e.fp = fp;
+  e.checksum = pcache_checksum(buf, PCACHE_REC_SIZE);
+
+  // Write the record first, then insert the entry in the index.
+  if (FR_OK != f_lseek(&fd, PCACHE_REC_OFFSET + e.recnum * PCACHE_REC_SIZE) ||
+      FR_OK != f_write(&fd, buf, PCACHE_REC_SIZE, &wrbytes) || wrbytes != PCACHE_REC_SIZE)
+    goto err;
+
+  if (!found) {
+    // Shift the tail of the index (backwards) to make room for the entry.
+    for (unsigned i = hdr.count; i > (unsigned)pos; i--) {
+      t_pcache_entry tmp;
+      if (!pcache_read_entry(&fd, i - 1, &tmp) || !pcache_write_entry(&fd, i, &tmp))
+        goto err;
+    }
+    hdr.count++;
   }
+  if (!pcache_write_entry(&fd, pos, &e))
+    goto err;
+
+  if (FR_OK != f_lseek(&fd, 0) || FR_OK != f_write(&fd, &hdr, sizeof(hdr), &wrbytes) || wrbytes != sizeof(hdr))
+    goto err;
 
   f_close(&fd);
-  return wrbytes == fs;
+  return true;
+
+err:
+  f_close(&fd);
+  return false;
 }
 
 
@@ -23,8 +23,15 @@
 #include <stdbool.h>
 #include <string.h>
 
-#define MAX_PATCH_OPS           128   // (artifically limited to save memory)
-#define MAX_PATCH_PRG             4   // Only 4 programs can be encoded so far
+#define MAX_PATCH_OPS           512   // Ops per patch set (limited to save memory)
+#define MAX_PATCH_PRG             4   // Programs used so far (the op encoding allows 8)
+
+#define PE_LDRTGT_WINDOW       2048   // Word positions tracked as pending LDR targets
+#define PE_LOOKAHEAD_WORDS       16   // Words read past the scanned word (signatures)
+#define PE_OPLOG_RESERVED        64   // Op log slots that WAITCNT ops cannot use
+
+#define PATCH_CACHE_VERSION       2   // Bump to invalidate caches (engine output changes)
+#define PATCH_CACHE_MAXENT      512   // Max cached ROMs (cache is reset when full)
 
 typedef struct {
   uint32_t length;
@@ -32,11 +39,11 @@ typedef struct {
 } t_patch_prog;
 
 struct struct_t_patch {
-  uint8_t wcnt_ops;               // WaitCNT patches
-  uint8_t save_ops;               // Save patches
+  uint16_t wcnt_ops;              // WaitCNT patches
+  uint16_t save_ops;              // Save patches
+  uint16_t irqh_ops;              // IRQ handler patches
+  uint16_t rtc_ops;               // RTC patches
   uint8_t save_mode;              // Save mode type (memory type)
-  uint8_t irqh_ops;               // IRQ handler patches
-  uint8_t rtc_ops;                // RTC patches
   uint32_t hole_size;             // Hole/trailing info, for ROM free space
   uint32_t hole_addr;
   uint32_t op[MAX_PATCH_OPS];     // Contain patch info for waitcnt and save
@@ -45,6 +52,28 @@ struct struct_t_patch {
 
 typedef struct struct_t_patch t_patch;
 
+// Max serialized patch set size (header, programs and ops)
+#define MAX_PATCH_SERIALIZED    (32 + MAX_PATCH_PRG * sizeof(t_patch_prog) + MAX_PATCH_OPS * sizeof(uint32_t))
+
+// Compiled patch set: ROM writes, sorted by offset and non-overlapping.
+#define MAX_PATCH_WRITES        (MAX_PATCH_OPS * 2 + 16)
+
+typedef struct {
+  uint32_t offset;                // ROM offset
+  uint16_t size;                  // Write size in bytes
+  uint16_t seq;                   // Op order (later writes take precedence)
+  const uint8_t *data;            // Points to the patch set or patch routines
+} t_patch_write;
+
+typedef struct {
+  unsigned count;
+  unsigned cursor;                // First write not yet fully applied
+  uint32_t curbase;               // Base address of the last applied chunk
+  uint32_t dsaddr;                // DirSav payload address (written after save routines)
+  uint32_t igmaddr;               // In-game menu entrypoint (zero if disabled)
+  t_patch_write w[MAX_PATCH_WRITES];
+} t_patch_wlist;
+
 typedef struct {
   unsigned filesize;
   // Save type related info
@@ -54,25 +83,45 @@ typedef struct {
   bool rtc_guess;
   // Trailing data
   uint32_t ldata, ldatacnt;
+  // Streaming state, carried across patchengine_process_rom calls.
+  uint32_t baseaddr;                         // ROM offset of the next word to scan
+  unsigned skip;                             // Words to skip (matches spanning chunks)
+  unsigned pendcnt;                          // Words waiting for lookahead data
+  uint32_t pend[PE_LOOKAHEAD_WORDS * 2];     // Pending words (plus next chunk head)
+  uint32_t ldrtgt[PE_LDRTGT_WINDOW / 32];    // Ring bitmap, words loaded by LDR [pc + off]
+  // Op log: ops are appended as found, and sorted by type when finalizing.
+  uint32_t *ops;
+  unsigned opcnt, opcap;
   // The actual patch data.
   t_patch p;
 } t_patch_builder;
 
 void patchmem_dbinfo(const uint8_t *dbptr, uint32_t *pcnt, char *version, char *date, char *creator);
+// Validates the DB layout and index ordering (upgrades ordered DBs in place).
+bool patchmem_validate(uint8_t *dbptr, unsigned dbsize);
 // Lookup routines (builtin, on-disk, etc).
 bool patchmem_lookup(const uint8_t *gamecode, const uint8_t *dbptr, t_patch *pdata);
-// Actual patching magic
-bool patch_apply_rom(uint8_t *buffer, unsigned bufsize, uint32_t baseaddr, bool patch_waitcnt, const t_patch *pdata,
-                     bool patch_rtc, uint32_t igmenu_addr, uint32_t ds_addr);
+// Actual patching magic: patches are compiled once and applied in chunks
+bool patch_compile(t_patch_wlist *wl, const t_patch *pdata, bool patch_waitcnt, bool patch_rtc,
+                   uint32_t igmenu_addr, uint32_t ds_addr);
+void patch_apply_wlist(t_patch_wlist *wl, uint8_t *buffer, unsigned bufsize, uint32_t baseaddr);
 // Payload patching routine
 void payload_apply_rom(uint8_t *buffer, unsigned bufsize, uint32_t baseaddr,
                        const uint8_t *payload, unsigned payload_size, uint32_t payload_offset);
 
-void patchengine_init(t_patch_builder *patch, unsigned filesize);
+// The op log is provided by the caller (any size, bigger logs can hold more ops).
+void patchengine_init(t_patch_builder *patch, unsigned filesize, uint32_t *oplog, unsigned oplogcnt);
 void patchengine_finalize(t_patch_builder *patch);
-// Generates a patch set from a given ROM.
+// Generates a patch set from a given ROM, fed in order in chunks of any size.
 bool patchengine_process_rom(const uint32_t *rom, unsigned romsize, t_patch_builder *patch, void(*progresscb)(unsigned));
 
+// Identifies a ROM by its contents (header and sampled sectors)
+typedef struct {
+  uint8_t hash[12];               // Truncated SHA256
+  uint32_t size;                  // ROM file size
+} t_rom_fingerprint;
+
+bool rom_fingerprint(const char *romfn, t_rom_fingerprint *fp);
 // Tries to load patches from disk
 bool load_cached_patches(const char *romfn, t_patch *patches);
 bool load_rom_patches(const char *romfn, t_patch *patches);
@@ -24,6 +24,15 @@
 #include "fatfs/ff.h"
 #include "common.h"
 #include "patchengine.h"
+#include "util.h"
+
+#define PTDB_SIGNATURE        0x31424450   // "PDB1" in ASCII
+#define PTDB_VERSION_LINEAR   0x00010000   // Index entries in arbitrary order
+#define PTDB_VERSION_SORTED   0x00010001   // Index sorted by game code + version
+
+#define PTDB_PRGS_OFFSET      512          // Program block follows the header
+#define PTDB_IDX_OFFSET       1024         // Index blocks start here
+#define PTDB_IDX_BLKSIZE      512          // Each index block is 512 bytes
 
 typedef struct {
   uint32_t signature;    // "PTDB" in ASCII
@@ -51,6 +60,11 @@ static int gcodecmp(const uint8_t *g1, const uint8_t *g2) {
   return 0;
 }
 
+static bool ptdb_header_ok(const t_db_header *dbh) {
+  return dbh->signature == PTDB_SIGNATURE &&
+         (dbh->dbversion == PTDB_VERSION_LINEAR || dbh->dbversion == PTDB_VERSION_SORTED);
+}
+
 void patchmem_dbinfo(const uint8_t *dbptr, uint32_t *pcnt, char *version, char *date, char *creator) {
   const t_db_header *dbh = (t_db_header*)dbptr;
   *pcnt = dbh->patchcnt;
@@ -59,21 +73,90 @@ void patchmem_dbinfo(const uint8_t *dbptr, uint32_t *pcnt, char *version, char *
   memcpy(creator, dbh->creator, sizeof(dbh->creator));
 }
 
+// Checks the database structure (sizes and offsets) and whether the index is
+// strictly ordered. Ordered databases in the old format are upgraded in place,
+// so that lookups can use binary search from then on.
+bool patchmem_validate(uint8_t *dbptr, unsigned dbsize) {
+  t_db_header *dbh = (t_db_header*)dbptr;
+  if (dbsize < PTDB_IDX_OFFSET || !ptdb_header_ok(dbh))
+    return false;
+
+  // Index blocks must fit in the image (checked first, so that the sizes
+  // below cannot overflow), and the index must fit in its blocks.
+  if (dbh->idxcnt > (dbsize - PTDB_IDX_OFFSET) / PTDB_IDX_BLKSIZE)
+    return false;
+  const unsigned entoff = PTDB_IDX_OFFSET + PTDB_IDX_BLKSIZE * dbh->idxcnt;
+  if (dbh->patchcnt > dbh->idxcnt * (PTDB_IDX_BLKSIZE / sizeof(t_db_idx)))
+    return false;
+
+  const t_db_idx *dbidx = (t_db_idx*)&dbptr[PTDB_IDX_OFFSET];
+  const unsigned maxwords = (dbsize - entoff) / 4;
+  bool sorted = true;
+  for (unsigned i = 0; i < dbh->patchcnt; i++) {
+    // The whole entry (header, ops and hole word) must be in the image.
+    const uint32_t offset = dbidx[i].offset >> 8;
+    if (offset >= maxwords)
+      return false;
+    const uint32_t pheader = ((uint32_t*)&dbptr[entoff])[offset];
+    const unsigned numops = ((pheader >>  0) & 0xFF) + ((pheader >>  8) & 0x1F) +
+                            ((pheader >> 16) & 0xFF) + ((pheader >> 24) & 0x0F);
+    const unsigned hole = (pheader >> 28) & 0x1;
+    if (offset + 1 + numops + hole > maxwords)
+      return false;
+    if (i && gcodecmp(dbidx[i-1].gcode, dbidx[i].gcode) >= 0)
+      sorted = false;
+  }
+
+  if (dbh->dbversion == PTDB_VERSION_SORTED)
+    return sorted;      // Claims to be sorted but it is not, reject it.
+
+  if (sorted)
+    dbh->dbversion = PTDB_VERSION_SORTED;
+  return true;
+}
+
+// Finds the game entry in the index, returns its position or -1 if not found.
+static int patchmem_find(const t_db_header *dbh, const t_db_idx *dbidx, const uint8_t *gamecode) {
+  if (dbh->dbversion == PTDB_VERSION_SORTED) {
+    // Binary search over the (game code, version) ordered index.
+    unsigned lo = 0, hi = dbh->patchcnt;
+    while (lo < hi) {
+      unsigned mid = (lo + hi) >> 1;
+      int c = gcodecmp(dbidx[mid].gcode, gamecode);
+      if (!c)
+        return mid;
+      else if (c < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  }
+  else {
+    for (unsigned i = 0; i < dbh->patchcnt; i++)
+      if (!gcodecmp(dbidx[i].gcode, gamecode))
+        return i;
+  }
+  return -1;
+}
+
 // Routines to lookup patches from the patch database in memory
 bool patchmem_lookup(const uint8_t *gamecode, const uint8_t *dbptr, t_patch *pdata) {
   const t_db_header *dbh = (t_db_header*)dbptr;
-  if (dbh->signature != 0x31424450 ||      // PTDB signature mismatch
-      dbh->dbversion != 0x00010000)        // Version check
+  if (!ptdb_header_ok(dbh))                // Signature or version mismatch
     return false;
 
   // Skip header and program block.
-  const t_db_idx *dbidx = (t_db_idx*)&dbptr[1024];
+  const t_db_idx *dbidx = (t_db_idx*)&dbptr[PTDB_IDX_OFFSET];
   // Skip the index block to address data entries.
-  const uint32_t *entries = (uint32_t*)&dbptr[1024 + 512 * dbh->idxcnt];
+  const uint32_t *entries = (uint32_t*)&dbptr[PTDB_IDX_OFFSET + PTDB_IDX_BLKSIZE * dbh->idxcnt];
+
+  int idx = patchmem_find(dbh, dbidx, gamecode);
+  if (idx < 0)
+    return false;
 
   // Load programs as well
   int pgn = 0;
-  const uint8_t *pgrpage = &dbptr[512];
+  const uint8_t *pgrpage = &dbptr[PTDB_PRGS_OFFSET];
   for (int i = 0; i < MAX_PATCH_PRG; i++)
     pdata->prgs[i].length = 0;
   for (int i = 0; i < 512 && pgn < MAX_PATCH_PRG; i++) {
@@ -89,65 +172,66 @@ bool patchmem_lookup(const uint8_t *gamecode, const uint8_t *dbptr, t_patch *pda
     i += cnt;
   }
 
-  for (unsigned i = 0; i < dbh->patchcnt; i++) {
-    if (!gcodecmp(dbidx[i].gcode, gamecode)) {
-      uint32_t offset = dbidx[i].offset >> 8;
-      const uint32_t *p = &entries[offset];
-      const uint32_t pheader = *p++;
-
-      pdata->wcnt_ops = (pheader >>  0) & 0xFF;
-      pdata->save_ops = (pheader >>  8) & 0x1F;    // Only 5 bits
-      pdata->irqh_ops = (pheader >> 16) & 0xFF;
-      pdata->rtc_ops =  (pheader >> 24) & 0x0F;    // Only 4 bits
+  uint32_t offset = dbidx[idx].offset >> 8;
+  const uint32_t *p = &entries[offset];
+  const uint32_t pheader = *p++;
 
-      pdata->save_mode = (pheader >> 13) & 0x7;    // 3 bits
+  pdata->wcnt_ops = (pheader >>  0) & 0xFF;
+  pdata->save_ops = (pheader >>  8) & 0x1F;    // Only 5 bits
+  pdata->irqh_ops = (pheader >> 16) & 0xFF;
+  pdata->rtc_ops =  (pheader >> 24) & 0x0F;    // Only 4 bits
 
-      const unsigned numops = pdata->wcnt_ops + pdata->save_ops + pdata->irqh_ops + pdata->rtc_ops;
+  pdata->save_mode = (pheader >> 13) & 0x7;    // 3 bits
 
-      if ((pheader >> 28) & 0x1) {
-        // Hole/Trailing space information, placed in the last op
-        pdata->hole_addr = (p[numops] >> 16) << 10;   // In KiB chunks
-        pdata->hole_size = (p[numops] & 0xFFFF) << 10;
-      }
-
-      // Copy patch words
-      memcpy(&pdata->op[0], p, numops * sizeof(uint32_t));
+  const unsigned numops = pdata->wcnt_ops + pdata->save_ops + pdata->irqh_ops + pdata->rtc_ops;
+  if (numops > MAX_PATCH_OPS)
+    return false;
 
-      return true;
-    }
+  if ((pheader >> 28) & 0x1) {
+    // Hole/Trailing space information, placed in the last op
+    pdata->hole_addr = (p[numops] >> 16) << 10;   // In KiB chunks
+    pdata->hole_size = (p[numops] & 0xFFFF) << 10;
   }
 
-  return false;
+  // Copy patch words
+  memcpy(&pdata->op[0], p, numops * sizeof(uint32_t));
+
+  return true;
 }
 
 // Write a byte to a buffer ensuring that only 16 bit accesses are performed.
 static void write_mem8(uint8_t *mem, uint8_t bytedata) {
   uintptr_t ptraddr = (uintptr_t)mem;
-  volatile uint16_t *aptr = (uint16_t*)(ptraddr & ~1U);
+  volatile uint16_t *aptr = (uint16_t*)(ptraddr & ~(uintptr_t)1);
   unsigned sha = (ptraddr & 1) ? 8 : 0;
   uint16_t data = *aptr & (~(0xFF << sha));
   data |= (bytedata << sha);
   *aptr = data;
 }
 
-static void write_mem16(uint8_t *mem, uint16_t worddata) {
-  write_mem8(mem + 0, worddata >>  0);
-  write_mem8(mem + 1, worddata >>  8);
+// Copies a buffer using aligned 16/32 bit stores (only the unaligned edges,
+// if any, need a read-modify-write).
+static void write_mem(uint8_t *mem, const uint8_t *data, unsigned size) {
+  if (((uintptr_t)mem & 1) && size) {
+    write_mem8(mem++, *data++);
+    size--;
+  }
+  if (((uintptr_t)mem & 2) && size >= 2) {
+    *(volatile uint16_t*)mem = data[0] | (data[1] << 8);
+    mem += 2; data += 2; size -= 2;
+  }
+  for (; size >= 4; size -= 4, mem += 4, data += 4)
+    *(volatile uint32_t*)mem = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+  if (size >= 2) {
+    *(volatile uint16_t*)mem = data[0] | (data[1] << 8);
+    mem += 2; data += 2; size -= 2;
+  }
+  if (size)
+    write_mem8(mem, *data);
 }
 
 static void write_mem32(uint8_t *mem, uint32_t worddata) {
-  write_mem8(mem + 0, worddata >>  0);
-  write_mem8(mem + 1, worddata >>  8);
-  write_mem8(mem + 2, worddata >> 16);
-  write_mem8(mem + 3, worddata >> 24);
-}
-
-static void copy_func16(uint8_t *buf, uint32_t baseaddr, unsigned bufsize, const uint16_t *fnptr, unsigned size) {
-  volatile uint16_t *buf16 = (uint16_t*)buf;
-  fnptr = (uint16_t*)(((uintptr_t)fnptr) & ~1U);           // Clear thumb addr bit for the symbol
-  for (unsigned i = 0; i < size; i += 2)
-    if (baseaddr + i < bufsize)
-      *buf16++ = *fnptr++;
+  write_mem(mem, (uint8_t*)&worddata, sizeof(worddata));
 }
 
 // Flashing/Eeprom routines flavours:
@@ -161,11 +245,6 @@ typedef struct {
   f_func_info flash_fncs[5];     // read, erase-device, erase-sector, write-sector, write-byte
 } t_psave_funcs;
 
-typedef struct {
-  uint32_t dspayload_addr;
-  const t_psave_funcs *sfns;
-} t_psave_info;
-
 #define SFUNC(start, end) { (start), (end) - (start) },
 
 static const t_psave_funcs psram_conversion_64k = {
@@ -229,147 +308,253 @@ static const struct {
 #define FN_ARM_RET1       0xe3a00001
 #define FN_ARM_RETBX      0xe12fff1e
 
-void apply_patch_ops(
-  // Where the ROM has been loaded.
-  uint8_t *buffer, unsigned bufsize,
-  // What base address this ROM has.
-  uint32_t baseaddr,
-  // Patch to apply
+static const uint16_t nop_thumb = 0x46C0;                 // mov r8, r8
+static const uint32_t nop_arm = 0xE1A00000;               // mov r0, r0
+static const uint32_t fn_thumb_ret[2] = { FN_THUMB_RET0, FN_THUMB_RET1 };
+static const uint32_t fn_arm_ret[2][2] = {
+  { FN_ARM_RET0, FN_ARM_RETBX },
+  { FN_ARM_RET1, FN_ARM_RETBX },
+};
+
+static bool wlist_add(t_patch_wlist *wl, uint32_t offset, const void *data, unsigned size) {
+  if (wl->count >= MAX_PATCH_WRITES)
+    return false;
+  if (size) {
+    t_patch_write *w = &wl->w[wl->count];
+    w->offset = offset;
+    w->size = size;
+    w->seq = wl->count++;
+    w->data = data;
+  }
+  return true;
+}
+
+static bool wlist_add_func(t_patch_wlist *wl, uint32_t offset, const void *fnptr, unsigned size) {
+  // Clear thumb addr bit for the symbol, copy whole half-words.
+  return wlist_add(wl, offset, (void*)(((uintptr_t)fnptr) & ~(uintptr_t)1), ROUND_UP2(size, 2));
+}
+
+static bool compile_patch_ops(
+  t_patch_wlist *wl,
   const uint32_t *ops, unsigned pcount,
-  const t_patch_prog *prgs, const t_psave_info *psi
+  const t_patch_prog *prgs, const t_psave_funcs *sfns
 ) {
   for (unsigned i = 0; i < pcount; i++) {
     uint32_t opc = ops[i] >> 28;
     uint32_t arg = (ops[i] >> 25) & 7;
     uint32_t moff = ops[i] & 0x1FFFFFF;
+    bool ok = true;
 
     switch (opc) {
-    case 0x0:
-      // Patch a full program into an address.
-      for (unsigned j = 0; j < prgs[arg].length; j++)
-        if (moff + j >= baseaddr && moff + j < baseaddr + bufsize)
-          write_mem8(&buffer[moff + j - baseaddr], prgs[arg].data[j]);
+    case 0x0:   // Patch a full program into an address.
+      if (arg < MAX_PATCH_PRG)
+        ok = wlist_add(wl, moff, prgs[arg].data, MIN(prgs[arg].length, sizeof(prgs[arg].data)));
       break;
     case 0x1:   // Patch Thumb instruction
-      if (moff >= baseaddr && moff < baseaddr + bufsize)
-        write_mem16(&buffer[moff - baseaddr], 0x46C0);   // mov r8, r8
+      ok = wlist_add(wl, moff, &nop_thumb, sizeof(nop_thumb));
       break;
     case 0x2:   // Patch ARM instruction
-      if (moff >= baseaddr && moff < baseaddr + bufsize)
-        write_mem32(&buffer[moff - baseaddr], 0xE1A00000);   // mov r0, r0
+      ok = wlist_add(wl, moff, &nop_arm, sizeof(nop_arm));
       break;
-    case 0x3:   // Write N bytes to address
-      for (unsigned j = 0; j < arg + 1; j++)
-        if (moff + j >= baseaddr && moff + j < baseaddr + bufsize)
-          write_mem8(&buffer[moff + j - baseaddr], ops[(j / 4) + 1] >> (j * 8));
+    case 0x3:   // Write N bytes to address (following op words, little endian)
+      if (i + 1 + (arg + 4) / 4 > pcount)
+        return false;
+      ok = wlist_add(wl, moff, &ops[i + 1], arg + 1);
       i += (arg + 1 + 3) / 4;
       break;
     case 0x4:   // Write N words to address
-      for (unsigned j = 0; j < arg + 1; j++)
-        if (moff + j >= baseaddr && moff + j < baseaddr + bufsize)
-          write_mem32(&buffer[moff + j * 4 - baseaddr], ops[++i]);
+      if (i + 1 + arg + 1 > pcount)
+        return false;
+      ok = wlist_add(wl, moff, &ops[i + 1], (arg + 1) * 4);
+      i += arg + 1;
       break;
     case 0x5:   // Patch function with a dummy one
-      switch (arg) {
-        case 0:
-        case 1:
-          if (moff >= baseaddr && moff < baseaddr + bufsize)
-            write_mem32(&buffer[moff - baseaddr], arg ? FN_THUMB_RET1 : FN_THUMB_RET0);
-          break;
-        case 4:
-        case 5:
-          if (moff >= baseaddr && moff < baseaddr + bufsize)
-            write_mem32(&buffer[moff - baseaddr], (arg == 5) ? FN_ARM_RET1 : FN_ARM_RET0);
-          if (moff + 4 >= baseaddr && moff + 4 < baseaddr + bufsize)
-            write_mem32(&buffer[moff + 4 - baseaddr], FN_ARM_RETBX);
-          break;
-      };
+      if (arg == 0 || arg == 1)
+        ok = wlist_add(wl, moff, &fn_thumb_ret[arg], sizeof(fn_thumb_ret[arg]));
+      else if (arg == 4 || arg == 5)
+        ok = wlist_add(wl, moff, fn_arm_ret[arg - 4], sizeof(fn_arm_ret[arg - 4]));
       break;
 
     case 0x7:    // RTC handlers
-      copy_func16(&buffer[moff - baseaddr], moff - baseaddr, bufsize, rtc_fncs[arg].ptr, *rtc_fncs[arg].size);
+      if (arg < ARRAY_SIZE(rtc_fncs))
+        ok = wlist_add_func(wl, moff, rtc_fncs[arg].ptr, *rtc_fncs[arg].size);
       break;
 
     case 0x8:    // EEPROM memory handlers
       if (arg < 2) {
-        unsigned fnsz = *psi->sfns->eeprom_fncs[arg].size;
-        copy_func16(&buffer[moff - baseaddr], moff - baseaddr, bufsize, psi->sfns->eeprom_fncs[arg].ptr, fnsz);
-        if (moff + fnsz >= baseaddr && moff + fnsz < baseaddr + bufsize)
-          write_mem32(&buffer[moff + fnsz - baseaddr], psi->dspayload_addr);
-        break;
+        unsigned fnsz = *sfns->eeprom_fncs[arg].size;
+        ok = wlist_add_func(wl, moff, sfns->eeprom_fncs[arg].ptr, fnsz) &&
+             wlist_add(wl, moff + fnsz, &wl->dsaddr, sizeof(wl->dsaddr));
       }
       break;
 
     case 0x9:    // FLASH memory handlers
       if (arg < 5) {
-        unsigned fnsz = *psi->sfns->flash_fncs[arg].size;
-        copy_func16(&buffer[moff - baseaddr], moff - baseaddr, bufsize, psi->sfns->flash_fncs[arg].ptr, fnsz);
-        if (moff + fnsz >= baseaddr && moff + fnsz < baseaddr + bufsize)
-          write_mem32(&buffer[moff + fnsz - baseaddr], psi->dspayload_addr);
+        unsigned fnsz = *sfns->flash_fncs[arg].size;
+        ok = wlist_add_func(wl, moff, sfns->flash_fncs[arg].ptr, fnsz) &&
+             wlist_add(wl, moff + fnsz, &wl->dsaddr, sizeof(wl->dsaddr));
       }
+      break;
     };
+
+    if (!ok)
+      return false;
   }
+  return true;
 }
 
+static int pwrite_cmp(const void *a, const void *b) {
+  const t_patch_write *wa = (t_patch_write*)a, *wb = (t_patch_write*)b;
+  if (wa->offset != wb->offset)
+    return wa->offset < wb->offset ? -1 : 1;
+  return (int)wa->seq - (int)wb->seq;
+}
 
-// Applies a patch directly into the ROM memory. The ROM can be a partial image
-// (i.e. half a ROM or similar) but it should always be 4byte aligned (size too).
-// Assuming we do at least 512 byte blocks or so too.
-bool patch_apply_rom(
-  // Where the ROM has been loaded.
-  uint8_t *buffer, unsigned bufsize,
-  // What base address this ROM has.
-  uint32_t baseaddr,
+// Sorts the writes by offset and trims overlapping ones (ops are applied in
+// order, so the latest one wins), so that no write depends on another.
+// Overlaps are unusual, this rarely takes more than one pass.
+static bool wlist_resolve(t_patch_wlist *wl) {
+  bool overlaps = true;
+  while (overlaps) {
+    overlaps = false;
+    heapsort4(wl->w, wl->count, sizeof(t_patch_write) / sizeof(uint32_t), pwrite_cmp);
+
+    for (unsigned i = 0, cnt = wl->count; i + 1 < cnt; i++) {
+      t_patch_write *a = &wl->w[i], *b = &wl->w[i + 1];
+      uint32_t aend = a->offset + a->size, bend = b->offset + b->size;
+      if (aend <= b->offset)
+        continue;
+
+      overlaps = true;
+      if (a->seq > b->seq) {
+        // Trim the head of b (perhaps all of it).
+        unsigned trim = MIN(aend, bend) - b->offset;
+        b->offset += trim;
+        b->data += trim;
+        b->size -= trim;
+      } else {
+        // Trim a, it might need splitting if it extends past b.
+        if (aend > bend) {
+          if (wl->count >= MAX_PATCH_WRITES)
+            return false;
+          t_patch_write *t = &wl->w[wl->count++];
+          t->offset = bend;
+          t->size = aend - bend;
+          t->seq = a->seq;
+          t->data = a->data + (bend - a->offset);
+        }
+        a->size = b->offset - a->offset;
+      }
+      i++;    // b might be out of order now, check it in the next pass
+    }
+
+    // Drop (fully) overwritten writes.
+    unsigned j = 0;
+    for (unsigned i = 0; i < wl->count; i++)
+      if (wl->w[i].size)
+        wl->w[j++] = wl->w[i];
+    wl->count = j;
+  }
+
+  // Coalesce contiguous writes with contiguous data.
+  unsigned j = 0;
+  for (unsigned i = 0; i < wl->count; i++) {
+    const t_patch_write *w = &wl->w[i];
+    if (j && wl->w[j-1].offset + wl->w[j-1].size == w->offset &&
+        wl->w[j-1].data + wl->w[j-1].size == w->data && wl->w[j-1].size + w->size <= 0xFFFF)
+      wl->w[j-1].size += w->size;
+    else
+      wl->w[j++] = *w;
+  }
+  wl->count = j;
+
+  return true;
+}
+
+// Compiles a patch set into a list of writes (sorted by ROM offset) that can be
+// applied to ROM chunks. The patch set must outlive the write list.
+bool patch_compile(
+  t_patch_wlist *wl,
   // Patching options
-  bool patch_waitcnt,
   const t_patch *pdata,
+  bool patch_waitcnt,
   bool patch_rtc,
   uint32_t igmenu_addr,
   uint32_t ds_addr
 ) {
-  const uint32_t *ops = &pdata->op[0];
   // Save patch routines vary depending on whether DirectSave is enabled or not.
-  const t_psave_info psi = {
-    .dspayload_addr = ds_addr,
-    .sfns = ds_addr                                ? &pdirectsave :
-            pdata->save_mode == SaveTypeFlash1024K ? &psram_conversion_128k
-                                                   : &psram_conversion_64k
-  };
+  const t_psave_funcs *sfns = ds_addr                                ? &pdirectsave :
+                              pdata->save_mode == SaveTypeFlash1024K ? &psram_conversion_128k
+                                                                     : &psram_conversion_64k;
+  const uint32_t *ops = &pdata->op[0];
+  wl->count = 0;
+  wl->cursor = 0;
+  wl->curbase = 0;
+  wl->dsaddr = ds_addr;
+  wl->igmaddr = igmenu_addr;
 
   // Apply the WAIT CNT patches
-  if (patch_waitcnt)
-    apply_patch_ops(buffer, bufsize, baseaddr, ops, pdata->wcnt_ops, pdata->prgs, &psi);
+  if (patch_waitcnt && !compile_patch_ops(wl, ops, pdata->wcnt_ops, pdata->prgs, sfns))
+    return false;
   ops += pdata->wcnt_ops;
 
   // Apply save patches
-  apply_patch_ops(buffer, bufsize, baseaddr, ops, pdata->save_ops, pdata->prgs, &psi);
+  if (!compile_patch_ops(wl, ops, pdata->save_ops, pdata->prgs, sfns))
+    return false;
   ops += pdata->save_ops;
 
   // Apply optional patches, they are placed right after.
-  if (igmenu_addr) {
-    apply_patch_ops(buffer, bufsize, baseaddr, ops, pdata->irqh_ops, pdata->prgs, &psi);
+  if (igmenu_addr && !compile_patch_ops(wl, ops, pdata->irqh_ops, pdata->prgs, sfns))
+    return false;
+  ops += pdata->irqh_ops;
 
-    // Need to patch the header with some entrypoint detour.
-    if (baseaddr == 0x0) {
-      uint32_t ibranch = *(uint32_t*)buffer;
-      uint32_t boot_addr = ((ibranch & 0xFFFFFF) << 2) + 8 + GBA_ROM_BASE;
+  // Apply RTC patches
+  if (patch_rtc && !compile_patch_ops(wl, ops, pdata->rtc_ops, pdata->prgs, sfns))
+    return false;
 
-      // Calculate the branch from 0x08000000 to igmenu_addr
-      unsigned brop = 0xEA000000 | ((igmenu_addr - GBA_ROM_BASE - 8) >> 2);
+  return wlist_resolve(wl);
+}
 
-      // Patch the first instruction with the branch opcode
-      write_mem32(&buffer[0], brop);
-      // Patch offset 0xB8 (unused header bits) with the real boot addr.
-      write_mem32(&buffer[0xB8], boot_addr);
-    }
+// Applies a compiled patch list directly into the ROM memory. The ROM can be a
+// partial image (i.e. half a ROM or similar) but it should always be 4 byte
+// aligned (size too). Assuming we do at least 512 byte blocks or so too.
+// Chunks are expected in increasing offset order (to be able to skip already
+// applied writes), otherwise the list is walked again.
+void patch_apply_wlist(
+  t_patch_wlist *wl,
+  // Where the ROM has been loaded.
+  uint8_t *buffer, unsigned bufsize,
+  // What base address this ROM has.
+  uint32_t baseaddr
+) {
+  if (baseaddr < wl->curbase)
+    wl->cursor = 0;
+  wl->curbase = baseaddr;
+
+  // Writes are sorted and do not overlap, skip the ones before this chunk.
+  while (wl->cursor < wl->count && wl->w[wl->cursor].offset + wl->w[wl->cursor].size <= baseaddr)
+    wl->cursor++;
+
+  for (unsigned i = wl->cursor; i < wl->count && wl->w[i].offset < baseaddr + bufsize; i++) {
+    const t_patch_write *w = &wl->w[i];
+    uint32_t start = MAX(w->offset, baseaddr);
+    uint32_t end = MIN(w->offset + w->size, baseaddr + bufsize);
+    write_mem(&buffer[start - baseaddr], &w->data[start - w->offset], end - start);
   }
-  ops += pdata->irqh_ops;
 
-  // Apply RTC patches
-  if (patch_rtc)
-    apply_patch_ops(buffer, bufsize, baseaddr, ops, pdata->rtc_ops, pdata->prgs, &psi);
+  // Need to patch the header with some entrypoint detour (for the in-game menu).
+  if (wl->igmaddr && baseaddr == 0x0) {
+    uint32_t ibranch = *(uint32_t*)buffer;
+    uint32_t boot_addr = ((ibranch & 0xFFFFFF) << 2) + 8 + GBA_ROM_BASE;
 
-  return true;
+    // Calculate the branch from 0x08000000 to igmenu_addr
+    unsigned brop = 0xEA000000 | ((wl->igmaddr - GBA_ROM_BASE - 8) >> 2);
+
+    // Patch the first instruction with the branch opcode
+    write_mem32(&buffer[0], brop);
+    // Patch offset 0xB8 (unused header bits) with the real boot addr.
+    write_mem32(&buffer[0xB8], boot_addr);
+  }
 }
 
 // Applies a payload to the ROM memory.
@@ -382,12 +567,10 @@ void payload_apply_rom(
   const uint8_t *payload, unsigned payload_size,
   uint32_t payload_offset
 ) {
-  // Optimize away the copy call if this can't possibly overlap.
-  if (payload_offset > baseaddr + bufsize)
-    return;
-  if (baseaddr > payload_offset + payload_size)
-    return;
-
-  copy_func16(&buffer[payload_offset - baseaddr], payload_offset - baseaddr, bufsize, (uint16_t*)payload, payload_size);
+  // Only copy the part that overlaps with this chunk (if any).
+  uint32_t start = MAX(payload_offset, baseaddr);
+  uint32_t end = MIN(payload_offset + payload_size, baseaddr + bufsize);
+  if (start < end)
+    write_mem(&buffer[start - baseaddr], &payload[start - payload_offset], end - start);
 }
 
@@ -18,6 +18,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <inttypes.h>
 
 #include "settings.h"
 #include "fatfs/ff.h"
@@ -90,6 +91,7 @@ uint32_t ingamemenu_default = 1;
 uint32_t rtcpatch_default = 1;
 uint32_t rtcvalue_default = 45568800U;
 uint32_t rtcspeed_default = 3;
+uint32_t patchgen_onload = 0;    // Generate missing patches while loading the ROM.
 
 // Setting loading/saving routines
 bool save_ui_settings() {
@@ -107,11 +109,11 @@ bool save_ui_settings() {
   uint16_t lc = lang_getcode();
   char buf[512];
   npf_snprintf(buf, sizeof(buf),
-    "theme=%lu\n"
+    "theme=%" PRIu32 "\n"
     "langcode=%c%c\n"
-    "recent_menu=%lu\n"
-    "anim_speed=%lu\n"
-    "hide_hidden=%lu\n",
+    "recent_menu=%" PRIu32 "\n"
+    "anim_speed=%" PRIu32 "\n"
+    "hide_hidden=%" PRIu32 "\n",
     menu_theme, (lc & 0xFF), (lc >> 8), recent_menu, anim_speed, hide_hidden);
 
   UINT wrbytes;
@@ -135,27 +137,28 @@ bool save_settings() {
   // Serialize the settings
   char buf[512];
   npf_snprintf(buf, sizeof(buf),
-    "hotkey_opt=%lu\n"
-    "boot_to_bios=%lu\n"
-    "save_path_policy=%lu\n"
-    "state_path_policy=%lu\n"
-    "sram_backup_count=%lu\n"
-    "enable_cheats=%lu\n"
-    "enable_slowld=%lu\n"
-    "enable_fastewram=%lu\n"
+    "hotkey_opt=%" PRIu32 "\n"
+    "boot_to_bios=%" PRIu32 "\n"
+    "save_path_policy=%" PRIu32 "\n"
+    "state_path_policy=%" PRIu32 "\n"
+    "sram_backup_count=%" PRIu32 "\n"
+    "enable_cheats=%" PRIu32 "\n"
+    "enable_slowld=%" PRIu32 "\n"
+    "enable_fastewram=%" PRIu32 "\n"
     "default_patcher=%u\n"
-    "default_igmenu=%lu\n"
-    "default_rtcpatch=%lu\n"
-    "default_rtcts=%lu\n"
-    "default_rtctick=%lu\n"
-    "default_loadgame=%lu\n"
-    "default_savegame=%lu\n"
-    "prefer_directsave=%lu\n",
+    "default_igmenu=%" PRIu32 "\n"
+    "default_rtcpatch=%" PRIu32 "\n"
+    "default_rtcts=%" PRIu32 "\n"
+    "default_rtctick=%" PRIu32 "\n"
+    "default_loadgame=%" PRIu32 "\n"
+    "default_savegame=%" PRIu32 "\n"
+    "prefer_directsave=%" PRIu32 "\n"
+    "patchgen_onload=%" PRIu32 "\n",
     hotkey_combo, boot_bios_splash, save_path_default, state_path_default,
     backup_sram_default, enable_cheats, use_slowld, use_fastew,
     (unsigned int)patcher_default, ingamemenu_default, rtcpatch_default,
     rtcvalue_default, rtcspeed_default, autoload_default, autosave_default,
-    autosave_prefer_ds);
+    autosave_prefer_ds, patchgen_onload);
 
   UINT wrbytes;
   FRESULT res = f_write(&fd, buf, strlen(buf), &wrbytes);
@@ -194,6 +197,7 @@ static void parse_settings(void *usr, const char *var, const char *value) {
       { "default_loadgame",  &autoload_default },
       { "default_savegame",  &autosave_default },
       { "prefer_directsave", &autosave_prefer_ds },
+      { "patchgen_onload",   &patchgen_onload },
     };
     for (unsigned i = 0; i < sizeof(bolset)/sizeof(bolset[0]); i++)
       if (!strcmp(var, bolset[i].s)) {
@@ -311,6 +315,20 @@ static void parse_rom_launch_settings(void *usr, const char *var, const char *va
     rs->rtcts = valu;
 }
 
+// Both settings live in the same file (and parsing consumes the buffer).
+typedef struct {
+  t_rom_load_settings *rld;
+  t_rom_launch_settings *rlh;
+} t_rom_settings;
+
+static void parse_rom_settings(void *usr, const char *var, const char *value) {
+  t_rom_settings *rs = (t_rom_settings*)usr;
+  if (rs->rld)
+    parse_rom_load_settings(rs->rld, var, value);
+  if (rs->rlh)
+    parse_rom_launch_settings(rs->rlh, var, value);
+}
+
 bool load_rom_settings(const char *fn, t_rom_load_settings *rld, t_rom_launch_settings *rlh) {
   char buf[512];
   strcpy(buf, ROMCONFIG_PATH);
@@ -325,10 +343,8 @@ bool load_rom_settings(const char *fn, t_rom_load_settings *rld, t_rom_launch_se
   UINT rdbytes;
   if (FR_OK == f_read(&fd, buf, sizeof(buf) - 1, &rdbytes)) {
     buf[rdbytes] = 0;
-    if (rld)
-      parse_file(buf, parse_rom_load_settings, rld);
-    if (rlh)
-      parse_file(buf, parse_rom_launch_settings, rlh);
+    t_rom_settings rs = { rld, rlh };
+    parse_file(buf, parse_rom_settings, &rs);
   }
   f_close(&fd);
 
@@ -78,6 +78,7 @@ extern uint32_t ingamemenu_default;
 extern uint32_t rtcpatch_default;
 extern uint32_t rtcvalue_default;
 extern uint32_t rtcspeed_default;
+extern uint32_t patchgen_onload;
 
 // Setting load/store
 bool save_ui_settings();
@@ -50,11 +50,11 @@ static inline bool use_fast_mirror() {
   #endif
 }
 
-typedef int (*t_rdsec_fn)(uint8_t *buffer, unsigned count, unsigned timeout);
+typedef int (*t_rdsec_fn)(uint8_t *buffer, unsigned count, unsigned timeout, uint8_t *crcbuf);
 typedef int (*t_wrsec_fn)(const uint8_t *buffer, unsigned count, unsigned timeout);
 
-int sc_read_sectors_w0(uint8_t *buffer, unsigned count, unsigned timeout);
-int sc_read_sectors_w1(uint8_t *buffer, unsigned count, unsigned timeout);
+int sc_read_sectors_w0(uint8_t *buffer, unsigned count, unsigned timeout, uint8_t *crcbuf);
+int sc_read_sectors_w1(uint8_t *buffer, unsigned count, unsigned timeout, uint8_t *crcbuf);
 int sc_write_sectors_w0(const uint8_t *buffer, unsigned count, unsigned timeout);
 int sc_write_sectors_w1(const uint8_t *buffer, unsigned count, unsigned timeout);
 
@@ -75,10 +75,15 @@ void send_sdcard_commandbuf(const uint8_t *buffer, unsigned maxsize);
 
 
 #define REG_SC_MODE_REG_ADDR     0x09FFFFFE
+#define REG_SC_SDDATA_ADDR       0x09100000   // Data lines (DAT0-3 in bits 8-11)
+#define SC_SD_DATA0              0x0100
 #define MODESWITCH_MAGIC         0xA55A
 
 #define MAX_WRITE_RETRIES        2            // Try up to 3 times to write a block.
+#define MAX_READ_RETRIES         1            // Try up to 2 times to read blocks.
 #define MAX_REINIT_RETRIES       9            // Try up to 10 to re-init the card.
+#define MAX_CRC_RETRIES          3            // Re-read a block up to 3 times on CRC errors.
+#define VERIFY_CHUNK_BLOCKS      8            // Blocks per read in verified mode.
 
 #define WAIT_IDLE_TIMEOUT    (0x800000 / SDDRV_TIMEOUT_MULT)   // Number of iterations to wait for card ready
 #define WAIT_RESP_TIMEOUT     (0x60000 / SDDRV_TIMEOUT_MULT)   // Aprox ~100ms as command timeout
@@ -86,6 +91,82 @@ void send_sdcard_commandbuf(const uint8_t *buffer, unsigned maxsize);
 #define WAIT_EREADY_TIMEOUT  (0x200000 / SDDRV_TIMEOUT_MULT)   // Around 500ms.
 #define WAIT_DATA_TIMEOUT    (0x400000 / SDDRV_TIMEOUT_MULT)   // Aprox ~1s as data timeout
 
+#ifdef SDDRV_ADAPTIVE_TIMEOUTS
+  // Data timeouts are derived from the latencies measured for the card, within
+  // some sane bounds. Timer 2+3 (cascaded, ~3.8us ticks) is used to measure.
+  // The constants above are ~4K iterations per millisecond.
+  #define ITERS_PER_MS         (4096 / SDDRV_TIMEOUT_MULT)
+  // Measurements can only raise the timeouts above the SD spec limits: 100ms
+  // for reads, 250ms (SDSC) and 500ms (SDHC) for write busy.
+  #define TMO_LAT_MULT            8     // Timeout is 8x the worst latency seen.
+  #define TMO_RD_MIN_MS         100
+  #define TMO_RD_MAX_MS        1000
+  #define TMO_WR_MIN_MS        (sc_issdhc() ? 500 : 250)
+  #define TMO_WR_MAX_MS        1000
+
+  static t_sd_stats drv_stats = {
+    .rd_tmo_ms = WAIT_DATA_TIMEOUT / ITERS_PER_MS,
+    .wr_tmo_ms = WAIT_EREADY_TIMEOUT / ITERS_PER_MS,
+  };
+
+  #define RD_DATA_TIMEOUT      (drv_stats.rd_tmo_ms * ITERS_PER_MS)
+  #define WR_DATA_TIMEOUT      (drv_stats.wr_tmo_ms * ITERS_PER_MS)
+  #define WR_BUSY_TIMEOUT      (drv_stats.wr_tmo_ms * ITERS_PER_MS)
+  #define STAT_INC(field)      drv_stats.field++
+
+  const t_sd_stats *sdcard_get_stats() {
+    return &drv_stats;
+  }
+
+  static void sdtimer_start() {
+    REG_TMxCNT(2) = 0;
+    REG_TMxCNT(3) = 0;
+    REG_TMxD(2) = 0;
+    REG_TMxD(3) = 0;
+    REG_TMxCNT(3) = 0x84;    // Cascade mode
+    REG_TMxCNT(2) = 0x81;    // F/64 (~3.8us)
+  }
+
+  static uint32_t sdtimer_us() {
+    uint32_t hi, lo;
+    do {
+      hi = REG_TMxD(3);
+      lo = REG_TMxD(2);
+    } while (hi != REG_TMxD(3));
+    return (((hi << 16) | lo) * 61) >> 4;
+  }
+
+  static uint32_t tune_timeout(uint32_t lat_us, uint32_t minms, uint32_t maxms) {
+    uint32_t ms = lat_us * TMO_LAT_MULT / 1000;
+    return ms < minms ? minms : ms > maxms ? maxms : ms;
+  }
+
+  // Records a successful busy wait, extends the write timeout if necessary.
+  static void note_busy_time(uint32_t us) {
+    if (us > drv_stats.wr_busy_us) {
+      drv_stats.wr_busy_us = us;
+      drv_stats.wr_tmo_ms = tune_timeout(us, TMO_WR_MIN_MS, TMO_WR_MAX_MS);
+    }
+  }
+
+  // After a failure, double the timeout (slow card or just a hiccup).
+  static void backoff_timeout(uint32_t *tmo, uint32_t maxms) {
+    *tmo = *tmo * 2 > maxms ? maxms : *tmo * 2;
+  }
+  #define backoff_rd_timeout() backoff_timeout(&drv_stats.rd_tmo_ms, TMO_RD_MAX_MS)
+  #define backoff_wr_timeout() backoff_timeout(&drv_stats.wr_tmo_ms, TMO_WR_MAX_MS)
+#else
+  #define RD_DATA_TIMEOUT      WAIT_DATA_TIMEOUT
+  #define WR_DATA_TIMEOUT      WAIT_DATA_TIMEOUT
+  #define WR_BUSY_TIMEOUT      WAIT_EREADY_TIMEOUT
+  #define STAT_INC(field)
+  #define sdtimer_start()
+  #define sdtimer_us()         0
+  #define note_busy_time(us)
+  #define backoff_rd_timeout()
+  #define backoff_wr_timeout()
+#endif
+
 #define OCR_CCS         0x40000000
 #define OCR_NBUSY       0x80000000
 #define OCR_V30         0x00040000   // Work at 3.0-3.1V
@@ -107,12 +188,14 @@ void send_sdcard_commandbuf(const uint8_t *buffer, unsigned maxsize);
 #define SD_CMD13       13   // Send status
 #define SD_CMD16       16   // Set block length
 #define SD_CMD18       18   // Read multiple blocks
+#define SD_CMD23       23   // Set block count (for the next CMD18/CMD25)
 #define SD_CMD24       24   // Write single block
 #define SD_CMD25       25   // Write multiple blocks
 #define SD_CMD55       55
 #define SD_ACMD6        6   // Bus width change
 #define SD_ACMD23      23   // Set write block erase count (pre-erase)
 #define SD_ACMD41      41   // Card ident
+#define SD_ACMD51      51   // Send SCR register
 
 typedef struct {
   uint8_t cmdresp;
@@ -128,12 +211,15 @@ typedef struct {
 #ifdef NO_SUPERCARD_INIT
   bool sc_issdhc();
   uint16_t sc_rca();
+  bool sc_cmd23();
 #else
   static bool drv_issdhc = false;
   static uint16_t drv_rca = 0;
+  static bool drv_cmd23 = false;
 
   bool sc_issdhc() { return drv_issdhc; }
   uint16_t sc_rca() { return drv_rca; }
+  bool sc_cmd23() { return drv_cmd23; }
 #endif
 
 void write_supercard_mode(uint16_t modebits) {
@@ -266,6 +352,46 @@ static bool send_sdcard_reset() {
   return true;
 }
 
+// Reads a short data block (ie. SCR register) after the command was issued.
+// Uses one bus access per clock (slow), only meant for a few bytes.
+static bool read_short_block(uint8_t *buffer, unsigned size, unsigned timeout) {
+  volatile uint16_t *dreg = (volatile uint16_t*)REG_SC_SDDATA_ADDR;
+
+  // Wait for the start bit (data lines pulled low).
+  while (*dreg & SC_SD_DATA0) {
+    if (!--timeout)
+      return false;
+  }
+
+  for (unsigned i = 0; i < size; i++) {
+    uint8_t hi = (*dreg >> 8) & 0xF;
+    uint8_t lo = (*dreg >> 8) & 0xF;
+    buffer[i] = (hi << 4) | lo;
+  }
+
+  // Clock out the CRC16 (16 clocks in 4 bit mode) and the end bit.
+  for (unsigned i = 0; i < 17; i++)
+    (void)*dreg;
+
+  return true;
+}
+
+// Reads the SCR register to check whether the card supports CMD23, that
+// allows us to perform multi-block transfers without a stop command.
+static bool detect_cmd23_support() {
+  uint8_t scr[8];
+  if (!send_sdcard_command(SD_CMD55, drv_rca << 16, NULL, SD_MAX_RESP))
+    return false;
+  if (!send_sdcard_command_noclock(SD_ACMD51, 0, NULL, SD_R1_RESP))
+    return false;
+
+  bool ok = read_short_block(scr, sizeof(scr), WAIT_DATA_TIMEOUT);
+  send_empty_clocks(32);
+
+  // CMD_SUPPORT (bits 33-32) is only valid for SD 3.0+ cards (SD_SPEC >= 2).
+  return ok && (scr[0] & 0xF) >= 2 && (scr[3] & 0x02);
+}
+
 // Re-init the SD card. This just initializes the driver variables/state and
 // the card is assume to be init/ready.
 unsigned sdcard_reinit() {
@@ -311,6 +437,8 @@ unsigned sdcard_reinit() {
   if (!send_sdcard_command(SD_CMD7, drv_rca << 16, NULL, SD_MAX_RESP))
     return SD_ERR_BAD_MODEXCH;
 
+  drv_cmd23 = detect_cmd23_support();
+
   return 0;
 }
 
@@ -419,58 +547,179 @@ unsigned sdcard_init(t_card_info *info) {
   if (!send_sdcard_command(SD_CMD16, 512, NULL, SD_MAX_RESP))
     return SD_ERR_BAD_BUSSEL;
 
+  // Not fatal, we can use open-ended transfers otherwise.
+  drv_cmd23 = detect_cmd23_support();
+
+  #ifdef SDDRV_ADAPTIVE_TIMEOUTS
+  // Measure the card read latency (a few reads of block 0) to tune the read timeout.
+  uint32_t lat = 0;
+  for (unsigned i = 0; i < 4; i++) {
+    uint32_t tmp[512/4];
+    sdtimer_start();
+    if (sdcard_read_blocks((uint8_t*)tmp, 0, 1))
+      return SD_ERR_BADREAD;
+    uint32_t us = sdtimer_us();
+    lat = us > lat ? us : lat;
+  }
+  drv_stats.rd_lat_us = lat;
+  drv_stats.rd_tmo_ms = tune_timeout(lat, TMO_RD_MIN_MS, TMO_RD_MAX_MS);
+  #endif
+
   return 0;
 }
 
 #endif
 
-unsigned sdcard_read_blocks(uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
-  uint8_t resp[4];
-  if (!send_sdcard_command_noclock(SD_CMD18, sc_issdhc() ? blocknum : blocknum * 512, resp, sizeof(resp)))
-    return SD_ERR_BADREAD;
+// Reads blocks, optionally returns the received CRC bytes (8 per block).
+static unsigned read_blocks(uint8_t *buffer, uint32_t blocknum, unsigned blkcnt, uint8_t *crcbuf) {
+  STAT_INC(rd_ops);
+  for (unsigned j = 0; j < 1+MAX_READ_RETRIES; j++) {
+    uint8_t resp[4];
+    if (j) {
+      // Give the card some time to recover before retrying.
+      STAT_INC(rd_retries);
+      backoff_rd_timeout();
+      wait_dat0_idle(WAIT_EREADY_TIMEOUT);
+    }
 
-  // Read all data using the asm routine for speed.
-  if (sc_read_sectors[SC_FAST_ROM_MIRROR ? 1 : 0](buffer, blkcnt, WAIT_DATA_TIMEOUT))
-    return SD_ERR_BADREAD;
+    // Pre-define the block count if possible, the transfer ends by itself.
+    bool predef = sc_cmd23() && send_sdcard_command(SD_CMD23, blkcnt, NULL, SD_MAX_RESP);
 
-  if (!send_sdcard_command(SD_CMD12, 0, NULL, SD_MAX_RESP))
-    return SD_ERR_BADREAD;
+    if (!send_sdcard_command_noclock(SD_CMD18, sc_issdhc() ? blocknum : blocknum * 512, resp, sizeof(resp)))
+      continue;
+
+    // Read all data using the asm routine for speed.
+    bool rd_ok = !sc_read_sectors[SC_FAST_ROM_MIRROR ? 1 : 0](buffer, blkcnt, RD_DATA_TIMEOUT, crcbuf);
+
+    if (predef && rd_ok) {
+      send_empty_clocks(32);
+      return 0;
+    }
+
+    // Stop the transfer, also after a failed read (to be able to retry).
+    if (send_sdcard_command(SD_CMD12, 0, NULL, SD_MAX_RESP) && rd_ok)
+      return 0;
+  }
+
+  STAT_INC(rd_errors);
+  return SD_ERR_BADREAD;
+}
+
+#ifdef SDDRV_VERIFIED_READS
+static bool drv_verify = false;
+
+void sdcard_set_verified_reads(bool enable) {
+  drv_verify = enable;
+}
+
+// Reads in small chunks and checks the CRC16 of every block. Reading resumes
+// from the first bad block, which is re-read a few times before giving up.
+static unsigned read_blocks_verified(uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
+  unsigned retries = 0;
+  while (blkcnt) {
+    uint32_t crcs[VERIFY_CHUNK_BLOCKS * 2];
+    unsigned cnt = blkcnt < VERIFY_CHUNK_BLOCKS ? blkcnt : VERIFY_CHUNK_BLOCKS;
+    unsigned ret = read_blocks(buffer, blocknum, cnt, (uint8_t*)crcs);
+    if (ret)
+      return ret;
+
+    unsigned good = 0;
+    for (; good < cnt; good++) {
+      uint32_t crc[2];
+      crc16_nibble_512_fast(&buffer[good * 512], (uint8_t*)crc);
+      if (crc[0] != crcs[good * 2] || crc[1] != crcs[good * 2 + 1])
+        break;
+    }
+
+    // Retries are counted for the first bad block only.
+    if (good == cnt)
+      retries = 0;
+    else {
+      STAT_INC(rd_retries);
+      retries = good ? 1 : retries + 1;
+      if (retries > MAX_CRC_RETRIES) {
+        STAT_INC(rd_errors);
+        return SD_ERR_BADCRC;
+      }
+    }
+
+    buffer += good * 512;
+    blocknum += good;
+    blkcnt -= good;
+  }
   return 0;
 }
+#endif
+
+unsigned sdcard_read_blocks(uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
+  #ifdef SDDRV_VERIFIED_READS
+  if (drv_verify)
+    return read_blocks_verified(buffer, blocknum, blkcnt);
+  #endif
+  return read_blocks(buffer, blocknum, blkcnt, NULL);
+}
+
+#ifdef SD_PREERASE_BLOCKS_WRITE
+static bool drv_preerase = true;
+
+void sdcard_set_preerase(bool enable) {
+  drv_preerase = enable;
+}
+#endif
 
 unsigned sdcard_write_blocks(const uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
+  STAT_INC(wr_ops);
+
   // Send a write intent / clear command, for faster writes. Do not take errors
   // too seriously, this is "optional" really.
   #ifdef SD_PREERASE_BLOCKS_WRITE
-  if (send_sdcard_command(SD_CMD55, sc_rca() << 16, NULL, SD_MAX_RESP))
+  if (drv_preerase && send_sdcard_command(SD_CMD55, sc_rca() << 16, NULL, SD_MAX_RESP))
     send_sdcard_command(SD_ACMD23, blkcnt, NULL, SD_MAX_RESP);
   #endif
 
   // Perform a block write. The ASM function handles it all (CRC and all).
   for (unsigned j = 0; j < 1+MAX_WRITE_RETRIES; j++) {
-    if (!send_sdcard_command_noclock(SD_CMD25, sc_issdhc() ? blocknum : blocknum * 512, NULL, SD_R1_RESP))
-      return SD_ERR_BADWRITE;
+    if (j)
+      STAT_INC(wr_retries);
 
-    bool wr_ok = !sc_write_sectors[SC_FAST_ROM_MIRROR ? 1 : 0](buffer, blkcnt, WAIT_DATA_TIMEOUT);
+    bool predef = sc_cmd23() && send_sdcard_command(SD_CMD23, blkcnt, NULL, SD_MAX_RESP);
 
-    // Send CMD12 to signal the end of the write sequence!
-    if (!send_sdcard_command(SD_CMD12, 0, NULL, SD_MAX_RESP))
-      return SD_ERR_BADWRITE;
+    if (!send_sdcard_command_noclock(SD_CMD25, sc_issdhc() ? blocknum : blocknum * 512, NULL, SD_R1_RESP))
+      break;
 
-    // CMD12 pulls DAT0 low while busy (usually writing). Wait for !busy.
-    wait_dat0_idle(WAIT_EREADY_TIMEOUT);
+    bool wr_ok = !sc_write_sectors[SC_FAST_ROM_MIRROR ? 1 : 0](buffer, blkcnt, WR_DATA_TIMEOUT);
+
+    // Send CMD12 to signal the end of the write sequence (or to abort it).
+    if (!predef || !wr_ok) {
+      if (!send_sdcard_command(SD_CMD12, 0, NULL, SD_MAX_RESP))
+        break;
+    }
+    else
+      send_empty_clocks(32);
+
+    // DAT0 is held low while busy (usually writing). Wait for !busy.
+    sdtimer_start();
+    if (wait_dat0_idle(WR_BUSY_TIMEOUT))
+      note_busy_time(sdtimer_us());
+    else {
+      // Timed out, wait some more (up to the worst case) before going on.
+      backoff_wr_timeout();
+      wait_dat0_idle(WAIT_EREADY_TIMEOUT);
+    }
 
     if (wr_ok) {
       // Check the status/error code reported by CMD13, should be zero.
       uint16_t cardst = 0xFFFF;
       if (!send_get_status(&cardst))
-        return SD_ERR_BADWRITE;
+        break;
 
       if (cardst == 0)
         return 0;     // Write seq successful!
     }
+    else
+      backoff_wr_timeout();
   }
 
+  STAT_INC(wr_errors);
   return SD_ERR_BADWRITE;
 }
-
@@ -48,10 +48,32 @@ void sdcard_side_init(bool _issdhc, uint16_t _rca);
 
 bool sc_issdhc();
 uint16_t sc_rca();
+bool sc_cmd23();           // Card supports CMD23 (pre-defined block count)
 
 unsigned sdcard_read_blocks(uint8_t *buffer, uint32_t blocknum, unsigned blkcnt);
 unsigned sdcard_write_blocks(const uint8_t *buffer, uint32_t blocknum, unsigned blkcnt);
 
+// Verified reads: checks the CRC of every block, re-reading bad blocks.
+// Slower, meant for critical reads (ie. flashing). Only available in builds
+// with SDDRV_VERIFIED_READS.
+void sdcard_set_verified_reads(bool enable);
+
+// Enables/disables the ACMD23 pre-erase before writes (enabled by default).
+// Only available in builds with SD_PREERASE_BLOCKS_WRITE.
+void sdcard_set_preerase(bool enable);
+
+// Driver statistics (only available in builds with adaptive timeouts)
+typedef struct {
+  uint32_t rd_ops, wr_ops;          // Read/write operations issued
+  uint32_t rd_errors, wr_errors;    // Operations that failed (after retrying)
+  uint32_t rd_retries, wr_retries;  // Retried attempts
+  uint32_t rd_lat_us;               // Worst read latency (single block, measured at init)
+  uint32_t wr_busy_us;              // Worst write busy time seen
+  uint32_t rd_tmo_ms, wr_tmo_ms;    // Current timeouts
+} t_sd_stats;
+
+const t_sd_stats *sdcard_get_stats();
+
 #define SD_ERR_NO_STARTUP       1
 #define SD_ERR_BAD_IDENT        2
 #define SD_ERR_BAD_INIT         3
@@ -63,6 +85,7 @@ unsigned sdcard_write_blocks(const uint8_t *buffer, uint32_t blocknum, unsigned
 #define SD_ERR_BADWRITE         9
 #define SD_ERR_READTIMEOUT     10
 #define SD_ERR_WRITETIMEOUT    11
+#define SD_ERR_BADCRC          12
 
 #endif
 
@@ -90,7 +90,7 @@ unsigned unicodeorder(unsigned cp) {
 
   switch (cp >> 8) {
   case 0:          // ASCII/latin
-    if (cp > 'A' && cp <= 'Z')
+    if (cp >= 'A' && cp <= 'Z')
       return cp + 'a' - 'A';
     else if (cp >= 0xC0)
       return transl_ls[cp & 0x1F];  // Latin supplement accents/diacritics are transliterated
@@ -110,7 +110,10 @@ unsigned unicodeorder(unsigned cp) {
 // Given an utf-8 encoded string, produces an utf-16-like encoded string that
 // can be used for sorting (ie. lexicographic sorting).
 // Our utf-6-like encoding is just utf-8 but using 16 bit (prefix encoding)
-void sortable_utf8_u16(const char *s8, uint16_t *s16) {
+// The output is NULL terminated, returns its length (in u16 units).
+// Each input byte produces at most one output u16.
+unsigned sortable_utf8_u16(const char *s8, uint16_t *s16) {
+  uint16_t *start = s16;
   while (*s8) {
     uint32_t code = utf8_decode(s8);
     code = unicodeorder(code);
@@ -124,5 +127,7 @@ void sortable_utf8_u16(const char *s8, uint16_t *s16) {
 
     s8 += utf8_chlen(s8);
   }
+  *s16 = 0;
+  return s16 - start;
 }
 
@@ -28,5 +28,5 @@ unsigned utf8_strlen(const char *s);
 uint32_t utf8_decode(const char *s);
 
 // Convert string to searchable structures
-void sortable_utf8_u16(const char *s8, uint16_t *s16);
+unsigned sortable_utf8_u16(const char *s8, uint16_t *s16);
 
@@ -23,6 +23,7 @@
 #include "patchengine.h"
 
 #define BLK_SIZE     4*1024*1024
+#define OPLOG_SIZE   (1024*1024)
 
 static void dummy(unsigned) {}
 
@@ -41,8 +42,9 @@ int main(int argc, char **argv) {
   stat(argv[1], &st);
 
   t_patch_builder pb;
-  patchengine_init(&pb, st.st_size);
-  char *tmp = malloc(BLK_SIZE + 64);   // FIXME: the scanner overruns the buffer sometimes.
+  uint32_t *oplog = malloc(OPLOG_SIZE * sizeof(uint32_t));
+  patchengine_init(&pb, st.st_size, oplog, OPLOG_SIZE);
+  char *tmp = malloc(BLK_SIZE);
 
   while (true) {
     int r = fread(tmp, 1, BLK_SIZE, fd);
@@ -54,6 +56,7 @@ int main(int argc, char **argv) {
 
   free(tmp);
   patchengine_finalize(&pb);
+  free(oplog);
   fclose(fd);
 
   // Print patches for manual inspection:
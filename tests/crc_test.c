@@ -20,10 +20,56 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #include "crc.h"
 
-int main() {
+#define BENCH_BLOCKS    (64*1024)
+
+// Compares the nibble CRC16 variants on random blocks (run with "bench").
+static void run_bench() {
+  static uint32_t blocks[16][512/4];
+  for (unsigned i = 0; i < sizeof(blocks) / 4; i++)
+    blocks[i / 128][i % 128] = rand();
+
+  const struct {
+    const char *name;
+    void (*fn)(const uint8_t *buf, uint8_t *crcout);
+  } variants[] = {
+    { "crc16_nibble_512",           crc16_nibble_512 },
+    { "crc16_nibble_512_8bit",      crc16_nibble_512_8bit },
+    { "crc16_nibble_512_nolutw",    crc16_nibble_512_nolutw },
+    { "crc16_nibble_512_nolut",     crc16_nibble_512_nolut },
+    { "crc16_nibble_512_nolut8bit", crc16_nibble_512_nolut8bit },
+    { "crc16_nibble_512_fast",      crc16_nibble_512_fast },
+  };
+
+  for (unsigned v = 0; v < sizeof(variants)/sizeof(variants[0]); v++) {
+    uint8_t co[8];
+    unsigned acc = 0;
+    clock_t start = clock();
+    for (unsigned i = 0; i < BENCH_BLOCKS; i++) {
+      variants[v].fn((uint8_t*)blocks[i & 15], co);
+      acc += co[i & 7];
+    }
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("%-28s %8.1f MiB/s (%08x)\n", variants[v].name,
+           BENCH_BLOCKS / 2048.0 / secs, acc);
+  }
+}
+
+int main(int argc, char **argv) {
+  // Regression check: all variants agree on random data.
+  for (unsigned i = 0; i < 256; i++) {
+    uint32_t blk[512/4];
+    uint8_t co[8], co2[8];
+    for (unsigned j = 0; j < 512/4; j++)
+      blk[j] = rand();
+    crc16_nibble_512_nolut((uint8_t*)blk, co);
+    crc16_nibble_512_fast((uint8_t*)blk, co2);
+    assert(!memcmp(co, co2, sizeof(co)));
+  }
+
   const struct {
     const char *data;
     const uint8_t len;
@@ -53,7 +99,7 @@ int main() {
   };
 
   for (unsigned i = 0; i < sizeof(testvec)/sizeof(testvec[0]); i++) {
-    uint8_t co[8], co2[8], co3[8], co4[8];
+    uint8_t co[8], co2[8], co3[8], co4[8], co5[8];
     uint8_t idata[512];
     for (unsigned j = 0; j < sizeof(idata); j++)
       idata[j] = testvec[i].pad_value;
@@ -63,15 +109,17 @@ int main() {
     crc16_nibble_512_8bit(idata, co2);
     crc16_nibble_512_nolut(idata, co3);
     crc16_nibble_512_nolut8bit(idata, co4);
+    crc16_nibble_512_fast(idata, co5);
     assert(!memcmp(co,  testvec[i].crcout, sizeof(testvec[i].crcout)));
     assert(!memcmp(co2, testvec[i].crcout, sizeof(testvec[i].crcout)));
     assert(!memcmp(co3, testvec[i].crcout, sizeof(testvec[i].crcout)));
     assert(!memcmp(co4, testvec[i].crcout, sizeof(testvec[i].crcout)));
+    assert(!memcmp(co5, testvec[i].crcout, sizeof(testvec[i].crcout)));
   }
 
   // Unaligned buffer
   for (unsigned i = 0; i < sizeof(testvec)/sizeof(testvec[0]); i++) {
-    uint8_t co[8], co2[8], co3[8], co4[8];
+    uint8_t co[8], co2[8], co3[8], co4[8], co5[8];
     uint8_t idata[513];
     for (unsigned j = 0; j < sizeof(idata); j++)
       idata[j] = testvec[i].pad_value;
@@ -81,10 +129,12 @@ int main() {
     crc16_nibble_512_8bit(&idata[1], co2);
     crc16_nibble_512_nolut(&idata[1], co3);
     crc16_nibble_512_nolut8bit(&idata[1], co4);
+    crc16_nibble_512_fast(&idata[1], co5);
     assert(!memcmp(co,  testvec[i].crcout, sizeof(testvec[i].crcout)));
     assert(!memcmp(co2, testvec[i].crcout, sizeof(testvec[i].crcout)));
     assert(!memcmp(co3, testvec[i].crcout, sizeof(testvec[i].crcout)));
     assert(!memcmp(co4, testvec[i].crcout, sizeof(testvec[i].crcout)));
+    assert(!memcmp(co5, testvec[i].crcout, sizeof(testvec[i].crcout)));
   }
 
   const struct {
@@ -164,6 +214,10 @@ int main() {
     0x21,0xd4,0xf8,0x07,0x56,0xcf,
   };
   assert(ds_crc16(tsthdr, sizeof(tsthdr)) == 0x544a);
+
+  if (argc > 1 && !strcmp(argv[1], "bench"))
+    run_bench();
+  return 0;
 }
 
 
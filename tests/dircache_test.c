@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+// Tests the directory listing cache on top of host disk images.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common.h"
+#include "util.h"
+#include "dirlist.h"
+#include "dircache.h"
+#include "fatfs/ff.h"
+#include "hostdisk.h"
+
+#define SCRATCH_SIZE    (256*1024)
+
+static t_dirlist dl, ref;
+static uint32_t scratch[SCRATCH_SIZE / sizeof(uint32_t)];
+static uint32_t sortbuf[DIRLIST_SORTBUF_SIZE / sizeof(uint32_t)];
+
+static void create_files(const char *path, unsigned count) {
+  char fn[MAX_FN_LEN];
+  for (unsigned i = 0; i < count; i++) {
+    sprintf(fn, "%sSome long ROM name, number %u (Europe) (En,Fr,De).gba", path, i);
+    hostdisk_write_file(fn, fn, strlen(fn));
+  }
+}
+
+// Lists a directory like the file browser does, returns true on cache hits.
+static bool load_listing(const char *path, t_dirlist *l) {
+  DIR d;
+  t_dirsig sig;
+  assert(FR_OK == f_opendir(&d, path));
+  bool sigok = dircache_signature(&d, (uint8_t*)scratch, sizeof(scratch), &sig);
+  assert(sigok);
+
+  bool hit = dircache_load(path, &sig, l);
+  if (!hit) {
+    FILINFO info;
+    dirlist_reset(l);
+    while (FR_OK == f_readdir(&d, &info) && info.fname[0])
+      assert(dirlist_add(l, info.fname, info.fsize, info.fattrib));
+    dirlist_sort(l, sortbuf);
+    assert(dircache_save(path, &sig, l));
+  }
+  f_closedir(&d);
+  dirlist_filter(l, false);
+  return hit;
+}
+
+static unsigned count_entries(const char *path) {
+  DIR d;
+  FILINFO info;
+  unsigned cnt = 0;
+  assert(FR_OK == f_opendir(&d, path));
+  while (FR_OK == f_readdir(&d, &info) && info.fname[0])
+    cnt++;
+  f_closedir(&d);
+  return cnt;
+}
+
+static void test_dir(const char *path, unsigned count) {
+  char fn[MAX_FN_LEN];
+  create_basepath(path);
+  const unsigned base = count_entries(path);
+  create_files(path, count);
+
+  hostdisk_reset_stats();
+  assert(!dircache_probe(path));
+  assert(!load_listing(path, &ref));
+  assert(dircache_probe(path));
+  assert(ref.count == base + count);
+  hostdisk_print_stats("  uncached listing");
+
+  hostdisk_reset_stats();
+  assert(load_listing(path, &dl));
+  hostdisk_check_same(&dl, &ref);
+  hostdisk_print_stats("  cached listing");
+
+  // Any change invalidates the cache: new files, deletions and attributes,
+  // even if they happen at the end of the directory.
+  sprintf(fn, "%snew file.gba", path);
+  hostdisk_write_file(fn, fn, strlen(fn));
+  assert(!load_listing(path, &dl));
+  assert(dl.count == base + count + 1);
+  assert(load_listing(path, &dl));
+
+  sprintf(fn, "%sSome long ROM name, number %u (Europe) (En,Fr,De).gba", path, count - 1);
+  assert(FR_OK == f_chmod(fn, AM_HID, AM_HID));
+  assert(!load_listing(path, &dl));
+  assert(load_listing(path, &dl));
+  dirlist_filter(&dl, true);
+  assert(dl.visible == base + count);
+
+  // Back to the original contents (but with entries in different slots)
+  assert(FR_OK == f_unlink(fn));
+  hostdisk_write_file(fn, fn, strlen(fn));
+  sprintf(fn, "%snew file.gba", path);
+  assert(FR_OK == f_unlink(fn));
+  assert(!load_listing(path, &dl));
+  assert(load_listing(path, &dl));
+  hostdisk_check_same(&dl, &ref);
+}
+
+static void test_badcache() {
+  // Collisions and corrupted files are detected.
+  DIR d;
+  t_dirsig sig;
+  assert(FR_OK == f_opendir(&d, "/roms/"));
+  assert(dircache_signature(&d, (uint8_t*)scratch, sizeof(scratch), &sig));
+  f_closedir(&d);
+  assert(dircache_load("/roms/", &sig, &dl));
+  assert(!dircache_load("/roms", &sig, &dl));
+  sig.hash ^= 1;
+  assert(!dircache_load("/roms/", &sig, &dl));
+  sig.hash ^= 1;
+
+  // Point an entry name outside of the arena (in all cache files).
+  char fn[MAX_FN_LEN + 32];
+  FIL fd;
+  FILINFO info;
+  UINT bw;
+  const t_dirent bad = { .name = DIRLIST_ARENA_SIZE };
+  assert(FR_OK == f_opendir(&d, "/.superfw/dircache"));
+  while (FR_OK == f_readdir(&d, &info) && info.fname[0]) {
+    sprintf(fn, "/.superfw/dircache/%s", info.fname);
+    assert(FR_OK == f_open(&fd, fn, FA_WRITE | FA_READ));
+    assert(FR_OK == f_lseek(&fd, 512 + 7 * sizeof(t_dirent)));
+    assert(FR_OK == f_write(&fd, &bad, sizeof(bad), &bw));
+    f_close(&fd);
+  }
+  f_closedir(&d);
+  assert(!dircache_load("/roms/", &sig, &dl));
+}
+
+static void run_cases() {
+  create_basepath("/.superfw/dircache/");
+  test_dir("/", 80);             // Fixed size root dir on FAT16
+  test_dir("/roms/", 1500);
+  test_badcache();
+}
+
+int main() {
+  const t_hostdisk_latency lat = HOSTDISK_LATENCY_SC;
+  hostdisk_set_latency(&lat);
+
+  hostdisk_run_images(run_cases);
+
+  printf("All tests passed!\n");
+  return 0;
+}
+
@@ -0,0 +1,408 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <time.h>
+
+#include "dirlist.h"
+#include "util.h"
+#include "utf_util.h"
+#include "fatfs/ff.h"
+
+#define BENCH_ENTRIES   (16*1024)
+
+static t_dirlist dl;
+static uint32_t sortbuf[DIRLIST_SORTBUF_SIZE / sizeof(uint32_t)];
+
+static int strcmp16(const uint16_t *a, const uint16_t *b) {
+  while (*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a - *b;
+}
+
+// Reference sort (as the browser used to do): index heapsort, full keys.
+static uint32_t reforder[DIRLIST_MAX_ENTRIES];
+static int refcmp(const void *a, const void *b) {
+  const t_dirent *ea = &dl.entries[*(uint32_t*)a];
+  const t_dirent *eb = &dl.entries[*(uint32_t*)b];
+  if ((ea->attr & AM_DIR) != (eb->attr & AM_DIR))
+    return (eb->attr & AM_DIR) ? 1 : -1;
+  return strcmp16(dirlist_key(&dl, ea), dirlist_key(&dl, eb));
+}
+
+static void ref_sort() {
+  for (unsigned i = 0; i < dl.count; i++)
+    reforder[i] = i;
+  heapsort4(reforder, dl.count, 1, refcmp);
+}
+
+// Sorts the list, checks the result against the reference sort.
+static void check_sort() {
+  static t_dirent orig[DIRLIST_MAX_ENTRIES];
+  memcpy(orig, dl.entries, dl.count * sizeof(t_dirent));
+  ref_sort();
+  dirlist_sort(&dl, sortbuf);
+  for (unsigned i = 0; i < dl.count; i++) {
+    const t_dirent *a = &dl.entries[i], *b = &orig[reforder[i]];
+    assert((a->attr & AM_DIR) == (b->attr & AM_DIR));
+    assert(!strcmp16(dirlist_key(&dl, a), dirlist_key(&dl, b)));
+  }
+}
+
+static void random_name(char *fn) {
+  // Few symbols, so that long shared prefixes and duplicates are common.
+  static const char *syms[] = {"a", "B", "z", " ", "-", "0", "9", "é", "Ü", "ß",
+                               "ĉ", "Ω", "中", "日", "😀", "(", "."};
+  unsigned len = 1 + rand() % 14;
+  fn[0] = 0;
+  for (unsigned i = 0; i < len; i++)
+    strcat(fn, syms[rand() % (sizeof(syms) / sizeof(syms[0]))]);
+}
+
+static void test_basic() {
+  dirlist_reset(&dl);
+  assert(dirlist_add(&dl, "zelda.gba", 100, AM_ARC));
+  assert(dirlist_add(&dl, "Metroid.gba", 200, AM_ARC));
+  assert(dirlist_add(&dl, "saves", 0, AM_DIR));
+  assert(dirlist_add(&dl, "Ábaco.gba", 300, AM_ARC));
+  assert(dirlist_add(&dl, "hidden.gba", 400, AM_ARC | AM_HID));
+  assert(dirlist_add(&dl, "Apps", 0, AM_DIR));
+  assert(dl.count == 6);
+
+  dirlist_sort(&dl, sortbuf);
+  dirlist_filter(&dl, false);
+  assert(dl.visible == 6);
+  const char *exp[] = {"Apps", "saves", "Ábaco.gba", "hidden.gba", "Metroid.gba", "zelda.gba"};
+  for (unsigned i = 0; i < 6; i++)
+    assert(!strcmp(dirlist_name(&dl, dirlist_get(&dl, i)), exp[i]));
+  assert(dirlist_get(&dl, 4)->filesize == 200);
+  assert(dirlist_get(&dl, 0)->attr & AM_DIR);
+
+  // Sort keys are stored u16 aligned, right after the name.
+  for (unsigned i = 0; i < dl.count; i++) {
+    const t_dirent *e = &dl.entries[i];
+    assert(!((uintptr_t)dirlist_key(&dl, e) & 1));
+    assert(e->keyoff > strlen(dirlist_name(&dl, e)));
+  }
+
+  // Entries are sorted in place, filtering keeps the order.
+  for (unsigned i = 0; i < 6; i++)
+    assert(!strcmp(dirlist_name(&dl, &dl.entries[i]), exp[i]));
+  dirlist_filter(&dl, true);
+  assert(dl.visible == 5);
+  for (unsigned i = 0; i < dl.visible; i++)
+    assert(strcmp(dirlist_name(&dl, dirlist_get(&dl, i)), "hidden.gba"));
+}
+
+static void test_large() {
+  // Way beyond the old 16K entries limit, memory usage depends on name length.
+  char fn[64];
+  dirlist_reset(&dl);
+  for (unsigned i = 0; i < DIRLIST_MAX_ENTRIES; i++) {
+    sprintf(fn, "Game %08x.gba", (unsigned)rand());
+    assert(dirlist_add(&dl, fn, i, (i % 97) ? AM_ARC : AM_DIR));
+  }
+  assert(!dirlist_add(&dl, "one too many", 0, 0));
+  assert(dl.arena_used < 64 * DIRLIST_MAX_ENTRIES);
+
+  dirlist_sort(&dl, sortbuf);
+  dirlist_filter(&dl, false);
+  assert(dl.visible == DIRLIST_MAX_ENTRIES);
+  for (unsigned i = 1; i < dl.visible; i++) {
+    const t_dirent *a = dirlist_get(&dl, i - 1), *b = dirlist_get(&dl, i);
+    if ((a->attr & AM_DIR) == (b->attr & AM_DIR))
+      assert(strcasecmp(dirlist_name(&dl, a), dirlist_name(&dl, b)) <= 0);
+    else
+      assert(a->attr & AM_DIR);
+    assert(a->filesize != b->filesize);
+  }
+}
+
+static void test_arena_full() {
+  char fn[256];
+  memset(fn, 'a', 255);
+  fn[255] = 0;
+
+  dirlist_reset(&dl);
+  unsigned cnt = 0;
+  while (dirlist_add(&dl, fn, 0, 0))
+    cnt++;
+  assert(cnt < DIRLIST_MAX_ENTRIES);
+  assert(dl.arena_used <= DIRLIST_ARENA_SIZE);
+  assert(!strcmp(dirlist_name(&dl, &dl.entries[cnt - 1]), fn));
+}
+
+static void test_prefix_sort() {
+  // Names sharing (or exceeding) the packed prefix, wide chars and duplicates.
+  const char *names[] = {
+    "Pokemon - Ruby Version.gba", "Pokemon - Sapphire Version.gba", "Pokemon",
+    "Pokemon ", "Pokemo", "pokemon - ruby version.gba", "Pokémon - Emerald.gba",
+    "Pokemon - Ruby Version.gba.sav", "中文游戏", "中文", "日本語", "😀 emoji",
+    "😀", "ÿ", "ĉ", "ĉa", "ĉb", "zzzzzzzzzzzzzz", "zzzzzzz", "zzzzzzzz", "a", "b",
+  };
+  for (unsigned r = 0; r < 2; r++) {
+    dirlist_reset(&dl);
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+      assert(dirlist_add(&dl, names[i], i, (i % 5 == r) ? AM_DIR : AM_ARC));
+    check_sort();
+  }
+
+  // Random names and sizes, sorted and reverse sorted inputs too.
+  char fn[64];
+  const unsigned sizes[] = {0, 1, 2, 3, 7, 100, 1000, 20000};
+  for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    dirlist_reset(&dl);
+    for (unsigned i = 0; i < sizes[s]; i++) {
+      random_name(fn);
+      assert(dirlist_add(&dl, fn, i, (rand() % 10) ? AM_ARC : AM_DIR));
+    }
+    check_sort();
+    check_sort();
+    for (unsigned i = 0; i < dl.count / 2; i++) {
+      t_dirent t = dl.entries[i];
+      dl.entries[i] = dl.entries[dl.count - 1 - i];
+      dl.entries[dl.count - 1 - i] = t;
+    }
+    check_sort();
+  }
+}
+
+static void test_merge() {
+  // Progressive loading: entries are merged in batches, the view must always
+  // be sorted and the final in place sort must match the reference one.
+  char fn[64];
+  dirlist_reset(&dl);
+  while (dl.count < 30000) {
+    unsigned batch = rand() % 3 ? rand() % 40 : rand() % 4000;
+    for (unsigned i = 0; i < batch; i++) {
+      random_name(fn);
+      unsigned attr = (rand() % 10) ? AM_ARC : AM_DIR;
+      assert(dirlist_add(&dl, fn, dl.count, (rand() % 7) ? attr : attr | AM_HID));
+    }
+    dirlist_merge(&dl, sortbuf);
+    assert(dl.merged == dl.count);
+
+    ref_sort();
+    dirlist_view(&dl, sortbuf, false);
+    assert(dl.visible == dl.count);
+    for (unsigned i = 0; i < dl.count; i++) {
+      const t_dirent *a = dirlist_get(&dl, i), *b = &dl.entries[reforder[i]];
+      assert((a->attr & AM_DIR) == (b->attr & AM_DIR));
+      assert(!strcmp16(dirlist_key(&dl, a), dirlist_key(&dl, b)));
+    }
+
+    // Hidden entries are skipped, equal keys keep their insertion order.
+    dirlist_view(&dl, sortbuf, true);
+    for (unsigned i = 0; i < dl.visible; i++) {
+      const t_dirent *a = dirlist_get(&dl, i);
+      assert(!(a->attr & AM_HID));
+      if (i) {
+        const t_dirent *p = dirlist_get(&dl, i - 1);
+        if (!strcmp16(dirlist_key(&dl, p), dirlist_key(&dl, a)))
+          assert(p->filesize < a->filesize);
+      }
+    }
+  }
+
+  // Some pending entries are left, dirlist_sort merges them too.
+  for (unsigned i = 0; i < 100; i++) {
+    random_name(fn);
+    assert(dirlist_add(&dl, fn, dl.count, AM_ARC));
+  }
+  check_sort();
+  assert(!dl.merged);
+}
+
+static const uint16_t *ext_key(unsigned idx, const void *ctx) {
+  return ((const uint16_t(*)[256])ctx)[idx];
+}
+
+static void test_sortrec() {
+  // Standalone record sorting, keys live elsewhere (ie. NOR game names).
+  static uint16_t keys[32][256];
+  t_sortrec recs[64];
+  char fn[64];
+  for (unsigned i = 0; i < 32; i++) {
+    random_name(fn);
+    sortable_utf8_u16(fn, keys[i]);
+    sortrec_init(&recs[i], keys[i], 0, i);
+  }
+  const t_sortrec *sorted = sortrec_sort(recs, &recs[32], 32, ext_key, keys);
+  bool seen[32] = {0};
+  for (unsigned i = 0; i < 32; i++) {
+    assert(!seen[sorted[i].idx]);
+    seen[sorted[i].idx] = true;
+    if (i)
+      assert(strcmp16(keys[sorted[i - 1].idx], keys[sorted[i].idx]) <= 0);
+  }
+}
+
+// Reference prefix lookup: linear scan over the visible entries.
+static int ref_seek(const uint16_t *prefix) {
+  unsigned plen = 0;
+  while (prefix[plen])
+    plen++;
+  for (unsigned i = 0; i < dl.visible; i++) {
+    const uint16_t *key = dirlist_key(&dl, dirlist_get(&dl, i));
+    unsigned j = 0;
+    while (j < plen && key[j] == prefix[j])
+      j++;
+    if (j == plen)
+      return i;
+  }
+  return -1;
+}
+
+static void check_seek() {
+  char fn[64];
+  uint16_t prefix[64];
+  for (unsigned i = 0; i < 2000; i++) {
+    // Prefixes of existing keys (any length) or random ones.
+    unsigned n = rand() % 6;
+    if (i % 2 && dl.visible)
+      memcpy(prefix, dirlist_key(&dl, dirlist_get(&dl, rand() % dl.visible)), sizeof(prefix));
+    else {
+      random_name(fn);
+      sortable_utf8_u16(fn, prefix);
+    }
+    prefix[n] = 0;     // Shorter keys are terminated earlier
+    assert(dirlist_seek(&dl, prefix) == ref_seek(prefix));
+  }
+}
+
+static void test_seek() {
+  dirlist_reset(&dl);
+  assert(dirlist_add(&dl, "zelda.gba", 100, AM_ARC));
+  assert(dirlist_add(&dl, "Advance Wars.gba", 200, AM_ARC));
+  assert(dirlist_add(&dl, "apple.gba", 300, AM_ARC));
+  assert(dirlist_add(&dl, "Zzz", 0, AM_DIR));
+  assert(dirlist_add(&dl, "1942.gba", 400, AM_ARC));
+  assert(dirlist_add(&dl, "Ábaco.gba", 500, AM_ARC | AM_HID));
+  dirlist_sort(&dl, sortbuf);
+  dirlist_filter(&dl, true);
+  assert(dl.visible == 5);
+
+  // Upper case initials are folded too, directories are looked up first.
+  const uint16_t pa[] = {'a', 0}, pad[] = {'a', 'd', 0}, pz[] = {'z', 0};
+  const uint16_t pzz[] = {'z', 'z', 0}, pb[] = {'b', 0}, p1[] = {'1', '9', 0};
+  assert(dirlist_seek(&dl, pa) == 2);
+  assert(!strcmp(dirlist_name(&dl, dirlist_get(&dl, 2)), "Advance Wars.gba"));
+  assert(dirlist_seek(&dl, pad) == 2);
+  assert(dirlist_seek(&dl, pz) == 0);
+  assert(dirlist_seek(&dl, pzz) == 0);
+  assert(dirlist_seek(&dl, pb) == -1);
+  assert(dirlist_seek(&dl, p1) == 1);
+  assert(dl.jumps[0][DIRLIST_JUMP_BUCKETS] == 1);
+  assert(dl.jumps[1][dirlist_bucket('a')] == 2 && dl.jumps[1][dirlist_bucket('b')] == 4);
+
+  // Random lists, hidden entries, also while being merged progressively.
+  char fn[64];
+  dirlist_reset(&dl);
+  while (dl.count < 20000) {
+    unsigned batch = rand() % 3000;
+    for (unsigned i = 0; i < batch; i++) {
+      random_name(fn);
+      unsigned attr = (rand() % 10) ? AM_ARC : AM_DIR;
+      assert(dirlist_add(&dl, fn, dl.count, (rand() % 7) ? attr : attr | AM_HID));
+    }
+    dirlist_merge(&dl, sortbuf);
+    dirlist_view(&dl, sortbuf, rand() % 2);
+    check_seek();
+  }
+  dirlist_sort(&dl, sortbuf);
+  dirlist_filter(&dl, false);
+  check_seek();
+  dirlist_filter(&dl, true);
+  check_seek();
+}
+
+// Sort benchmark, synthetic names or real ones (one per line, from a file).
+static void run_bench(const char *fnlist) {
+  static const char *titles[] = {"Pokemon", "Super Mario", "The Legend of Zelda",
+    "Final Fantasy", "Mega Man Battle Network", "Castlevania", "Golden Sun",
+    "Metroid", "Advance Wars", "Fire Emblem", "Kirby", "Harry Potter"};
+  static const char *regions[] = {"(Europe) (En,Fr,De,Es,It)", "(USA)", "(Japan)",
+    "(USA, Europe)", "(Europe) (Rev 1)", "(Japan) (Beta)"};
+
+  dirlist_reset(&dl);
+  if (fnlist) {
+    char fn[512];
+    FILE *fd = fopen(fnlist, "r");
+    assert(fd);
+    while (fgets(fn, sizeof(fn), fd) && dl.count < DIRLIST_MAX_ENTRIES) {
+      fn[strcspn(fn, "\r\n")] = 0;
+      if (fn[0] && strlen(fn) < 256)
+        dirlist_add(&dl, fn, 0, AM_ARC);
+    }
+    fclose(fd);
+  }
+  else {
+    char fn[256];
+    for (unsigned i = 0; i < BENCH_ENTRIES; i++) {
+      sprintf(fn, "%s %u - Part %u %s.gba", titles[rand() % 12], rand() % 8,
+              rand() % 100, regions[rand() % 6]);
+      dirlist_add(&dl, fn, i, (i % 50) ? AM_ARC : AM_DIR);
+    }
+  }
+
+  static t_dirent orig[DIRLIST_MAX_ENTRIES];
+  memcpy(orig, dl.entries, dl.count * sizeof(t_dirent));
+  printf("Sorting %u entries\n", dl.count);
+
+  clock_t start = clock();
+  for (unsigned r = 0; r < 10; r++)
+    ref_sort();
+  printf("%-24s %8.2f ms\n", "heapsort (full keys)", (clock() - start) * 100.0 / CLOCKS_PER_SEC);
+
+  start = clock();
+  for (unsigned r = 0; r < 10; r++) {
+    memcpy(dl.entries, orig, dl.count * sizeof(t_dirent));
+    dirlist_sort(&dl, sortbuf);
+  }
+  printf("%-24s %8.2f ms\n", "mergesort (prefixes)", (clock() - start) * 100.0 / CLOCKS_PER_SEC);
+
+  start = clock();
+  for (unsigned r = 0; r < 10; r++)
+    dirlist_sort(&dl, sortbuf);
+  printf("%-24s %8.2f ms\n", "mergesort (sorted)", (clock() - start) * 100.0 / CLOCKS_PER_SEC);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && !strcmp(argv[1], "bench")) {
+    run_bench(argc > 2 ? argv[2] : NULL);
+    return 0;
+  }
+
+  test_basic();
+  test_large();
+  test_arena_full();
+  test_prefix_sort();
+  test_sortrec();
+  test_merge();
+  test_seek();
+
+  printf("All tests passed!\n");
+  return 0;
+}
+
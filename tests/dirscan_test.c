@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+// Tests the bulk directory scanner against f_readdir, on host disk images.
+// Run as "dirscan_test.bin image.img" to check all dirs in an existing
+// image (exFAT images can be checked this way).
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common.h"
+#include "util.h"
+#include "dirlist.h"
+#include "dirscan.h"
+#include "fatfs/ff.h"
+#include "hostdisk.h"
+
+#define SCANBUF_SIZE    (64*1024)
+
+static FATFS fs;
+static t_dirlist dl, ref;
+static t_dirscan ds;
+static uint8_t scanbuf[SCANBUF_SIZE];
+
+static void list_readdir(const char *path, t_dirlist *l) {
+  DIR d;
+  FILINFO info;
+  dirlist_reset(l);
+  assert(FR_OK == f_opendir(&d, path));
+  while (FR_OK == f_readdir(&d, &info) && info.fname[0])
+    assert(dirlist_add(l, info.fname, (uint32_t)info.fsize, info.fattrib));
+  f_closedir(&d);
+}
+
+static void list_scan(const char *path, t_dirlist *l, unsigned maxsecs) {
+  DIR d;
+  dirlist_reset(l);
+  assert(FR_OK == f_opendir(&d, path));
+  assert(dirscan_open(&ds, &d, scanbuf, sizeof(scanbuf)));
+  while (dirscan_step(&ds, l, maxsecs));
+  f_closedir(&d);
+}
+
+// Checks a directory, reading it in small and big chunks.
+static unsigned check_dir(const char *path) {
+  list_readdir(path, &ref);
+  list_scan(path, &dl, 1);
+  hostdisk_check_same(&dl, &ref);
+  list_scan(path, &dl, ~0U);
+  hostdisk_check_same(&dl, &ref);
+  return ref.count;
+}
+
+static void test_dir(const char *path, unsigned count) {
+  char fn[512];
+  create_basepath(path);
+
+  // Short names (with case flags), long and unicode names, very long names
+  // (that do not fit in the name buffer as utf-8), dirs and hidden entries.
+  static const char *names[] = {
+    "GAME.GBA", "game2.gba", "Game3.GBA", "GAME4.gba", "a", "ABCDEFGH.IJK",
+    "Some long ROM name (Europe) (En,Fr,De).gba", "Pokémon Émeraude.gba",
+    "中文游戏.gba", "😀 emoji 😀.gba", "dots.in.the.name.gba", " leading space",
+    "trailing dot.", "ÿ", "x.y", "LONGNAME1234.GBA",
+  };
+  for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    sprintf(fn, "%s%s", path, names[i]);
+    hostdisk_write_file(fn, NULL, i * 100);
+  }
+  strcpy(fn, path);
+  for (unsigned i = 0; i < 100; i++)
+    strcat(fn, "中");
+  hostdisk_write_file(fn, NULL, 1);
+  sprintf(fn, "%ssaves", path);
+  assert(FR_OK == f_mkdir(fn));
+  sprintf(fn, "%sHidden dir", path);
+  assert(FR_OK == f_mkdir(fn));
+  assert(FR_OK == f_chmod(fn, AM_HID, AM_HID));
+  sprintf(fn, "%sGAME.GBA", path);
+  assert(FR_OK == f_chmod(fn, AM_HID | AM_SYS | AM_RDO, AM_HID | AM_SYS | AM_RDO));
+  check_dir(path);
+
+  // Lots of files, with deleted entries in between.
+  for (unsigned i = 0; i < count; i++) {
+    sprintf(fn, "%sSome long ROM name, number %u (Europe) (En,Fr,De).gba", path, i);
+    hostdisk_write_file(fn, NULL, i);
+  }
+  for (unsigned i = 0; i < count; i += 7) {
+    sprintf(fn, "%sSome long ROM name, number %u (Europe) (En,Fr,De).gba", path, i);
+    assert(FR_OK == f_unlink(fn));
+  }
+  unsigned cnt = check_dir(path);
+
+  // Deleted slots are reused by shorter names.
+  for (unsigned i = 0; i < count; i += 7) {
+    sprintf(fn, "%sr%u.gba", path, i);
+    hostdisk_write_file(fn, NULL, 10);
+  }
+  assert(check_dir(path) == cnt + (count + 6) / 7);
+}
+
+static void test_fragmented() {
+  // Two dirs growing at the same time, so that their clusters interleave.
+  char fn[128];
+  assert(FR_OK == f_mkdir("/frag1"));
+  assert(FR_OK == f_mkdir("/frag2"));
+  for (unsigned i = 0; i < 600; i++) {
+    sprintf(fn, "/frag%u/A file with a long name to use lots of entries %u.gba", i & 1 ? 1 : 2, i);
+    hostdisk_write_file(fn, NULL, 0);
+  }
+  assert(check_dir("/frag1") == 300);
+  assert(check_dir("/frag2") == 300);
+}
+
+static void test_full_list() {
+  // Scanning stops once the list is full.
+  static t_dirlist small;
+  char fn[MAX_FN_LEN];
+  memset(fn, 'x', 250);
+  fn[250] = 0;
+  dirlist_reset(&small);
+  while (dirlist_add(&small, fn, 0, 0));
+  small.count -= 10;
+  small.arena_used = small.entries[small.count].name;
+  const unsigned base = small.count;
+
+  DIR d;
+  assert(FR_OK == f_opendir(&d, "/roms/"));
+  assert(dirscan_open(&ds, &d, scanbuf, sizeof(scanbuf)));
+  while (dirscan_step(&ds, &small, 16));
+  f_closedir(&d);
+  assert(small.count > base && small.count < base + 100);
+}
+
+static void test_read_error() {
+  // Read errors end the scan too, but they are reported as such.
+  DIR d;
+  list_scan("/roms/", &dl, 16);
+  assert(!ds.failed);
+  const unsigned total = dl.count;
+
+  dirlist_reset(&dl);
+  assert(FR_OK == f_opendir(&d, "/roms/"));
+  assert(dirscan_open(&ds, &d, scanbuf, sizeof(scanbuf)));
+  assert(dirscan_step(&ds, &dl, 16));
+  hostdisk_fail_reads(true);
+  while (dirscan_step(&ds, &dl, 16));
+  hostdisk_fail_reads(false);
+  f_closedir(&d);
+  assert(ds.failed && dl.count < total);
+}
+
+// exFAT entry sets, built by hand (no exFAT formatter around).
+static unsigned build_xset(uint8_t *p, const uint16_t *name, unsigned nc, unsigned attr, uint32_t size) {
+  const unsigned nument = 2 + (nc + 14) / 15;
+  memset(p, 0, nument * 32);
+  p[0] = 0x85;
+  p[1] = nument - 1;
+  p[4] = attr;
+  p[32] = 0xC0;
+  p[32 + 1] = 0x03;
+  p[32 + 3] = nc;
+  memcpy(&p[32 + 24], &size, sizeof(size));      // Host is little endian
+  memcpy(&p[32 + 8], &size, sizeof(size));
+  for (unsigned i = 0; i < nument - 2; i++)
+    p[(i + 2) * 32] = 0xC1;
+  for (unsigned i = 0; i < nc; i++) {
+    p[(i / 15 + 2) * 32 + 2 + (i % 15) * 2] = name[i];
+    p[(i / 15 + 2) * 32 + 3 + (i % 15) * 2] = name[i] >> 8;
+  }
+
+  uint16_t sum = 0;
+  for (unsigned i = 0; i < nument * 32; i++) {
+    if (i == 2 || i == 3)
+      continue;
+    sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + p[i];
+  }
+  p[2] = sum;
+  p[3] = sum >> 8;
+  return nument;
+}
+
+static unsigned build_xset_ascii(uint8_t *p, const char *name, unsigned attr, uint32_t size) {
+  uint16_t wn[256];
+  unsigned nc = strlen(name);
+  for (unsigned i = 0; i < nc; i++)
+    wn[i] = name[i];
+  return build_xset(p, wn, nc, attr, size);
+}
+
+static void test_exfat() {
+  static uint8_t raw[64 * 1024];
+  unsigned n = 0;
+  n += build_xset_ascii(&raw[n * 32], "game.gba", AM_ARC, 4096);
+  n += build_xset_ascii(&raw[n * 32], "saves", AM_DIR | AM_HID, 1234);
+  // Deleted entry set (in-use bits cleared) and other entry types.
+  unsigned d = build_xset_ascii(&raw[n * 32], "deleted.gba", AM_ARC, 1);
+  for (unsigned i = 0; i < d; i++)
+    raw[(n + i) * 32] &= 0x7F;
+  n += d;
+  raw[n++ * 32] = 0x81;       // Allocation bitmap
+  raw[n++ * 32] = 0x83;       // Volume label
+  // Long name (spans several name entries) with a surrogate pair.
+  uint16_t wn[200];
+  for (unsigned i = 0; i < 200; i++)
+    wn[i] = 'a' + i % 26;
+  wn[50] = 0xD83D;
+  wn[51] = 0xDE00;
+  n += build_xset(&raw[n * 32], wn, 200, AM_ARC, 77);
+  // Broken surrogate and a name too long for the utf-8 buffer.
+  wn[50] = 0xDE00;
+  n += build_xset(&raw[n * 32], wn, 200, AM_ARC, 78);
+  for (unsigned i = 0; i < 200; i++)
+    wn[i] = 0x4E2D;
+  n += build_xset(&raw[n * 32], wn, 200, AM_ARC, 79);
+  const unsigned last = n;
+  n += build_xset_ascii(&raw[n * 32], "last.gba", AM_ARC | AM_RDO, 5);
+  // Bad checksums make f_readdir fail, so listing stops there.
+  n += build_xset_ascii(&raw[n * 32], "bad.gba", AM_ARC, 5);
+  raw[(n - 1) * 32 + 4] ^= 1;
+  n += build_xset_ascii(&raw[n * 32], "after.gba", AM_ARC, 5);
+
+  // Entry sets can span chunks.
+  const unsigned chunks[] = {1, 3, 16, n};
+  for (unsigned c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+    dirlist_reset(&dl);
+    dirscan_init(&ds, true);
+    bool more = true;
+    for (unsigned i = 0; i < n && more; i += chunks[c])
+      more = dirscan_parse(&ds, &raw[i * 32], MIN(chunks[c], n - i), &dl);
+    assert(!more && ds.failed);
+
+    assert(dl.count == 6);
+    const t_dirent *e = dl.entries;
+    assert(!strcmp(dirlist_name(&dl, &e[0]), "game.gba") && e[0].filesize == 4096 && e[0].attr == AM_ARC);
+    assert(!strcmp(dirlist_name(&dl, &e[1]), "saves") && !e[1].filesize && e[1].attr == (AM_DIR | AM_HID));
+    const char *n2 = dirlist_name(&dl, &e[2]);
+    assert(strlen(n2) == 198 + 4 && !memcmp(&n2[50], "😀", 4) && e[2].filesize == 77);
+    assert(!strcmp(dirlist_name(&dl, &e[3]), "?") && e[3].filesize == 78);
+    assert(!strcmp(dirlist_name(&dl, &e[4]), "?") && e[4].filesize == 79);
+    assert(!strcmp(dirlist_name(&dl, &e[5]), "last.gba") && e[5].attr == (AM_ARC | AM_RDO));
+  }
+
+  // The end marker stops the listing too.
+  memset(&raw[last * 32], 0, 32);
+  dirlist_reset(&dl);
+  dirscan_init(&ds, true);
+  assert(!dirscan_parse(&ds, raw, n, &dl));
+  assert(dl.count == 5 && !ds.failed);
+
+  // So does a set that is cut short (name entries missing).
+  n = build_xset_ascii(raw, "game.gba", AM_ARC, 4096);
+  n += build_xset_ascii(&raw[n * 32], "cut.gba", AM_ARC, 1);
+  raw[(n - 1) * 32] = 0x85;
+  dirlist_reset(&dl);
+  dirscan_init(&ds, true);
+  assert(!dirscan_parse(&ds, raw, n, &dl));
+  assert(dl.count == 1 && ds.failed);
+}
+
+static void run_cases() {
+  test_dir("/", 60);             // Fixed size root dir on FAT16
+  test_dir("/roms/", 1200);
+  test_fragmented();
+  test_full_list();
+  test_read_error();
+
+  hostdisk_reset_stats();
+  list_readdir("/roms/", &ref);
+  hostdisk_print_stats("  f_readdir listing");
+  hostdisk_reset_stats();
+  list_scan("/roms/", &dl, ~0U);
+  hostdisk_print_stats("  dirscan listing");
+}
+
+static unsigned check_tree(char *path) {
+  unsigned cnt = check_dir(path), plen = strlen(path);
+
+  // Subdirs are checked after the list is reused, keep their names.
+  unsigned ndirs = 0;
+  char **dirs = malloc(ref.count * sizeof(char*));
+  for (unsigned i = 0; i < ref.count; i++)
+    if (ref.entries[i].attr & AM_DIR)
+      dirs[ndirs++] = strdup(dirlist_name(&ref, &ref.entries[i]));
+
+  for (unsigned i = 0; i < ndirs; i++) {
+    strcat(path, dirs[i]);
+    strcat(path, "/");
+    cnt += check_tree(path);
+    path[plen] = 0;
+    free(dirs[i]);
+  }
+  free(dirs);
+  return cnt;
+}
+
+int main(int argc, char **argv) {
+  const t_hostdisk_latency lat = HOSTDISK_LATENCY_SC;
+  hostdisk_set_latency(&lat);
+
+  if (argc > 1) {
+    char path[4096] = "/";
+    assert(hostdisk_open(argv[1]));
+    assert(FR_OK == f_mount(&fs, "0:", 1));
+    printf("%u entries checked\n", check_tree(path));
+    f_unmount("0:");
+    hostdisk_close();
+    return 0;
+  }
+
+  test_exfat();
+  hostdisk_run_images(run_cases);
+
+  printf("All tests passed!\n");
+  return 0;
+}
+
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+// Tests the diskio sector cache against a fake SD card.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common.h"
+#include "fatfs/ff.h"
+#include "fatfs/diskio.h"
+
+#define CARD_SECTORS   1022     // (not a multiple of the line size)
+
+static uint8_t card[CARD_SECTORS * 512];
+static unsigned rdcmds, wrcmds;
+
+unsigned sdcard_read_blocks(uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
+  rdcmds++;
+  if (blocknum + blkcnt > CARD_SECTORS)
+    return 1;
+  memcpy(buffer, &card[blocknum * 512], blkcnt * 512);
+  return 0;
+}
+
+unsigned sdcard_write_blocks(const uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
+  wrcmds++;
+  if (blocknum + blkcnt > CARD_SECTORS)
+    return 1;
+  memcpy(&card[blocknum * 512], buffer, blkcnt * 512);
+  return 0;
+}
+
+static void check_read(LBA_t sector, UINT count) {
+  static uint8_t buf[CARD_SECTORS * 512];
+  assert(RES_OK == disk_read(0, buf, sector, count));
+  assert(!memcmp(buf, &card[sector * 512], count * 512));
+}
+
+int main() {
+  for (unsigned i = 0; i < sizeof(card); i++)
+    card[i] = rand();
+  disk_initialize(0);
+
+  // Sequential single sector reads: one read command per line.
+  rdcmds = 0;
+  for (unsigned i = 0; i < 64; i++)
+    check_read(i, 1);
+  assert(rdcmds == 64 / SD_CACHE_LINE_SECTORS);
+
+  // Re-reading a recently used sector does not hit the card.
+  rdcmds = 0;
+  check_read(60, 1);
+  check_read(63, 1);
+  assert(rdcmds == 0);
+
+  // Multi-sector reads bypass the cache.
+  check_read(0, 64);
+  assert(rdcmds == 1);
+
+  // LRU: keep a hot sector (ie. FAT) while streaming others through.
+  rdcmds = 0;
+  for (unsigned i = 100; i < 400; i++) {
+    check_read(7, 1);
+    check_read(i, 1);
+  }
+  assert(rdcmds == 1 + 300 / SD_CACHE_LINE_SECTORS);
+
+  // Writes are written through and update cached sectors.
+  static uint8_t wbuf[16 * 512];
+  for (unsigned i = 0; i < sizeof(wbuf); i++)
+    wbuf[i] = i ^ 0x33;
+  assert(RES_OK == disk_write(0, wbuf, 390, 16));
+  assert(wrcmds == 1);
+  rdcmds = 0;
+  for (unsigned i = 388; i < 400; i++)
+    check_read(i, 1);
+  check_read(7, 1);
+  assert(rdcmds == 0);
+  assert(RES_OK == disk_write(0, wbuf, 7, 1));
+  check_read(7, 1);
+  check_read(380, 40);
+
+  // Lines beyond the end of the card are read directly.
+  rdcmds = 0;
+  check_read(CARD_SECTORS - 1, 1);
+  assert(rdcmds == 2);
+  assert(RES_OK != disk_read(0, wbuf, CARD_SECTORS, 1));
+
+  // Random access pattern against the card contents.
+  for (unsigned i = 0; i < 20000; i++) {
+    LBA_t s = rand() % CARD_SECTORS;
+    if (!(i % 7)) {
+      UINT cnt = 1 + rand() % MIN(16, CARD_SECTORS - s);
+      for (unsigned j = 0; j < cnt * 512; j++)
+        wbuf[j] = rand();
+      assert(RES_OK == disk_write(0, wbuf, s, cnt));
+    }
+    else if (!(i % 5))
+      check_read(s, 1 + rand() % MIN(32, CARD_SECTORS - s));
+    else
+      check_read(s, 1);
+  }
+
+  printf("All tests passed!\n");
+  return 0;
+}
+
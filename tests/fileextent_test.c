@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common.h"
+#include "fileextent.h"
+#include "fatfs/diskio.h"
+
+// Synthetic volume: a FAT (16 or 32 bits) followed by the data area.
+#define DISK_SECTORS    (16*1024)
+#define FAT_BASE        8
+#define DATA_BASE       256
+#define CLUSTER_SECS    4
+#define CLUSTER_SIZE    (CLUSTER_SECS * 512)
+#define NUM_CLUSTERS    ((DISK_SECTORS - DATA_BASE) / CLUSTER_SECS)
+
+static uint8_t disk[DISK_SECTORS * 512];
+static FATFS fs;
+static unsigned rdcalls, rdsectors, freads;
+
+DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
+  assert(sector + count <= DISK_SECTORS && count);
+  memcpy(buff, &disk[sector * 512], count * 512);
+  rdcalls++;
+  rdsectors += count;
+  return RES_OK;
+}
+
+static uint32_t get_fat(uint32_t clst) {
+  if (fs.fs_type == FS_FAT16)
+    return ((uint16_t*)&disk[FAT_BASE * 512])[clst];
+  return ((uint32_t*)&disk[FAT_BASE * 512])[clst] & 0x0FFFFFFF;
+}
+
+static void set_fat(uint32_t clst, uint32_t val) {
+  if (fs.fs_type == FS_FAT16)
+    ((uint16_t*)&disk[FAT_BASE * 512])[clst] = val;
+  else
+    ((uint32_t*)&disk[FAT_BASE * 512])[clst] = val;
+}
+
+// Reference FatFs implementation (walks the chain on every call).
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs) {
+  fp->fptr = ofs;
+  return FR_OK;
+}
+
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br) {
+  freads++;
+  *br = 0;
+  while (btr && fp->fptr < f_size(fp)) {
+    uint32_t clst = fp->obj.sclust;
+    if (!(fp->obj.stat & 2))
+      for (unsigned i = 0; i < fp->fptr / CLUSTER_SIZE; i++)
+        clst = get_fat(clst);
+    else
+      clst += fp->fptr / CLUSTER_SIZE;
+    unsigned coff = fp->fptr % CLUSTER_SIZE;
+    unsigned cnt = MIN(btr, MIN(CLUSTER_SIZE - coff, f_size(fp) - fp->fptr));
+    memcpy(buff, &disk[(DATA_BASE + (clst - 2) * CLUSTER_SECS) * 512 + coff], cnt);
+    buff = (uint8_t*)buff + cnt;
+    fp->fptr += cnt;
+    btr -= cnt;
+    *br += cnt;
+  }
+  return FR_OK;
+}
+
+static void init_fs(BYTE type) {
+  memset(disk, 0, sizeof(disk));
+  memset(&fs, 0, sizeof(fs));
+  fs.fs_type = type;
+  fs.csize = CLUSTER_SECS;
+  fs.n_fatent = NUM_CLUSTERS + 2;
+  fs.fatbase = FAT_BASE;
+  fs.database = DATA_BASE;
+}
+
+// Creates a file using the given clusters (in order) and fills it.
+static void make_file(FIL *fp, const uint32_t *clsts, unsigned ncl, unsigned size, unsigned seed) {
+  memset(fp, 0, sizeof(*fp));
+  fp->obj.fs = &fs;
+  fp->obj.sclust = clsts[0];
+  fp->obj.objsize = size;
+  for (unsigned i = 0; i < ncl; i++)
+    set_fat(clsts[i], i + 1 < ncl ? clsts[i + 1] : 0x0FFFFFFF);
+
+  srand(seed);
+  for (unsigned i = 0; i < ncl; i++)
+    for (unsigned j = 0; j < CLUSTER_SIZE; j++)
+      disk[(DATA_BASE + (clsts[i] - 2) * CLUSTER_SECS) * 512 + j] = rand();
+}
+
+// Checks random reads against the reference implementation.
+static void check_reads(t_file_extents *fe, FIL *fp, unsigned iters) {
+  static uint8_t ref[NUM_CLUSTERS * CLUSTER_SIZE], out[NUM_CLUSTERS * CLUSTER_SIZE];
+  const unsigned size = f_size(fp);
+  for (unsigned i = 0; i < iters; i++) {
+    unsigned off = rand() % (size + 1024);
+    unsigned len = (i & 1) ? rand() % 2048 : rand() % (size + 1);
+    if (i & 2) {
+      off &= ~511U;
+      len &= ~511U;
+    }
+
+    UINT rbr, obr;
+    f_lseek(fp, off);
+    assert(FR_OK == f_read(fp, ref, len, &rbr));
+    memset(out, 0xAA, sizeof(out));
+    assert(FR_OK == fext_read(fe, off, out, len, &obr));
+    assert(rbr == obr && !memcmp(ref, out, rbr));
+    assert(out[obr] == 0xAA);
+  }
+}
+
+static void run_tests(BYTE type) {
+  static uint32_t clsts[NUM_CLUSTERS];
+  t_file_extents fe;
+  FIL fp;
+  UINT br;
+
+  init_fs(type);
+
+  // Contiguous file: a single extent, whole reads are a single disk read.
+  for (unsigned i = 0; i < 1000; i++)
+    clsts[i] = 100 + i;
+  make_file(&fp, clsts, 1000, 1000 * CLUSTER_SIZE - 100, 1);
+  assert(fext_map(&fe, &fp));
+  assert(fe.count == 1 && fe.mapped == 1000 * CLUSTER_SIZE - 100);
+  assert(fe.ext[0].sector == DATA_BASE + 98 * CLUSTER_SECS && fe.ext[0].count == 1000 * CLUSTER_SECS);
+  static uint8_t buf[1000 * CLUSTER_SIZE];
+  rdcalls = rdsectors = freads = 0;
+  assert(FR_OK == fext_read(&fe, 0, buf, 64*1024, &br) && br == 64*1024);
+  assert(rdcalls == 1 && rdsectors == 128 && freads == 0);
+  rdcalls = rdsectors = freads = 0;
+  assert(FR_OK == fext_read(&fe, 1000, buf, sizeof(buf), &br) && br == sizeof(buf) - 1100);
+  assert(rdcalls == 1 && freads == 2);            // Unaligned head, partial tail
+  check_reads(&fe, &fp, 200);
+
+  // Fragmented file, one extent per fragment.
+  unsigned n = 0;
+  for (unsigned f = 0; f < 10; f++)
+    for (unsigned i = 0; i < 50; i++)
+      clsts[n++] = 2000 + (9 - f) * 100 + i;
+  make_file(&fp, clsts, n, n * CLUSTER_SIZE, 2);
+  assert(fext_map(&fe, &fp));
+  assert(fe.count == 10 && fe.mapped == n * CLUSTER_SIZE);
+  for (unsigned f = 0; f < 10; f++)
+    assert(fe.ext[f].offset == f * 50 * CLUSTER_SIZE && fe.ext[f].count == 50 * CLUSTER_SECS);
+  rdcalls = rdsectors = freads = 0;
+  assert(FR_OK == fext_read(&fe, 0, buf, n * CLUSTER_SIZE, &br) && br == n * CLUSTER_SIZE);
+  assert(rdcalls == 10 && rdsectors == n * CLUSTER_SECS && freads == 0);
+  check_reads(&fe, &fp, 200);
+
+  // Heavily fragmented file: partially mapped, the rest uses f_read.
+  for (unsigned i = 0; i < 100; i++)
+    clsts[i] = 3000 + i * 2;
+  make_file(&fp, clsts, 100, 100 * CLUSTER_SIZE, 3);
+  assert(fext_map(&fe, &fp));
+  assert(fe.count == MAX_FILE_EXTENTS && fe.mapped == MAX_FILE_EXTENTS * CLUSTER_SIZE);
+  check_reads(&fe, &fp, 200);
+
+  // Tiny file and empty file.
+  clsts[0] = 10;
+  make_file(&fp, clsts, 1, 100, 4);
+  assert(fext_map(&fe, &fp));
+  check_reads(&fe, &fp, 50);
+  fp.obj.sclust = 0;
+  fp.obj.objsize = 0;
+  assert(!fext_map(&fe, &fp));
+  assert(FR_OK == fext_read(&fe, 0, buf, 512, &br) && br == 0);
+
+  // Broken chains just stop mapping.
+  for (unsigned i = 0; i < 20; i++)
+    clsts[i] = 500 + i;
+  make_file(&fp, clsts, 20, 20 * CLUSTER_SIZE, 5);
+  set_fat(509, 1);
+  assert(fext_map(&fe, &fp));
+  assert(fe.count == 1 && fe.mapped == 10 * CLUSTER_SIZE);
+
+  // Dirty FAT window: no mapping, reads still work.
+  make_file(&fp, clsts, 20, 20 * CLUSTER_SIZE, 6);
+  fs.wflag = 1;
+  assert(!fext_map(&fe, &fp));
+  check_reads(&fe, &fp, 50);
+  fs.wflag = 0;
+}
+
+int main() {
+  run_tests(FS_FAT16);
+  run_tests(FS_FAT32);
+  run_tests(FS_EXFAT);
+
+  // exFAT contiguous files (no FAT chain).
+  init_fs(FS_EXFAT);
+  uint32_t clsts[64];
+  for (unsigned i = 0; i < 64; i++)
+    clsts[i] = 40 + i;
+  FIL fp;
+  t_file_extents fe;
+  make_file(&fp, clsts, 64, 64 * CLUSTER_SIZE - 3, 7);
+  memset(&disk[FAT_BASE * 512], 0, 64 * 512);
+  fp.obj.stat = 2;
+  assert(fext_map(&fe, &fp));
+  assert(fe.count == 1 && fe.mapped == 64 * CLUSTER_SIZE - 3);
+  check_reads(&fe, &fp, 200);
+
+  printf("All tests passed!\n");
+  return 0;
+}
+
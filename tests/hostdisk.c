@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hostdisk.h"
+#include "supercard_driver.h"
+#include "fatfs/ff.h"
+
+static int imgfd = -1;
+static uint32_t imgsectors;
+static t_hostdisk_stats stats;
+static t_hostdisk_latency latency;
+static bool fail_reads;
+static FATFS fixture_fs;
+static char fixture_path[32];
+
+static unsigned hist_bucket(unsigned cnt) {
+  unsigned b = 0;
+  while (cnt > 1 && b < HOSTDISK_HIST_BUCKETS - 1) {
+    cnt >>= 1;
+    b++;
+  }
+  return b;
+}
+
+static void account(bool write, unsigned blkcnt) {
+  if (write) {
+    stats.wr_cmds++;
+    stats.wr_sectors += blkcnt;
+    stats.wr_hist[hist_bucket(blkcnt)]++;
+  } else {
+    stats.rd_cmds++;
+    stats.rd_sectors += blkcnt;
+    stats.rd_hist[hist_bucket(blkcnt)]++;
+  }
+  stats.elapsed_us += latency.cmd_us + (blkcnt > 1 ? latency.stop_us : 0) +
+                      blkcnt * (write ? latency.wr_sector_us : latency.rd_sector_us);
+}
+
+// Driver API (as in supercard_driver.c)
+
+unsigned sdcard_read_blocks(uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
+  account(false, blkcnt);
+  if (fail_reads || blocknum + blkcnt > imgsectors)
+    return SD_ERR_BADREAD;
+  if (pread(imgfd, buffer, blkcnt * 512, (off_t)blocknum * 512) != blkcnt * 512)
+    return SD_ERR_BADREAD;
+  return 0;
+}
+
+unsigned sdcard_write_blocks(const uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
+  account(true, blkcnt);
+  if (blocknum + blkcnt > imgsectors)
+    return SD_ERR_BADWRITE;
+  if (pwrite(imgfd, buffer, blkcnt * 512, (off_t)blocknum * 512) != blkcnt * 512)
+    return SD_ERR_BADWRITE;
+  return 0;
+}
+
+bool hostdisk_open(const char *path) {
+  imgfd = open(path, O_RDWR);
+  if (imgfd < 0)
+    return false;
+  imgsectors = lseek(imgfd, 0, SEEK_END) / 512;
+  hostdisk_reset_stats();
+  return true;
+}
+
+void hostdisk_close() {
+  if (imgfd >= 0)
+    close(imgfd);
+  imgfd = -1;
+}
+
+static void st16(uint8_t *p, uint16_t v) {
+  p[0] = v; p[1] = v >> 8;
+}
+
+static void st32(uint8_t *p, uint32_t v) {
+  st16(p, v); st16(&p[2], v >> 16);
+}
+
+// Minimal FAT16/FAT32 formatter (FatFs is built without f_mkfs), creates
+// a single volume (no partition table) with an empty root directory.
+bool hostdisk_create(const char *path, uint32_t sectors, unsigned clustsecs) {
+  bool fat32 = true;
+  unsigned rsvd, rootsecs, fatsz;
+  uint32_t nclst;
+  while (1) {
+    rsvd = fat32 ? 32 : 1;
+    rootsecs = fat32 ? 0 : 32;     // 512 root entries on FAT16
+    fatsz = 1;
+    while (1) {
+      nclst = (sectors - rsvd - rootsecs - 2 * fatsz) / clustsecs;
+      unsigned req = ((nclst + 2) * (fat32 ? 4 : 2) + 511) / 512;
+      if (fatsz >= req)
+        break;
+      fatsz = req;
+    }
+    if (!fat32 || nclst > 65525)
+      break;
+    fat32 = false;
+  }
+  if (nclst <= 4085 || nclst > (fat32 ? 0x0FFFFFF5 : 65525))
+    return false;        // FAT12 not supported (and not useful)
+
+  imgfd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (imgfd < 0)
+    return false;
+  imgsectors = sectors;
+  if (ftruncate(imgfd, (off_t)sectors * 512))
+    return false;
+
+  uint8_t bs[512] = {0};
+  memcpy(bs, fat32 ? "\xEB\x58\x90" "MSWIN4.1" : "\xEB\x3C\x90" "MSWIN4.1", 11);
+  st16(&bs[11], 512);
+  bs[13] = clustsecs;
+  st16(&bs[14], rsvd);
+  bs[16] = 2;
+  st16(&bs[17], fat32 ? 0 : 512);
+  st16(&bs[19], sectors < 0x10000 ? sectors : 0);
+  bs[21] = 0xF8;
+  st16(&bs[22], fat32 ? 0 : fatsz);
+  st16(&bs[24], 63);
+  st16(&bs[26], 255);
+  st32(&bs[32], sectors < 0x10000 ? 0 : sectors);
+  uint8_t *ext = fat32 ? &bs[64] : &bs[36];
+  if (fat32) {
+    st32(&bs[36], fatsz);
+    st32(&bs[44], 2);          // Root directory cluster
+    st16(&bs[48], 1);          // FSInfo sector
+    st16(&bs[50], 6);          // Backup boot sector
+  }
+  ext[0] = 0x80;
+  ext[2] = 0x29;
+  st32(&ext[3], 0x5C5C0001);
+  memcpy(&ext[7], "NO NAME    ", 11);
+  memcpy(&ext[18], fat32 ? "FAT32   " : "FAT16   ", 8);
+  st16(&bs[510], 0xAA55);
+  pwrite(imgfd, bs, 512, 0);
+
+  if (fat32) {
+    pwrite(imgfd, bs, 512, 6 * 512);
+    uint8_t fsi[512] = {0};
+    st32(&fsi[0], 0x41615252);
+    st32(&fsi[484], 0x61417272);
+    st32(&fsi[488], 0xFFFFFFFF);
+    st32(&fsi[492], 0xFFFFFFFF);
+    st32(&fsi[508], 0xAA550000);
+    pwrite(imgfd, fsi, 512, 1 * 512);
+  }
+
+  // Reserved FAT entries (and the root directory cluster on FAT32)
+  uint8_t fat[512] = {0};
+  if (fat32) {
+    st32(&fat[0], 0x0FFFFFF8);
+    st32(&fat[4], 0x0FFFFFFF);
+    st32(&fat[8], 0x0FFFFFFF);
+  } else {
+    st16(&fat[0], 0xFFF8);
+    st16(&fat[2], 0xFFFF);
+  }
+  for (unsigned i = 0; i < 2; i++)
+    pwrite(imgfd, fat, 512, (off_t)(rsvd + i * fatsz) * 512);
+
+  hostdisk_reset_stats();
+  return true;
+}
+
+void hostdisk_set_latency(const t_hostdisk_latency *lat) {
+  latency = *lat;
+}
+
+void hostdisk_fail_reads(bool fail) {
+  fail_reads = fail;
+}
+
+void hostdisk_reset_stats() {
+  memset(&stats, 0, sizeof(stats));
+}
+
+const t_hostdisk_stats *hostdisk_stats() {
+  return &stats;
+}
+
+void hostdisk_print_stats(const char *title) {
+  printf("%s: %llu reads (%llu sectors), %llu writes (%llu sectors), %llu.%03llu ms\n", title,
+         (unsigned long long)stats.rd_cmds, (unsigned long long)stats.rd_sectors,
+         (unsigned long long)stats.wr_cmds, (unsigned long long)stats.wr_sectors,
+         (unsigned long long)stats.elapsed_us / 1000, (unsigned long long)stats.elapsed_us % 1000);
+  for (unsigned i = 0; i < HOSTDISK_HIST_BUCKETS; i++)
+    if (stats.rd_hist[i] || stats.wr_hist[i])
+      printf("  %5u+ sectors: %8llu reads %8llu writes\n", 1 << i,
+             (unsigned long long)stats.rd_hist[i], (unsigned long long)stats.wr_hist[i]);
+}
+
+
+void hostdisk_setup(const char *title, uint32_t sectors, unsigned clustsecs, unsigned fstype) {
+  strcpy(fixture_path, "/tmp/hostdisk.XXXXXX");
+  int tfd = mkstemp(fixture_path);
+  assert(tfd >= 0);
+  close(tfd);
+
+  printf("%s\n", title);
+  assert(hostdisk_create(fixture_path, sectors, clustsecs));
+  assert(FR_OK == f_mount(&fixture_fs, "0:", 1));
+  assert(fixture_fs.fs_type == fstype && fixture_fs.csize == clustsecs);
+}
+
+void hostdisk_teardown() {
+  f_unmount("0:");
+  hostdisk_close();
+  unlink(fixture_path);
+}
+
+void hostdisk_remount() {
+  f_unmount("0:");
+  hostdisk_close();
+  assert(hostdisk_open(fixture_path));
+  assert(FR_OK == f_mount(&fixture_fs, "0:", 1));
+}
+
+void hostdisk_run_images(void (*cases)()) {
+  hostdisk_setup("FAT16 (64MiB, 2KiB clusters)", 64*1024*2, 4, FS_FAT16);
+  cases();
+  hostdisk_teardown();
+  hostdisk_setup("FAT32 (512MiB, 4KiB clusters)", 512*1024*2, 8, FS_FAT32);
+  cases();
+  hostdisk_teardown();
+}
+
+void hostdisk_write_file(const char *fn, const void *data, unsigned size) {
+  static const uint8_t zeros[4096];
+  FIL fd;
+  UINT bw;
+  assert(FR_OK == f_open(&fd, fn, FA_WRITE | FA_CREATE_ALWAYS));
+  if (data)
+    assert(FR_OK == f_write(&fd, data, size, &bw) && bw == size);
+  else {
+    for (unsigned off = 0; off < size; off += sizeof(zeros)) {
+      const unsigned chunk = MIN(size - off, sizeof(zeros));
+      assert(FR_OK == f_write(&fd, zeros, chunk, &bw) && bw == chunk);
+    }
+  }
+  assert(FR_OK == f_close(&fd));
+}
+
+void hostdisk_check_same(const t_dirlist *a, const t_dirlist *b) {
+  assert(a->count == b->count && a->visible == b->visible);
+  for (unsigned i = 0; i < a->count; i++) {
+    assert(a->entries[i].filesize == b->entries[i].filesize);
+    assert(a->entries[i].attr == b->entries[i].attr);
+    assert(!strcmp(dirlist_name(a, &a->entries[i]), dirlist_name(b, &b->entries[i])));
+  }
+}
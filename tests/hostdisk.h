@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HOSTDISK_H_
+#define _HOSTDISK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dirlist.h"
+
+// Host SD card backend: implements the sdcard_read/write_blocks() driver
+// API on top of a disk image file, so that the firmware diskio.c and FatFs
+// can run on the host. All I/O is accounted for, and an optional latency
+// model estimates how long it would take on real hardware.
+
+#define HOSTDISK_HIST_BUCKETS   12    // Request sizes: 1, 2-3, 4-7 ... 2048+ sectors
+
+typedef struct {
+  uint64_t rd_cmds, wr_cmds;          // Read/write commands (CMD17/18, CMD24/25)
+  uint64_t rd_sectors, wr_sectors;
+  uint64_t rd_hist[HOSTDISK_HIST_BUCKETS];
+  uint64_t wr_hist[HOSTDISK_HIST_BUCKETS];
+  uint64_t elapsed_us;                // As estimated by the latency model
+} t_hostdisk_stats;
+
+// Command setup cost, plus a per-sector transfer cost. Multi-block commands
+// pay an extra stop (CMD12) cost. All in microseconds.
+typedef struct {
+  unsigned cmd_us;
+  unsigned stop_us;
+  unsigned rd_sector_us;
+  unsigned wr_sector_us;
+} t_hostdisk_latency;
+
+// Roughly mimics a Supercard SD (~2.5MiB/s reads, slower writes).
+#define HOSTDISK_LATENCY_SC   ((t_hostdisk_latency){ 300, 100, 190, 450 })
+
+// Opens an existing disk image (FAT/exFAT, with or without partition table).
+bool hostdisk_open(const char *path);
+
+// Creates a FAT16/FAT32 formatted image (type depends on the cluster count).
+bool hostdisk_create(const char *path, uint32_t sectors, unsigned clustsecs);
+
+void hostdisk_close();
+
+void hostdisk_set_latency(const t_hostdisk_latency *lat);
+
+// Makes all reads fail (to exercise error paths).
+void hostdisk_fail_reads(bool fail);
+void hostdisk_reset_stats();
+const t_hostdisk_stats *hostdisk_stats();
+void hostdisk_print_stats(const char *title);
+
+// Test fixture: creates a temporary image and mounts it as "0:", checking
+// that it got the expected FAT type. Teardown unmounts and deletes it.
+void hostdisk_setup(const char *title, uint32_t sectors, unsigned clustsecs, unsigned fstype);
+void hostdisk_teardown();
+// Unmounts and mounts the image again (to check what reached the disk).
+void hostdisk_remount();
+// Runs the test cases on a FAT16 (64MiB) and a FAT32 (512MiB) image.
+void hostdisk_run_images(void (*cases)());
+
+// Creates (or overwrites) a file, NULL data writes zeros.
+void hostdisk_write_file(const char *fn, const void *data, unsigned size);
+// Asserts that both lists have the same entries, in the same order.
+void hostdisk_check_same(const t_dirlist *a, const t_dirlist *b);
+
+#endif
+
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+// Runs FatFs (and the firmware diskio layer) on top of host disk images.
+// Run as "hostdisk_test.bin image.img" to benchmark directory walks on a
+// real card image (nothing is written to it).
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common.h"
+#include "util.h"
+#include "patchengine.h"
+#include "fileextent.h"
+#include "save.h"
+#include "settings.h"
+#include "fatfs/ff.h"
+#include "hostdisk.h"
+
+#define BIGFILE_SIZE    (2*1024*1024 + 1000)
+#define DIR_FILES       300
+
+static FATFS fs;
+static uint8_t wbuf[BIGFILE_SIZE], rbuf[BIGFILE_SIZE];
+
+// Not exported by save.c
+bool rotate_savefile(const char *templ_fn, unsigned max_backups);
+bool copy_save_contiguous_file(const char *fn, const char *dest, unsigned size);
+
+// Hardware and UI bits used by save.c and settings.c (SRAM is not emulated,
+// so only the file side of the save handling is checked).
+void set_supercard_mode(unsigned mapped_area, bool write_access, bool sdcard_interface) {}
+void dma_memset16(volatile void *ptr, uint16_t value, uint16_t count) {
+  for (unsigned i = 0; i < count; i++)
+    ((volatile uint16_t*)ptr)[i] = value;
+}
+uint16_t lang_getcode() { return 'e' | ('n' << 8); }
+unsigned lang_lookup(uint16_t code) { return code == ('e' | ('n' << 8)) ? 0 : 1; }
+
+static unsigned read_file(const char *fn, void *data, unsigned maxsize) {
+  FIL fd;
+  UINT br;
+  if (FR_OK != f_open(&fd, fn, FA_READ))
+    return ~0U;
+  assert(FR_OK == f_read(&fd, data, maxsize, &br));
+  f_close(&fd);
+  return br;
+}
+
+static void test_bigfile() {
+  for (unsigned i = 0; i < BIGFILE_SIZE; i++)
+    wbuf[i] = rand();
+  hostdisk_write_file("/big.gba", wbuf, BIGFILE_SIZE);
+
+  // Regular f_read, in 16KB chunks.
+  FIL fd;
+  UINT br;
+  assert(FR_OK == f_open(&fd, "/big.gba", FA_READ));
+  hostdisk_reset_stats();
+  memset(rbuf, 0, sizeof(rbuf));
+  for (unsigned off = 0; off < BIGFILE_SIZE; off += 16*1024)
+    assert(FR_OK == f_read(&fd, &rbuf[off], MIN(16*1024, BIGFILE_SIZE - off), &br));
+  assert(!memcmp(wbuf, rbuf, BIGFILE_SIZE));
+  hostdisk_print_stats("  f_read (16KB)");
+  const uint64_t fread_cmds = hostdisk_stats()->rd_cmds;
+
+  // Extent mapped reads, a fresh file is contiguous.
+  t_file_extents fe;
+  hostdisk_reset_stats();
+  assert(fext_map(&fe, &fd));
+  assert(fe.count == 1 && fe.mapped == BIGFILE_SIZE);
+  memset(rbuf, 0, sizeof(rbuf));
+  assert(FR_OK == fext_read(&fe, 0, rbuf, BIGFILE_SIZE, &br) && br == BIGFILE_SIZE);
+  assert(!memcmp(wbuf, rbuf, BIGFILE_SIZE));
+  hostdisk_print_stats("  fext_read");
+  assert(hostdisk_stats()->rd_cmds < fread_cmds);
+  assert(hostdisk_stats()->rd_hist[HOSTDISK_HIST_BUCKETS - 1] == 1);
+  f_close(&fd);
+}
+
+static void test_directory() {
+  char fn[64];
+  create_basepath("/roms/gba/");
+  for (unsigned i = 0; i < DIR_FILES; i++) {
+    sprintf(fn, "/roms/gba/Some long game name number %u.gba", i);
+    hostdisk_write_file(fn, fn, strlen(fn));
+  }
+
+  // Walk the directory twice (the second time the cache is warm-ish).
+  for (unsigned r = 0; r < 2; r++) {
+    DIR d;
+    FILINFO info;
+    unsigned cnt = 0;
+    hostdisk_reset_stats();
+    assert(FR_OK == f_opendir(&d, "/roms/gba"));
+    while (FR_OK == f_readdir(&d, &info) && info.fname[0])
+      cnt++;
+    f_closedir(&d);
+    assert(cnt == DIR_FILES);
+    hostdisk_print_stats("  readdir");
+  }
+
+  // File probes, as done when a ROM is selected.
+  hostdisk_reset_stats();
+  for (unsigned i = 0; i < DIR_FILES; i += 10) {
+    sprintf(fn, "/roms/gba/Some long game name number %u.gba", i);
+    assert(check_file_exists(fn));
+    sprintf(fn, "/roms/gba/Some long game name number %u.sav", i);
+    assert(!check_file_exists(fn));
+  }
+  hostdisk_print_stats("  probes");
+}
+
+static void test_patchcache() {
+  t_patch p, q;
+  memset(&p, 0, sizeof(p));
+  p.wcnt_ops = 3;
+  p.op[0] = 0x100; p.op[1] = 0x200; p.op[2] = 0x300;
+  p.hole_addr = 0x100000;
+  p.hole_size = 0x40000;
+
+  hostdisk_reset_stats();
+  assert(!load_cached_patches("/big.gba", &q));
+  assert(write_patches_cache("/big.gba", &p));
+  assert(load_cached_patches("/big.gba", &q));
+  assert(q.wcnt_ops == 3 && q.op[2] == 0x300 && q.hole_addr == 0x100000);
+  hostdisk_print_stats("  patch cache");
+}
+
+static void test_savefiles() {
+  // Wiped saves are 128KiB of ones.
+  create_basepath("/saves/");
+  assert(wipe_sav_file("/saves/wiped.sav"));
+  assert(read_file("/saves/wiped.sav", rbuf, sizeof(rbuf)) == 128*1024);
+  for (unsigned i = 0; i < 128*1024; i++)
+    assert(rbuf[i] == 0xFF);
+
+  // Backup rotation: .tmp.sav becomes the .sav, older ones are shifted.
+  char buf[16];
+  for (unsigned i = 0; i < 4; i++) {
+    sprintf(buf, "save%u", i);
+    hostdisk_write_file("/saves/game.tmp.sav", buf, strlen(buf) + 1);
+    assert(rotate_savefile("/saves/game", 2));
+  }
+  assert(read_file("/saves/game.tmp.sav", rbuf, 16) == ~0U);
+  assert(read_file("/saves/game.sav", rbuf, 16) == 6 && !strcmp((char*)rbuf, "save3"));
+  assert(read_file("/saves/game.1.sav", rbuf, 16) == 6 && !strcmp((char*)rbuf, "save2"));
+  assert(read_file("/saves/game.2.sav", rbuf, 16) == 6 && !strcmp((char*)rbuf, "save1"));
+  assert(read_file("/saves/game.3.sav", rbuf, 16) == ~0U);
+
+  // DirectSave files are contiguous copies (padded with ones) or blank.
+  LBA_t lba = 0;
+  for (unsigned i = 0; i < 5000; i++)
+    wbuf[i] = i * 3;
+  hostdisk_write_file("/saves/short.sav", wbuf, 5000);
+  assert(copy_save_contiguous_file("/saves/short.sav", "/saves/ds/copy.sav", 64*1024));
+  assert(file_is_contiguous("/saves/ds/copy.sav", &lba) && lba);
+  assert(read_file("/saves/ds/copy.sav", rbuf, sizeof(rbuf)) == 64*1024);
+  assert(!memcmp(rbuf, wbuf, 5000));
+  for (unsigned i = 5000; i < 64*1024; i++)
+    assert(rbuf[i] == 0xFF);
+  assert(copy_save_contiguous_file(NULL, "/saves/ds/blank.sav", 32*1024));
+  assert(file_is_contiguous("/saves/ds/blank.sav", NULL));
+  assert(read_file("/saves/ds/blank.sav", rbuf, sizeof(rbuf)) == 32*1024);
+  assert(rbuf[0] == 0xFF && rbuf[32*1024 - 1] == 0xFF);
+}
+
+static void test_settings() {
+  // Global and UI settings round trip.
+  hotkey_combo = 3;
+  backup_sram_default = 4;
+  rtcvalue_default = 123456789;
+  patchgen_onload = 1;
+  hide_hidden = 1;
+  anim_speed = 2;
+  assert(save_settings() && save_ui_settings());
+  hotkey_combo = backup_sram_default = rtcvalue_default = patchgen_onload = 0;
+  hide_hidden = anim_speed = 0;
+  lang_id = 5;
+  load_settings();
+  assert(hotkey_combo == 3 && backup_sram_default == 4 && rtcvalue_default == 123456789);
+  assert(patchgen_onload == 1 && hide_hidden == 1 && anim_speed == 2 && lang_id == 0);
+
+  // Per ROM settings, keyed by the ROM file name.
+  t_rom_load_settings ld = { .patch_policy = 1, .use_igm = true, .use_rtc = false, .use_dsaving = true };
+  t_rom_launch_settings lh = { .use_cheats = true, .rtcts = 987654 };
+  assert(!load_rom_settings("/roms/gba/Some game.gba", &ld, &lh));
+  assert(save_rom_settings("/roms/gba/Some game.gba", &ld, &lh));
+  memset(&ld, 0, sizeof(ld));
+  memset(&lh, 0, sizeof(lh));
+  assert(load_rom_settings("/other/Some game.gba", &ld, &lh));
+  assert(ld.patch_policy == 1 && ld.use_igm && !ld.use_rtc && ld.use_dsaving);
+  assert(lh.use_cheats && lh.rtcts == 987654);
+}
+
+static void run_cases() {
+  test_bigfile();
+  test_directory();
+  test_patchcache();
+  test_savefiles();
+  test_settings();
+
+  // Mount it again, all files must be there.
+  hostdisk_remount();
+  FILINFO info;
+  assert(FR_OK == f_stat("/big.gba", &info) && info.fsize == BIGFILE_SIZE);
+  assert(check_file_exists("/roms/gba/Some long game name number 299.gba"));
+}
+
+// Walks a directory tree recursively, counting entries.
+static unsigned walk_tree(char *path) {
+  DIR d;
+  FILINFO info;
+  unsigned cnt = 0;
+  if (FR_OK != f_opendir(&d, path))
+    return 0;
+  while (FR_OK == f_readdir(&d, &info) && info.fname[0]) {
+    cnt++;
+    if (info.fattrib & AM_DIR) {
+      unsigned l = strlen(path);
+      if (l + strlen(info.fname) + 2 < FF_MAX_LFN) {
+        sprintf(&path[l], "/%s", info.fname);
+        cnt += walk_tree(path);
+        path[l] = 0;
+      }
+    }
+  }
+  f_closedir(&d);
+  return cnt;
+}
+
+int main(int argc, char **argv) {
+  const t_hostdisk_latency lat = HOSTDISK_LATENCY_SC;
+  hostdisk_set_latency(&lat);
+
+  if (argc > 1) {
+    if (!hostdisk_open(argv[1]) || FR_OK != f_mount(&fs, "0:", 1)) {
+      fprintf(stderr, "Could not mount %s\n", argv[1]);
+      return 1;
+    }
+    char path[FF_MAX_LFN] = "";
+    hostdisk_reset_stats();
+    printf("%u entries\n", walk_tree(path));
+    hostdisk_print_stats("Directory walk");
+    hostdisk_close();
+    return 0;
+  }
+
+  hostdisk_run_images(run_cases);
+
+  printf("All tests passed!\n");
+  return 0;
+}
+
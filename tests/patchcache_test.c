@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "patchengine.h"
+#include "fatfs/ff.h"
+
+// Minimal FatFs implementation, backed by host files (under a temp dir).
+static char rootdir[256];
+static struct {
+  FIL *fil;
+  FILE *fd;
+} openfiles[8];
+
+static void host_path(const char *path, char *out) {
+  sprintf(out, "%s%s", rootdir, path);
+}
+
+static FILE *host_fd(FIL *fp) {
+  for (unsigned i = 0; i < 8; i++)
+    if (openfiles[i].fil == fp)
+      return openfiles[i].fd;
+  assert(0);
+}
+
+FRESULT f_mkdir(const TCHAR* path) {
+  char tmp[512];
+  host_path(path, tmp);
+  mkdir(tmp, 0755);
+  return FR_OK;
+}
+
+FRESULT f_open(FIL* fp, const TCHAR* path, BYTE mode) {
+  char tmp[512];
+  host_path(path, tmp);
+  FILE *fd = fopen(tmp, "r+b");
+  if (!fd && (mode & FA_OPEN_ALWAYS))
+    fd = fopen(tmp, "w+b");
+  if (!fd)
+    return FR_NO_FILE;
+
+  for (unsigned i = 0; i < 8; i++) {
+    if (!openfiles[i].fil) {
+      openfiles[i].fil = fp;
+      openfiles[i].fd = fd;
+      fseek(fd, 0, SEEK_END);
+      fp->obj.objsize = ftell(fd);
+      fseek(fd, 0, SEEK_SET);
+      return FR_OK;
+    }
+  }
+  fclose(fd);
+  return FR_TOO_MANY_OPEN_FILES;
+}
+
+FRESULT f_close(FIL* fp) {
+  for (unsigned i = 0; i < 8; i++) {
+    if (openfiles[i].fil == fp) {
+      fclose(openfiles[i].fd);
+      openfiles[i].fil = NULL;
+      return FR_OK;
+    }
+  }
+  assert(0);
+}
+
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br) {
+  *br = fread(buff, 1, btr, host_fd(fp));
+  return FR_OK;
+}
+
+FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw) {
+  *bw = fwrite(buff, 1, btw, host_fd(fp));
+  return FR_OK;
+}
+
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs) {
+  // Like FatFs, seeking past the end (for writing) expands the file.
+  FILE *fd = host_fd(fp);
+  fseek(fd, 0, SEEK_END);
+  long size = ftell(fd);
+  while (size < (long)ofs) {
+    fputc(0xAA, fd);
+    size++;
+  }
+  fseek(fd, ofs, SEEK_SET);
+  return FR_OK;
+}
+
+#define ROM_SIZE    (64*1024)
+
+static void write_rom(const char *fn, unsigned seed) {
+  static uint8_t rom[ROM_SIZE];
+  srand(seed + 1000);    // (seeds 0 and 1 are equivalent)
+  for (unsigned i = 0; i < ROM_SIZE; i++)
+    rom[i] = rand();
+  char tmp[512];
+  host_path(fn, tmp);
+  FILE *fd = fopen(tmp, "wb");
+  fwrite(rom, 1, ROM_SIZE, fd);
+  fclose(fd);
+}
+
+static void make_patch(t_patch *p, unsigned seed) {
+  memset(p, 0, sizeof(*p));
+  p->wcnt_ops = 1 + seed % 32;
+  p->save_ops = seed % 3;
+  p->save_mode = seed % 5;
+  p->irqh_ops = seed % 7;
+  p->hole_addr = 0x100000 + (seed & 0xFF) * 1024;
+  p->hole_size = 0x10000;
+  for (unsigned i = 0; i < p->wcnt_ops + p->save_ops + p->irqh_ops; i++)
+    p->op[i] = seed * 7919 + i;
+  p->prgs[0].length = 4;
+  memcpy(p->prgs[0].data, &seed, 4);
+}
+
+static bool same_patch(const t_patch *a, const t_patch *b) {
+  return a->wcnt_ops == b->wcnt_ops && a->save_ops == b->save_ops &&
+         a->irqh_ops == b->irqh_ops && a->rtc_ops == b->rtc_ops &&
+         a->save_mode == b->save_mode &&
+         a->hole_addr == b->hole_addr && a->hole_size == b->hole_size &&
+         !memcmp(a->op, b->op, sizeof(a->op)) && !memcmp(a->prgs, b->prgs, sizeof(a->prgs));
+}
+
+int main() {
+  strcpy(rootdir, "/tmp/patchcache_test.XXXXXX");
+  assert(mkdtemp(rootdir));
+
+  t_patch p, q;
+  char fn[64];
+
+  // Nothing cached yet.
+  write_rom("/rom0.gba", 0);
+  assert(!load_cached_patches("/rom0.gba", &q));
+  assert(!load_cached_patches("/missing.gba", &q));
+
+  // Insert ROMs in random order, all of them must be found.
+  for (unsigned i = 0; i < 100; i++) {
+    unsigned n = (i * 37) % 100;
+    sprintf(fn, "/rom%u.gba", n);
+    write_rom(fn, n);
+    make_patch(&p, n);
+    assert(write_patches_cache(fn, &p));
+  }
+  for (unsigned i = 0; i < 100; i++) {
+    sprintf(fn, "/rom%u.gba", i);
+    make_patch(&p, i);
+    assert(load_cached_patches(fn, &q));
+    assert(same_patch(&p, &q));
+  }
+
+  // Renamed/copied ROMs are found by content.
+  write_rom("/renamed.gba", 42);
+  make_patch(&p, 42);
+  assert(load_cached_patches("/renamed.gba", &q));
+  assert(same_patch(&p, &q));
+
+  // Modified ROMs are not.
+  write_rom("/rom42.gba", 4242);
+  assert(!load_cached_patches("/rom42.gba", &q));
+
+  // Rewriting an entry replaces it.
+  make_patch(&p, 1000);
+  assert(write_patches_cache("/rom7.gba", &p));
+  assert(load_cached_patches("/rom7.gba", &q));
+  assert(same_patch(&p, &q));
+  make_patch(&p, 8);
+  assert(load_cached_patches("/rom8.gba", &q));
+  assert(same_patch(&p, &q));
+
+  // Corrupted records are rejected.
+  char tmp[512];
+  host_path(PATCH_CACHE_FILE, tmp);
+  FILE *fd = fopen(tmp, "r+b");
+  fseek(fd, -100, SEEK_END);
+  fputc(0x55, fd);
+  fclose(fd);
+  unsigned misses = 0;
+  for (unsigned i = 0; i < 100; i++) {
+    sprintf(fn, "/rom%u.gba", i);
+    misses += load_cached_patches(fn, &q) ? 0 : 1;
+  }
+  assert(misses == 2);       // The corrupted one and rom42
+
+  // Fill the cache: it starts over once full.
+  for (unsigned i = 100; i < PATCH_CACHE_MAXENT + 1; i++) {
+    sprintf(fn, "/rom%u.gba", i);
+    write_rom(fn, i);
+    make_patch(&p, i);
+    assert(write_patches_cache(fn, &p));
+  }
+  assert(!load_cached_patches("/rom0.gba", &q));
+  sprintf(fn, "/rom%u.gba", PATCH_CACHE_MAXENT);
+  make_patch(&p, PATCH_CACHE_MAXENT);
+  assert(load_cached_patches(fn, &q));
+  assert(same_patch(&p, &q));
+
+  char cmd[300];
+  sprintf(cmd, "rm -rf %s", rootdir);
+  assert(!system(cmd));
+
+  printf("All tests passed!\n");
+  return 0;
+}
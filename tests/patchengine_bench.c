@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+// Patch engine benchmark. Runs the engine over a corpus of ROM images (or a
+// synthetic corpus if none is given) and compares the cost of validating
+// WAITCNT/IRQ constants using the LDR target record against the old approach
+// (scanning backwards for an LDR instruction for every candidate found).
+// Both approaches must validate the exact same constants.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "patchengine.h"
+
+#define CHUNK_SIZE     (64*1024)
+#define ITERATIONS     8
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Legacy validation: look for an LDR [pc + off] pointing to `pos` (backwards)
+static bool backscan_ldrpc(const uint32_t *rom, unsigned pos) {
+  unsigned tstart = pos < 256 ? 0 : pos - 256;
+  for (unsigned i = tstart * 2; i < pos * 2; i++) {
+    uint16_t inst = (i & 1) ? (rom[i >> 1] >> 16) : (rom[i >> 1] & 0xFFFF);
+    if ((inst >> 11) == 0x09 && (i & ~1U) + (inst & 0xFF) * 2 + 2 == pos * 2)
+      return true;
+  }
+  unsigned astart = pos < 1024 ? 0 : pos - 1024;
+  for (unsigned i = astart; i < pos; i++) {
+    uint32_t inst = rom[i];
+    if (((inst >> 16) & 0xFFF) == 0x59F && !(inst & 3) && i + ((inst & 0xFFF) >> 2) + 2 == pos)
+      return true;
+  }
+  return false;
+}
+
+static unsigned backscan_validate(const uint32_t *rom, unsigned words, uint32_t *offs, unsigned *cands) {
+  unsigned cnt = 0;
+  *cands = 0;
+  for (unsigned i = 0; i < words; i++) {
+    if (rom[i] == 0x04000204 || rom[i] == 0x03007FFC) {
+      (*cands)++;
+      if (backscan_ldrpc(rom, i))
+        offs[cnt++] = i * 4;
+    }
+  }
+  return cnt;
+}
+
+static void run_engine(const uint32_t *rom, unsigned size, t_patch_builder *pb) {
+  static uint32_t oplog[4096];
+  patchengine_init(pb, size, oplog, sizeof(oplog) / sizeof(oplog[0]));
+  for (unsigned off = 0; off < size; off += CHUNK_SIZE)
+    patchengine_process_rom(&rom[off / 4], MIN(CHUNK_SIZE, size - off), pb, NULL);
+  patchengine_finalize(pb);
+}
+
+static int cmpu32(const void *a, const void *b) {
+  uint32_t va = *(uint32_t*)a, vb = *(uint32_t*)b;
+  return va < vb ? -1 : va > vb ? 1 : 0;
+}
+
+// Generates a ROM with plenty of literal pools, only a few of them referenced
+// (the engine can only hold a limited amount of patches). The filler data
+// cannot be decoded as PC-relative loads (bits 30, 26 and 14 are cleared).
+static uint32_t *gen_rom(unsigned size, unsigned density, unsigned seed) {
+  uint32_t *rom = malloc(size);
+  unsigned words = size / 4, refs = 0;
+  srand(seed);
+  for (unsigned i = 0; i < words; i++)
+    rom[i] = ((rand() << 1) ^ rand()) & ~0x44004000U;
+  for (unsigned i = 2048; i < words; i += density) {
+    rom[i] = (i & 1) ? 0x04000204 : 0x03007FFC;
+    if ((rand() % 64) == 0 && refs++ < 96) {
+      if (rand() & 1)
+        rom[i - 4] = 0xE59F0008;            // ldr r0, [pc, #8]
+      else
+        rom[i - 2] = 0x48014801;            // ldr r0, [pc, #4] (x2)
+    }
+  }
+  return rom;
+}
+
+static void bench_rom(const char *name, const uint32_t *rom, unsigned size) {
+  static t_patch_builder pb;
+  static uint32_t offs[1024*1024];
+  unsigned words = size / 4, cands = 0, vcnt = 0;
+
+  double t0 = now_ms();
+  for (unsigned i = 0; i < ITERATIONS; i++)
+    run_engine(rom, size, &pb);
+  double t1 = now_ms();
+  for (unsigned i = 0; i < ITERATIONS; i++)
+    vcnt = backscan_validate(rom, words, offs, &cands);
+  double t2 = now_ms();
+
+  // Cross check: the engine ops must match the back-scan results.
+  unsigned ecnt = pb.p.wcnt_ops + pb.p.irqh_ops;
+  uint32_t eoffs[MAX_PATCH_OPS];
+  for (unsigned i = 0; i < pb.p.wcnt_ops; i++)
+    eoffs[i] = pb.p.op[i] & 0x1FFFFFF;
+  for (unsigned i = 0; i < pb.p.irqh_ops; i++)
+    eoffs[pb.p.wcnt_ops + i] = pb.p.op[pb.p.wcnt_ops + pb.p.save_ops + i] & 0x1FFFFFF;
+  qsort(eoffs, ecnt, sizeof(uint32_t), cmpu32);
+  if (ecnt != vcnt || memcmp(eoffs, offs, ecnt * sizeof(uint32_t)))
+    printf("%s: WARNING engine and back-scan results differ!\n", name);
+
+  double eng = (t1 - t0) / ITERATIONS, bsc = (t2 - t1) / ITERATIONS;
+  printf("%-24s %6u KiB %7u cands %4u valid | engine %8.2f ms (%7.1f MiB/s) | "
+         "back-scan validation alone %8.2f ms (%.1fx the engine)\n",
+         name, size / 1024, cands, vcnt, eng, size / 1048576.0 / (eng / 1000.0), bsc, bsc / eng);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      FILE *fd = fopen(argv[i], "rb");
+      if (!fd) {
+        printf("Could not open file %s\n", argv[i]);
+        return 1;
+      }
+      struct stat st;
+      stat(argv[i], &st);
+      unsigned size = st.st_size & ~3U;
+      uint32_t *rom = malloc(size + 4);
+      if (fread(rom, 1, size, fd) != size) {
+        printf("Could not read file %s\n", argv[i]);
+        return 1;
+      }
+      fclose(fd);
+      bench_rom(argv[i], rom, size);
+      free(rom);
+    }
+  }
+  else {
+    // Synthetic corpus, with a increasing literal pool density.
+    const unsigned densities[] = {4096, 1024, 256, 64, 16};
+    for (unsigned i = 0; i < sizeof(densities)/sizeof(densities[0]); i++) {
+      char name[32];
+      unsigned size = 8*1024*1024;
+      uint32_t *rom = gen_rom(size, densities[i], i);
+      sprintf(name, "synthetic-1/%u", densities[i]);
+      bench_rom(name, rom, size);
+      free(rom);
+    }
+  }
+
+  return 0;
+}
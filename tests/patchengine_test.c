@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common.h"
+#include "patchengine.h"
+
+#define ROM_WORDS     (256*1024)     // 1MiB synthetic ROM
+
+static uint32_t rom[ROM_WORDS];
+static uint32_t oplog[4096];
+
+static void dummy(unsigned p) {}
+
+// Places a literal pool word and a Thumb LDR (from `dist` words before) to it.
+static void plant_thumb(unsigned pos, unsigned dist, uint32_t value) {
+  unsigned ldrhw = (pos - dist) * 2 + 1;    // Odd half-word, to test alignment
+  unsigned imm8 = (pos * 2 - (ldrhw & ~1U) - 2) / 2;
+  uint16_t *rom16 = (uint16_t*)rom;
+  assert(imm8 < 256);
+  rom16[ldrhw] = 0x4800 | imm8;      // ldr r0, [pc, #imm8*4]
+  rom[pos] = value;
+}
+
+// Same for ARM LDR instructions.
+static void plant_arm(unsigned pos, unsigned dist, uint32_t value) {
+  unsigned ldrpos = pos - dist;
+  unsigned imm12 = (pos - ldrpos - 2) * 4;
+  assert(imm12 < 4096);
+  rom[ldrpos] = 0xE59F0000 | imm12;  // ldr r0, [pc, #imm12]
+  rom[pos] = value;
+}
+
+static void gen_rom() {
+  srand(1234);
+  for (unsigned i = 0; i < ROM_WORDS; i++)
+    rom[i] = (rand() << 1) ^ rand();
+
+  // Place a bunch of valid references, at varying (large) distances.
+  for (unsigned i = 0; i < 64; i++) {
+    unsigned pos = 2048 + i * 3001;
+    if (i & 1)
+      plant_arm(pos, 2 + (i * 97) % 1000, i & 2 ? 0x04000204 : 0x03007FFC);
+    else
+      plant_thumb(pos, 2 + (i * 31) % 250, i & 2 ? 0x04000204 : 0x03007FFC);
+  }
+  // Unreferenced constants should not be patched.
+  rom[ROM_WORDS - 3000] = 0x04000204;
+  rom[ROM_WORDS - 2000] = 0x03007FFC;
+
+  // Save type strings, spanning odd offsets.
+  rom[ROM_WORDS / 2 - 1] = 0x52504545;    // "EEPR"
+  rom[ROM_WORDS / 2 + 0] = 0x565F4D4F;    // "OM_V"
+  rom[ROM_WORDS - 2] = 0x52494953;        // "SIIR"
+  rom[ROM_WORDS - 1] = 0x565f4354;        // "TC_V"
+
+  // Long run of identical data at the end (hole detection)
+  for (unsigned i = ROM_WORDS - 40000; i < ROM_WORDS - 4000; i++)
+    rom[i] = 0xFFFFFFFF;
+}
+
+static void run_chunked(t_patch_builder *pb, unsigned chunk, bool variable) {
+  patchengine_init(pb, sizeof(rom), oplog, sizeof(oplog) / sizeof(oplog[0]));
+  unsigned off = 0, n = 0;
+  while (off < ROM_WORDS) {
+    unsigned cnt = variable ? 1 + ((n++ * 7919) % chunk) : chunk;
+    if (cnt > ROM_WORDS - off)
+      cnt = ROM_WORDS - off;
+    patchengine_process_rom(&rom[off], cnt * 4, pb, dummy);
+    off += cnt;
+  }
+  patchengine_finalize(pb);
+}
+
+static bool same_patch(const t_patch *a, const t_patch *b) {
+  return a->wcnt_ops == b->wcnt_ops && a->save_ops == b->save_ops &&
+         a->irqh_ops == b->irqh_ops && a->rtc_ops == b->rtc_ops &&
+         a->save_mode == b->save_mode &&
+         a->hole_addr == b->hole_addr && a->hole_size == b->hole_size &&
+         !memcmp(a->op, b->op, sizeof(a->op));
+}
+
+int main() {
+  gen_rom();
+
+  // Reference run, single buffer.
+  static t_patch_builder ref, pb;
+  run_chunked(&ref, ROM_WORDS, false);
+
+  assert(ref.p.wcnt_ops == 32);
+  assert(ref.p.irqh_ops == 32);
+  assert(ref.p.save_mode == SaveTypeEEPROM64K);
+  for (unsigned i = 0; i < ref.p.wcnt_ops + ref.p.irqh_ops; i++) {
+    unsigned off = ref.p.op[i] & 0x1FFFFFF;
+    assert(off < sizeof(rom) && (off % 4) == 0);
+    assert(rom[off / 4] == 0x04000204 || rom[off / 4] == 0x03007FFC);
+  }
+
+  // Any chunking must produce the exact same result.
+  const unsigned chunks[] = {1, 3, 16, 31, 32, 33, 100, 1024, 1025, 2048, 65536};
+  for (unsigned i = 0; i < sizeof(chunks)/sizeof(chunks[0]); i++) {
+    run_chunked(&pb, chunks[i], false);
+    assert(same_patch(&ref.p, &pb.p));
+    run_chunked(&pb, chunks[i], true);
+    assert(same_patch(&ref.p, &pb.p));
+  }
+
+  printf("All tests passed!\n");
+  return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common.h"
+#include "patchengine.h"
+
+// Fake patch routines (with some recognizable content).
+#define DEF_FN(name, sz)                   \
+  uint16_t name[64];                       \
+  const uint32_t name##_size = (sz);
+
+DEF_FN(patch_rtc_probe, 20)
+DEF_FN(patch_rtc_reset, 34)
+DEF_FN(patch_rtc_getstatus, 50)
+DEF_FN(patch_rtc_gettimedate, 120)
+DEF_FN(patch_eeprom_read_sram64k, 60)
+DEF_FN(patch_eeprom_write_sram64k, 62)
+DEF_FN(patch_eeprom_read_directsave, 40)
+DEF_FN(patch_eeprom_write_directsave, 42)
+DEF_FN(patch_flash_read_sram64k, 36)
+DEF_FN(patch_flash_erase_device_sram64k, 24)
+DEF_FN(patch_flash_erase_sector_sram64k, 28)
+DEF_FN(patch_flash_write_sector_sram64k, 44)
+DEF_FN(patch_flash_write_byte_sram64k, 22)
+DEF_FN(patch_flash_read_sram128k, 38)
+DEF_FN(patch_flash_erase_device_sram128k, 26)
+DEF_FN(patch_flash_erase_sector_sram128k, 30)
+DEF_FN(patch_flash_write_sector_sram128k, 46)
+DEF_FN(patch_flash_write_byte_sram128k, 24)
+DEF_FN(patch_flash_read_directsave, 32)
+DEF_FN(patch_flash_erase_device_directsave, 20)
+DEF_FN(patch_flash_erase_sector_directsave, 20)
+DEF_FN(patch_flash_write_sector_directsave, 32)
+DEF_FN(patch_flash_write_byte_directsave, 18)
+
+static uint16_t *const allfns[] = {
+  patch_rtc_probe, patch_rtc_reset, patch_rtc_getstatus, patch_rtc_gettimedate,
+  patch_eeprom_read_sram64k, patch_eeprom_write_sram64k, patch_eeprom_read_directsave,
+  patch_eeprom_write_directsave, patch_flash_read_sram64k, patch_flash_erase_device_sram64k,
+  patch_flash_erase_sector_sram64k, patch_flash_write_sector_sram64k, patch_flash_write_byte_sram64k,
+  patch_flash_read_sram128k, patch_flash_erase_device_sram128k, patch_flash_erase_sector_sram128k,
+  patch_flash_write_sector_sram128k, patch_flash_write_byte_sram128k, patch_flash_read_directsave,
+  patch_flash_erase_device_directsave, patch_flash_erase_sector_directsave,
+  patch_flash_write_sector_directsave, patch_flash_write_byte_directsave,
+};
+
+#define ROM_SIZE      (128*1024)
+
+static uint8_t rom[ROM_SIZE], ref[ROM_SIZE], out[ROM_SIZE];
+
+// Reference implementation: applies ops in order, byte by byte.
+static void ref_write(uint32_t off, const void *data, unsigned size) {
+  for (unsigned i = 0; i < size; i++)
+    if (off + i < ROM_SIZE)
+      ref[off + i] = ((uint8_t*)data)[i];
+}
+
+static void ref_func(uint32_t off, const uint16_t *fn, uint32_t fnsz, uint32_t dsaddr) {
+  ref_write(off, fn, fnsz);
+  ref_write(off + fnsz, &dsaddr, 4);
+}
+
+static void ref_apply_ops(const uint32_t *ops, unsigned cnt, const t_patch *p, bool ds) {
+  const uint32_t dsaddr = ds ? 0x09FE0000 : 0;
+  for (unsigned i = 0; i < cnt; i++) {
+    uint32_t opc = ops[i] >> 28, arg = (ops[i] >> 25) & 7, moff = ops[i] & 0x1FFFFFF;
+    uint32_t tmp[2];
+    switch (opc) {
+    case 0: ref_write(moff, p->prgs[arg].data, p->prgs[arg].length); break;
+    case 1: tmp[0] = 0x46C0; ref_write(moff, tmp, 2); break;
+    case 2: tmp[0] = 0xE1A00000; ref_write(moff, tmp, 4); break;
+    case 3: ref_write(moff, &ops[i + 1], arg + 1); i += (arg + 4) / 4; break;
+    case 4: ref_write(moff, &ops[i + 1], (arg + 1) * 4); i += arg + 1; break;
+    case 5:
+      if (arg < 2) {
+        tmp[0] = arg ? 0x47702001 : 0x47702000;
+        ref_write(moff, tmp, 4);
+      } else if (arg >= 4 && arg <= 5) {
+        tmp[0] = arg == 5 ? 0xe3a00001 : 0xe3a00000;
+        tmp[1] = 0xe12fff1e;
+        ref_write(moff, tmp, 8);
+      }
+      break;
+    case 7: {
+      const uint16_t *f[] = { patch_rtc_probe, patch_rtc_reset, patch_rtc_getstatus, patch_rtc_gettimedate };
+      const uint32_t s[] = { patch_rtc_probe_size, patch_rtc_reset_size, patch_rtc_getstatus_size, patch_rtc_gettimedate_size };
+      if (arg < 4)
+        ref_write(moff, f[arg], s[arg]);
+      break; }
+    case 8:
+      if (arg == 0)
+        ref_func(moff, ds ? patch_eeprom_read_directsave : patch_eeprom_read_sram64k,
+                 ds ? patch_eeprom_read_directsave_size : patch_eeprom_read_sram64k_size, dsaddr);
+      break;
+    case 9:
+      if (arg == 3)
+        ref_func(moff, ds ? patch_flash_write_sector_directsave : patch_flash_write_sector_sram64k,
+                 ds ? patch_flash_write_sector_directsave_size : patch_flash_write_sector_sram64k_size, dsaddr);
+      break;
+    };
+  }
+}
+
+// Generates a random patch set, with ops clustered so that some overlap.
+static void gen_patch(t_patch *p, unsigned seed) {
+  srand(seed);
+  memset(p, 0, sizeof(*p));
+  for (unsigned i = 0; i < MAX_PATCH_PRG; i++) {
+    p->prgs[i].length = 1 + rand() % 20;
+    for (unsigned j = 0; j < p->prgs[i].length; j++)
+      p->prgs[i].data[j] = rand();
+  }
+
+  unsigned n = 0;
+  uint32_t cluster = 0;
+  unsigned counts[4] = {0};
+  for (unsigned g = 0; g < 4; g++) {
+    unsigned target = rand() % 24;
+    while (counts[g] < target && n < MAX_PATCH_OPS - 10) {
+      if (!(rand() % 4))
+        cluster = (rand() % (ROM_SIZE - 1024)) & ~1U;
+      uint32_t moff = cluster + (rand() % 64);
+      unsigned start = n;
+      switch (rand() % 9) {
+      case 0: p->op[n++] = (0 << 28) | ((rand() % 4) << 25) | moff; break;
+      case 1: p->op[n++] = (1 << 28) | (moff & ~1U); break;
+      case 2: p->op[n++] = (2 << 28) | (moff & ~3U); break;
+      case 3: {
+        unsigned arg = rand() % 8;
+        p->op[n++] = (3 << 28) | (arg << 25) | moff;
+        for (unsigned j = 0; j < (arg + 4) / 4; j++)
+          p->op[n++] = rand() ^ ((uint32_t)rand() << 16);
+        break; }
+      case 4: {
+        unsigned arg = rand() % 4;
+        p->op[n++] = (4 << 28) | (arg << 25) | (moff & ~3U);
+        for (unsigned j = 0; j <= arg; j++)
+          p->op[n++] = rand() ^ ((uint32_t)rand() << 16);
+        break; }
+      case 5: p->op[n++] = (5 << 28) | ((rand() % 6) << 25) | (moff & ~1U); break;
+      case 6: p->op[n++] = (7 << 28) | ((rand() % 4) << 25) | (moff & ~1U); break;
+      case 7: p->op[n++] = (8U << 28) | (0 << 25) | (moff & ~1U); break;
+      case 8: p->op[n++] = (9U << 28) | (3 << 25) | (moff & ~1U); break;
+      };
+      counts[g] += n - start;
+    }
+  }
+  p->wcnt_ops = counts[0];
+  p->save_ops = counts[1];
+  p->irqh_ops = counts[2];
+  p->rtc_ops = counts[3];
+}
+
+static void check_patch(const t_patch *p, bool wcnt, bool rtc, bool igm, bool ds) {
+  static t_patch_wlist wl;
+  memcpy(ref, rom, ROM_SIZE);
+  const uint32_t *ops = p->op;
+  if (wcnt)
+    ref_apply_ops(ops, p->wcnt_ops, p, ds);
+  ops += p->wcnt_ops;
+  ref_apply_ops(ops, p->save_ops, p, ds);
+  ops += p->save_ops;
+  if (igm)
+    ref_apply_ops(ops, p->irqh_ops, p, ds);
+  ops += p->irqh_ops;
+  if (rtc)
+    ref_apply_ops(ops, p->rtc_ops, p, ds);
+  if (igm) {
+    uint32_t brop = 0xEA000000 | ((0x09F00000 - GBA_ROM_BASE - 8) >> 2);
+    uint32_t baddr = ((*(uint32_t*)ref & 0xFFFFFF) << 2) + 8 + GBA_ROM_BASE;
+    memcpy(&ref[0], &brop, 4);
+    memcpy(&ref[0xB8], &baddr, 4);
+  }
+
+  assert(patch_compile(&wl, p, wcnt, rtc, igm ? 0x09F00000 : 0, ds ? 0x09FE0000 : 0));
+  for (unsigned i = 1; i < wl.count; i++)
+    assert(wl.w[i - 1].offset + wl.w[i - 1].size <= wl.w[i].offset);
+
+  // Any chunking (and chunk order) must produce the same result. The header
+  // detour (in-game menu) requires the first chunk to contain the header.
+  const unsigned chunks[] = {4, 64, 508, 512, 4096, ROM_SIZE};
+  for (unsigned c = igm ? 3 : 0; c < sizeof(chunks)/sizeof(chunks[0]); c++) {
+    memcpy(out, rom, ROM_SIZE);
+    for (unsigned off = 0; off < ROM_SIZE; off += chunks[c])
+      patch_apply_wlist(&wl, &out[off], MIN(chunks[c], ROM_SIZE - off), off);
+    assert(!memcmp(out, ref, ROM_SIZE));
+
+    memcpy(out, rom, ROM_SIZE);
+    for (int off = ROUND_UP(ROM_SIZE, chunks[c]) - chunks[c]; off >= 0; off -= chunks[c])
+      patch_apply_wlist(&wl, &out[off], MIN(chunks[c], ROM_SIZE - off), off);
+    assert(!memcmp(out, ref, ROM_SIZE));
+  }
+}
+
+// Patch DB validation: entries must be fully contained in the image.
+static void check_validate() {
+  static uint32_t db[1024];
+  const unsigned entw = (1024 + 512) / 4;
+  memset(db, 0, sizeof(db));
+  db[0] = 0x31424450;         // Signature
+  db[1] = 0x00010000;         // Version (unsorted)
+  db[2] = 1;                  // Patch count
+  db[3] = 1;                  // Index blocks
+  memcpy(&db[1024 / 4], "ABCD", 4);
+  db[1024 / 4 + 1] = 1 << 8;  // Entry at word 1
+  db[entw + 1] = 2 | (1 << 28);   // Two WC ops and the hole word
+
+  const unsigned dbsize = (entw + 5) * 4;
+  assert(patchmem_validate((uint8_t*)db, dbsize));
+  assert(!patchmem_validate((uint8_t*)db, dbsize - 4));   // No room for the hole
+  db[entw + 1] = 3;
+  assert(patchmem_validate((uint8_t*)db, dbsize));
+  db[entw + 1] = 4;
+  assert(!patchmem_validate((uint8_t*)db, dbsize));       // Ops past the end
+  db[entw + 1] = 2;
+
+  // Huge index block counts must not wrap around.
+  db[3] = 0x00800001;
+  assert(!patchmem_validate((uint8_t*)db, dbsize));
+  db[3] = 1;
+  db[1024 / 4 + 1] = 0xFFFFFF00;
+  assert(!patchmem_validate((uint8_t*)db, dbsize));
+}
+
+int main() {
+  for (unsigned i = 0; i < sizeof(allfns)/sizeof(allfns[0]); i++)
+    for (unsigned j = 0; j < 64; j++)
+      allfns[i][j] = (i << 8) | j | 0x8000;
+  for (unsigned i = 0; i < ROM_SIZE; i++)
+    rom[i] = i * 7;
+
+  for (unsigned i = 0; i < 400; i++) {
+    t_patch p;
+    gen_patch(&p, i);
+    check_patch(&p, i & 1, i & 2, i & 4, i & 8);
+  }
+
+  // Payloads are also copied partially, to any chunk they overlap with.
+  static uint8_t payload[1000];
+  for (unsigned i = 0; i < sizeof(payload); i++)
+    payload[i] = i ^ 0x5A;
+  memcpy(ref, rom, ROM_SIZE);
+  memcpy(&ref[4094], payload, sizeof(payload));
+  memcpy(out, rom, ROM_SIZE);
+  for (unsigned off = 0; off < ROM_SIZE; off += 512)
+    payload_apply_rom(&out[off], 512, off, payload, sizeof(payload), 4094);
+  assert(!memcmp(out, ref, ROM_SIZE));
+
+  check_validate();
+
+  printf("All tests passed!\n");
+  return 0;
+}
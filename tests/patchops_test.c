@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+// Stresses the patch builder with (way) more ops than a patch set can hold.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common.h"
+#include "patchengine.h"
+
+#define ROM_WORDS     (1024*1024)    // 4MiB synthetic ROM
+#define WCNT_SITES    6000
+#define IRQH_SITES    48
+
+static uint32_t rom[ROM_WORDS];
+static uint32_t wcntpos[WCNT_SITES], irqhpos[IRQH_SITES];
+
+// Places a literal pool word and an ARM LDR (a few words before) to it.
+static void plant_arm(unsigned pos, uint32_t value) {
+  rom[pos - 4] = 0xE59F0008;         // ldr r0, [pc, #8]
+  rom[pos] = value;
+}
+
+// Filler data cannot be decoded as PC-relative loads (bits 30, 26 and 14 are cleared).
+static void gen_rom() {
+  srand(4321);
+  for (unsigned i = 0; i < ROM_WORDS; i++)
+    rom[i] = ((rand() << 1) ^ rand()) & ~0x44004000U;
+
+  // IRQ handler sites are interleaved with the WAITCNT ones.
+  unsigned w = 0, q = 0;
+  for (unsigned i = 0; i < WCNT_SITES + IRQH_SITES; i++) {
+    unsigned pos = 1024 + i * 160;
+    if (q < IRQH_SITES && (i % 120) == 119) {
+      plant_arm(pos, 0x03007FFC);
+      irqhpos[q++] = pos * 4;
+    } else {
+      plant_arm(pos, 0x04000204);
+      wcntpos[w++] = pos * 4;
+    }
+  }
+  assert(w == WCNT_SITES && q == IRQH_SITES);
+}
+
+static void run_engine(t_patch_builder *pb, uint32_t *oplog, unsigned logsize) {
+  patchengine_init(pb, sizeof(rom), oplog, logsize);
+  for (unsigned off = 0; off < ROM_WORDS; off += 16*1024)
+    patchengine_process_rom(&rom[off], 64*1024, pb, NULL);
+  patchengine_finalize(pb);
+}
+
+// Ops are grouped by type, in ROM order. Only the tail of WAITCNT ops is dropped.
+static void check_patch(const t_patch *p, unsigned wcnt) {
+  assert(p->wcnt_ops == wcnt);
+  assert(p->irqh_ops == IRQH_SITES);
+  assert(p->save_ops == 0 && p->rtc_ops == 0);
+  for (unsigned i = 0; i < p->wcnt_ops; i++)
+    assert(p->op[i] == wcntpos[i]);
+  for (unsigned i = 0; i < p->irqh_ops; i++)
+    assert(p->op[p->wcnt_ops + p->save_ops + i] == (irqhpos[i] | (1 << 25)));
+  for (unsigned i = p->wcnt_ops + p->irqh_ops; i < MAX_PATCH_OPS; i++)
+    assert(p->op[i] == 0);
+}
+
+int main() {
+  gen_rom();
+
+  // Big op log: all ops are logged, WAITCNT ops are dropped to fit the rest.
+  static t_patch_builder pb;
+  static uint32_t biglog[64*1024];
+  run_engine(&pb, biglog, sizeof(biglog) / sizeof(biglog[0]));
+  assert(pb.opcnt == WCNT_SITES + IRQH_SITES);
+  check_patch(&pb.p, MAX_PATCH_OPS - IRQH_SITES);
+
+  // Small op log: it fills up with WAITCNT ops, but there is still room for others.
+  static uint32_t smalllog[256];
+  run_engine(&pb, smalllog, sizeof(smalllog) / sizeof(smalllog[0]));
+  // (one IRQ op was logged before the log filled up)
+  assert(pb.opcnt == 256 - PE_OPLOG_RESERVED - 1 + IRQH_SITES);
+  check_patch(&pb.p, 256 - PE_OPLOG_RESERVED - 1);
+
+  // Serialization round trip, only the used ops are stored.
+  run_engine(&pb, biglog, sizeof(biglog) / sizeof(biglog[0]));
+  static uint8_t buf[MAX_PATCH_SERIALIZED];
+  int sz = serialize_patch(&pb.p, buf);
+  assert(sz == MAX_PATCH_SERIALIZED);
+  t_patch q;
+  memset(&q, 0xFF, sizeof(q));
+  assert(unserialize_patch(buf, sz, &q));
+  assert(!memcmp(&q.op, &pb.p.op, sizeof(q.op)) && !memcmp(&q.prgs, &pb.p.prgs, sizeof(q.prgs)));
+  check_patch(&q, MAX_PATCH_OPS - IRQH_SITES);
+  assert(!unserialize_patch(buf, sz - 1, &q));
+
+  // Fewer ops, smaller buffer.
+  pb.p.wcnt_ops = 10;
+  sz = serialize_patch(&pb.p, buf);
+  assert(sz == 32 + sizeof(pb.p.prgs) + (10 + IRQH_SITES) * 4);
+  assert(unserialize_patch(buf, sz, &q));
+  assert(q.wcnt_ops == 10 && q.irqh_ops == IRQH_SITES && q.op[9] == wcntpos[9]);
+
+  // Old (V01) patch files can still be loaded.
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, "SUPERFWPATCHV01", 16);
+  buf[16] = 2;                              // WAITCNT ops
+  buf[19] = 1;                              // IRQ ops
+  buf[25] = 0x40;                           // Hole at 16MB (in KiB)
+  uint32_t v1ops[3] = { 0x100, 0x200, 0x2000300 };
+  memcpy(&buf[32 + 4 * 64], v1ops, sizeof(v1ops));
+  assert(unserialize_patch(buf, 800, &q));
+  assert(q.wcnt_ops == 2 && q.irqh_ops == 1 && q.save_ops == 0 && q.rtc_ops == 0);
+  assert(q.hole_addr == 16*1024*1024 && !memcmp(q.op, v1ops, sizeof(v1ops)));
+  assert(!unserialize_patch(buf, 799, &q));
+
+  printf("All tests passed!\n");
+  return 0;
+}
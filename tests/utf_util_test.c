@@ -52,6 +52,9 @@ int main() {
   sortable_utf8_u16("F", out);
   assert(out[0] == 'f' && out[1] == 0);
 
+  sortable_utf8_u16("AZ", out);
+  assert(out[0] == 'a' && out[1] == 'z' && out[2] == 0);
+
   const char *tst[] = {"Á", "á", "À", "à", "Ä", "ä", "Â", "â", "Ã", "ã", "Ā", "Ă", "ā"};
   for (unsigned i = 0; i < sizeof(tst)/sizeof(tst[0]); i++) {
     sortable_utf8_u16(tst[i], out);
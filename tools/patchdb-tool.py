@@ -0,0 +1,135 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+# Copyright 2025 David Guillen Fandos <david@davidgf.net>
+
+# Patch database (PTDB) tool. Validates existing databases and (re)builds them
+# with a sorted index, so that the firmware can binary search game entries.
+# Several input databases can be merged, later inputs override earlier ones.
+
+import sys, argparse, struct
+
+PTDB_SIGNATURE = 0x31424450
+PTDB_VERSION_LINEAR = 0x00010000
+PTDB_VERSION_SORTED = 0x00010001
+
+PRGS_OFFSET = 512
+IDX_OFFSET = 1024
+IDX_BLKSIZE = 512
+
+parser = argparse.ArgumentParser(prog='patchdb-tool')
+sub = parser.add_subparsers(dest='cmd', required=True)
+vp = sub.add_parser('validate', help='Check a database structure and its index ordering')
+vp.add_argument('dbfile', help='Patch database file')
+vp.add_argument('--strict', action='store_true', help='Require the sorted-index format version')
+bp = sub.add_parser('build', help='Build a sorted database out of one or more databases')
+bp.add_argument('dbfiles', nargs='+', help='Input patch databases (later ones take precedence)')
+bp.add_argument('--output', dest='out', required=True, help='Output database file')
+bp.add_argument('--version', dest='version', help='DB version string (8 chars max)')
+bp.add_argument('--date', dest='date', help='DB date string (8 chars max)')
+bp.add_argument('--creator', dest='creator', help='DB creator string (32 chars max)')
+args = parser.parse_args()
+
+def entry_words(hdr):
+  # Entry header word followed by the ops and the optional hole word.
+  numops = (hdr & 0xFF) + ((hdr >> 8) & 0x1F) + ((hdr >> 16) & 0xFF) + ((hdr >> 24) & 0x0F)
+  return 1 + numops + ((hdr >> 28) & 1)
+
+def parse_db(fn):
+  data = open(fn, "rb").read()
+  if len(data) < IDX_OFFSET:
+    raise ValueError("%s: file too small" % fn)
+  sig, ver, pcnt, icnt = struct.unpack("<IIII", data[:16])
+  if sig != PTDB_SIGNATURE or ver not in (PTDB_VERSION_LINEAR, PTDB_VERSION_SORTED):
+    raise ValueError("%s: bad signature or version" % fn)
+  if pcnt > icnt * (IDX_BLKSIZE // 8):
+    raise ValueError("%s: index blocks too small for %d entries" % (fn, pcnt))
+
+  entoff = IDX_OFFSET + IDX_BLKSIZE * icnt
+  entries = []
+  for i in range(pcnt):
+    key = data[IDX_OFFSET + i*8: IDX_OFFSET + i*8 + 5]
+    off, = struct.unpack("<I", data[IDX_OFFSET + i*8 + 4: IDX_OFFSET + i*8 + 8])
+    p = entoff + (off >> 8) * 4
+    if p + 4 > len(data):
+      raise ValueError("%s: entry %d points outside the file" % (fn, i))
+    hdr, = struct.unpack("<I", data[p:p+4])
+    size = entry_words(hdr) * 4
+    if p + size > len(data):
+      raise ValueError("%s: entry %d is truncated" % (fn, i))
+    entries.append((key, data[p:p+size]))
+
+  return {
+    "version": ver,
+    "meta": data[16:64],
+    "prgs": data[PRGS_OFFSET:IDX_OFFSET],
+    "entries": entries,
+  }
+
+def check_order(entries):
+  # Returns the first position that breaks the strict ordering (or None)
+  for i in range(1, len(entries)):
+    if entries[i-1][0] >= entries[i][0]:
+      return i
+  return None
+
+def strfield(s, size):
+  s = s.encode("ascii")
+  if len(s) > size:
+    raise ValueError("String field too long: %s" % s)
+  return s + b"\x00" * (size - len(s))
+
+if args.cmd == "validate":
+  try:
+    db = parse_db(args.dbfile)
+  except ValueError as e:
+    print(e)
+    sys.exit(1)
+  pos = check_order(db["entries"])
+  if pos is not None:
+    k0, k1 = db["entries"][pos-1][0], db["entries"][pos][0]
+    print("Index not sorted at entry %d (%s v%d >= %s v%d)" % (
+          pos, k0[:4].decode("ascii", "replace"), k0[4], k1[:4].decode("ascii", "replace"), k1[4]))
+    sys.exit(1)
+  if args.strict and db["version"] != PTDB_VERSION_SORTED:
+    print("Index is sorted but the DB is not tagged as such")
+    sys.exit(1)
+  print("OK: %d entries" % len(db["entries"]))
+
+elif args.cmd == "build":
+  dbs = [parse_db(fn) for fn in args.dbfiles]
+  for db in dbs[1:]:
+    if db["prgs"] != dbs[0]["prgs"]:
+      print("Program blocks differ between databases, cannot merge")
+      sys.exit(1)
+
+  # Merge all entries, later databases replace existing games.
+  merged = {}
+  for db in dbs:
+    for key, edata in db["entries"]:
+      merged[key] = edata
+
+  meta = dbs[-1]["meta"]
+  date = strfield(args.date, 8) if args.date else meta[0:8]
+  version = strfield(args.version, 8) if args.version else meta[8:16]
+  creator = strfield(args.creator, 32) if args.creator else meta[16:48]
+
+  # Deduplicate identical entries, since many games share the same patches.
+  keys = sorted(merged.keys())
+  idxblks = (len(keys) + (IDX_BLKSIZE // 8) - 1) // (IDX_BLKSIZE // 8)
+  index, entdata, entoffs = b"", b"", {}
+  for k in keys:
+    edata = merged[k]
+    if edata not in entoffs:
+      entoffs[edata] = len(entdata) // 4
+      entdata += edata
+    index += k + struct.pack("<I", entoffs[edata] << 8)[1:]
+
+  index += b"\x00" * (idxblks * IDX_BLKSIZE - len(index))
+  hdr = struct.pack("<IIII", PTDB_SIGNATURE, PTDB_VERSION_SORTED, len(keys), idxblks)
+  hdr += date + version + creator
+  hdr += b"\x00" * (PRGS_OFFSET - len(hdr))
+
+  entdata += b"\x00" * ((IDX_BLKSIZE - len(entdata) % IDX_BLKSIZE) % IDX_BLKSIZE)
+  open(args.out, "wb").write(hdr + dbs[0]["prgs"] + index + entdata)
+  print("Wrote %d entries (%d unique patches)" % (len(keys), len(entoffs)))
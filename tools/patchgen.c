@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2025 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "patchengine.h"
+
+// Batch patch generator. Walks directories looking for GBA ROMs, runs the
+// patch engine on them (using a pool of threads) and writes .patch files
+// (next to the ROMs, or in an output directory) and/or a patch database.
+
+#define CHUNK_SIZE        (4*1024*1024)
+#define OPLOG_SIZE        (256*1024)
+
+#define PTDB_SIGNATURE    0x31424450
+#define PTDB_VERSION      0x00010001     // Sorted index
+#define PTDB_PRGS_OFFSET  512
+#define PTDB_IDX_OFFSET   1024
+#define PTDB_IDX_BLKSIZE  512
+
+typedef struct {
+  char *fn;
+  uint32_t size;
+  uint8_t gcode[5];        // Game code and version
+  bool ok;
+  double scan_ms;
+  t_patch p;
+} t_job;
+
+static t_job *jobs = NULL;
+static unsigned jobcnt = 0, jobcap = 0;
+static unsigned nextjob = 0;
+static pthread_mutex_t joblock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void add_job(const char *fn) {
+  if (jobcnt == jobcap) {
+    jobcap = jobcap ? jobcap * 2 : 256;
+    jobs = realloc(jobs, jobcap * sizeof(t_job));
+  }
+  memset(&jobs[jobcnt], 0, sizeof(t_job));
+  jobs[jobcnt++].fn = strdup(fn);
+}
+
+static bool is_gba_rom(const char *fn) {
+  const char *ext = strrchr(fn, '.');
+  return ext && !strcasecmp(ext, ".gba");
+}
+
+static void walk_dir(const char *path) {
+  struct stat st;
+  if (stat(path, &st))
+    return;
+  if (!S_ISDIR(st.st_mode)) {
+    add_job(path);
+    return;
+  }
+
+  DIR *d = opendir(path);
+  if (!d)
+    return;
+  struct dirent *e;
+  while ((e = readdir(d))) {
+    if (e->d_name[0] == '.')
+      continue;
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s/%s", path, e->d_name);
+    if (!stat(tmp, &st) && (S_ISDIR(st.st_mode) || is_gba_rom(tmp)))
+      walk_dir(tmp);
+  }
+  closedir(d);
+}
+
+static int jobcmp(const void *a, const void *b) {
+  return strcmp(((t_job*)a)->fn, ((t_job*)b)->fn);
+}
+
+// Reads the ROM in chunks and feeds them to the engine (only scan time is accounted).
+static void process_rom(t_job *job, t_patch_builder *pb, uint32_t *oplog, uint32_t *buf) {
+  FILE *fd = fopen(job->fn, "rb");
+  if (!fd)
+    return;
+
+  struct stat st;
+  fstat(fileno(fd), &st);
+  if (st.st_size < 192 || st.st_size > MAX_GBA_ROM_SIZE) {
+    fclose(fd);
+    return;
+  }
+
+  job->size = st.st_size;
+  patchengine_init(pb, job->size, oplog, OPLOG_SIZE);
+  for (unsigned off = 0; off < job->size; ) {
+    unsigned rd = fread(buf, 1, CHUNK_SIZE, fd);
+    if (!rd)
+      break;
+    if (!off) {
+      const uint8_t *h = (uint8_t*)buf;
+      memcpy(job->gcode, &h[0xAC], 4);
+      job->gcode[4] = h[0xBC];
+    }
+
+    double t0 = now_ms();
+    patchengine_process_rom(buf, rd, pb, NULL);
+    job->scan_ms += now_ms() - t0;
+    off += rd;
+  }
+  double t0 = now_ms();
+  patchengine_finalize(pb);
+  job->scan_ms += now_ms() - t0;
+  fclose(fd);
+
+  job->p = pb->p;
+  job->ok = true;
+}
+
+static void *worker(void *arg) {
+  t_patch_builder *pb = malloc(sizeof(t_patch_builder));
+  uint32_t *oplog = malloc(OPLOG_SIZE * sizeof(uint32_t));
+  uint32_t *buf = malloc(CHUNK_SIZE);
+
+  while (true) {
+    pthread_mutex_lock(&joblock);
+    unsigned n = nextjob++;
+    pthread_mutex_unlock(&joblock);
+    if (n >= jobcnt)
+      break;
+
+    process_rom(&jobs[n], pb, oplog, buf);
+  }
+
+  free(buf);
+  free(oplog);
+  free(pb);
+  return NULL;
+}
+
+static bool write_patch_file(const t_job *job, const char *outdir) {
+  char fn[4096];
+  if (outdir) {
+    const char *bn = strrchr(job->fn, '/');
+    snprintf(fn, sizeof(fn), "%s/%s", outdir, bn ? bn + 1 : job->fn);
+  } else
+    snprintf(fn, sizeof(fn), "%s", job->fn);
+  char *ext = strrchr(fn, '.');
+  if (ext && !strchr(ext, '/'))
+    *ext = 0;
+  strncat(fn, ".patch", sizeof(fn) - strlen(fn) - 1);
+
+  uint8_t tmp[MAX_PATCH_SERIALIZED];
+  int sz = serialize_patch(&job->p, tmp);
+
+  FILE *fd = fopen(fn, "wb");
+  if (!fd)
+    return false;
+  bool ok = fwrite(tmp, 1, sz, fd) == sz;
+  fclose(fd);
+  return ok;
+}
+
+static int gcodecmp(const void *a, const void *b) {
+  return memcmp((*(t_job**)a)->gcode, (*(t_job**)b)->gcode, 5);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+// Writes a PTDB database (sorted index) with all the generated patch sets.
+static bool write_database(const char *dbfn) {
+  t_job **sorted = malloc(jobcnt * sizeof(t_job*));
+  unsigned cnt = 0;
+  for (unsigned i = 0; i < jobcnt; i++) {
+    const t_patch *p = &jobs[i].p;
+    if (!jobs[i].ok)
+      continue;
+    // The DB entry header has narrower op counters.
+    if (p->wcnt_ops > 0xFF || p->save_ops > 0x1F || p->irqh_ops > 0xFF || p->rtc_ops > 0x0F) {
+      fprintf(stderr, "%s: too many ops for a DB entry, skipped\n", jobs[i].fn);
+      continue;
+    }
+    sorted[cnt++] = &jobs[i];
+  }
+  qsort(sorted, cnt, sizeof(t_job*), gcodecmp);
+
+  // Drop duplicated game codes (first one wins).
+  unsigned ucnt = 0;
+  for (unsigned i = 0; i < cnt; i++) {
+    if (ucnt && !memcmp(sorted[ucnt-1]->gcode, sorted[i]->gcode, 5))
+      fprintf(stderr, "%s: duplicated game code, skipped\n", sorted[i]->fn);
+    else
+      sorted[ucnt++] = sorted[i];
+  }
+
+  const unsigned idxent = PTDB_IDX_BLKSIZE / 8;
+  const unsigned idxcnt = (ucnt + idxent - 1) / idxent;
+  const unsigned entoff = PTDB_IDX_OFFSET + idxcnt * PTDB_IDX_BLKSIZE;
+  unsigned maxsize = entoff + ucnt * (MAX_PATCH_OPS + 2) * 4 + PTDB_IDX_BLKSIZE;
+  uint8_t *db = calloc(1, maxsize);
+
+  put32(&db[0], PTDB_SIGNATURE);
+  put32(&db[4], PTDB_VERSION);
+  put32(&db[8], ucnt);
+  put32(&db[12], idxcnt);
+  time_t t = time(NULL);
+  strftime((char*)&db[16], 9, "%Y%m%d", gmtime(&t));
+  memcpy(&db[24], "patchgen", 8);
+  memcpy(&db[32], "superfw-patchgen", 16);
+
+  // Program block (the engine emits the same programs for every ROM).
+  if (ucnt) {
+    unsigned off = PTDB_PRGS_OFFSET;
+    for (unsigned i = 0; i < MAX_PATCH_PRG; i++) {
+      const t_patch_prog *prg = &sorted[0]->p.prgs[i];
+      if (!prg->length)
+        break;
+      db[off++] = prg->length;
+      memcpy(&db[off], prg->data, prg->length);
+      off += prg->length;
+    }
+  }
+
+  unsigned wpos = 0;
+  for (unsigned i = 0; i < ucnt; i++) {
+    const t_patch *p = &sorted[i]->p;
+    uint8_t *ie = &db[PTDB_IDX_OFFSET + i * 8];
+    memcpy(ie, sorted[i]->gcode, 4);
+    put32(&ie[4], sorted[i]->gcode[4] | (wpos << 8));
+
+    bool hole = p->hole_size != 0;
+    unsigned numops = p->wcnt_ops + p->save_ops + p->irqh_ops + p->rtc_ops;
+    uint32_t hdr = p->wcnt_ops | (p->save_ops << 8) | ((p->save_mode & 7) << 13) |
+                   (p->irqh_ops << 16) | (p->rtc_ops << 24) | (hole ? (1 << 28) : 0);
+    uint8_t *e = &db[entoff + wpos * 4];
+    put32(e, hdr);
+    for (unsigned j = 0; j < numops; j++)
+      put32(&e[4 + j * 4], p->op[j]);
+    if (hole)
+      put32(&e[4 + numops * 4], ((p->hole_addr >> 10) << 16) | (p->hole_size >> 10));
+    wpos += 1 + numops + (hole ? 1 : 0);
+  }
+
+  unsigned total = ROUND_UP2(entoff + wpos * 4, PTDB_IDX_BLKSIZE);
+  FILE *fd = fopen(dbfn, "wb");
+  bool ok = fd && fwrite(db, 1, total, fd) == total;
+  if (fd)
+    fclose(fd);
+
+  printf("Database %s: %u entries, %u bytes\n", dbfn, ucnt, total);
+  free(db);
+  free(sorted);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  unsigned nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  const char *outdir = NULL, *dbfn = NULL;
+  bool nopatches = false, quiet = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "j:o:d:nq")) != -1) {
+    switch (opt) {
+    case 'j': nthreads = atoi(optarg); break;
+    case 'o': outdir = optarg; break;
+    case 'd': dbfn = optarg; break;
+    case 'n': nopatches = true; break;
+    case 'q': quiet = true; break;
+    default:
+      optind = argc;
+      break;
+    };
+  }
+  if (optind >= argc) {
+    printf("Usage: %s [-j threads] [-o outdir] [-d patches.db] [-n] [-q] romdir/romfile ...\n", argv[0]);
+    printf("  -j  Number of threads (defaults to the number of CPUs)\n");
+    printf("  -o  Write .patch files to this directory (instead of next to the ROMs)\n");
+    printf("  -d  Write a patch database with all the generated patches\n");
+    printf("  -n  Do not write .patch files (ie. just benchmark or build a DB)\n");
+    printf("  -q  Do not print per-ROM stats\n");
+    exit(1);
+  }
+  if (!nthreads)
+    nthreads = 1;
+
+  for (int i = optind; i < argc; i++)
+    walk_dir(argv[i]);
+  qsort(jobs, jobcnt, sizeof(t_job), jobcmp);
+
+  double t0 = now_ms();
+  pthread_t *thds = malloc(nthreads * sizeof(pthread_t));
+  for (unsigned i = 0; i < nthreads; i++)
+    pthread_create(&thds[i], NULL, worker, NULL);
+  for (unsigned i = 0; i < nthreads; i++)
+    pthread_join(thds[i], NULL);
+  double wall = now_ms() - t0;
+  free(thds);
+
+  uint64_t totbytes = 0;
+  double totscan = 0;
+  unsigned okcnt = 0, errcnt = 0;
+  for (unsigned i = 0; i < jobcnt; i++) {
+    const t_job *job = &jobs[i];
+    if (!job->ok) {
+      fprintf(stderr, "%s: could not read ROM\n", job->fn);
+      errcnt++;
+      continue;
+    }
+    if (!nopatches && !write_patch_file(job, outdir)) {
+      fprintf(stderr, "%s: could not write patch file\n", job->fn);
+      errcnt++;
+    }
+    okcnt++;
+    totbytes += job->size;
+    totscan += job->scan_ms;
+    char gc[5];
+    for (unsigned j = 0; j < 4; j++)
+      gc[j] = job->gcode[j] >= 0x20 && job->gcode[j] < 0x7F ? job->gcode[j] : '?';
+    gc[4] = 0;
+    if (!quiet)
+      printf("%-48s %s-%02x %6u KiB  wcnt %3u save %2u irq %3u rtc %2u  %8.2f ms %8.1f MiB/s\n",
+             job->fn, gc, job->gcode[4],
+             job->size / 1024, job->p.wcnt_ops, job->p.save_ops, job->p.irqh_ops, job->p.rtc_ops,
+             job->scan_ms, job->size / 1048576.0 / (job->scan_ms / 1000.0));
+  }
+
+  if (dbfn && !write_database(dbfn))
+    errcnt++;
+
+  printf("Processed %u ROMs (%.1f MiB) using %u threads in %.2f s\n",
+         okcnt, totbytes / 1048576.0, nthreads, wall / 1000.0);
+  printf("Scan throughput: %.1f MiB/s per thread, %.1f MiB/s aggregate (wall time, including I/O)\n",
+         totbytes / 1048576.0 / (totscan / 1000.0), totbytes / 1048576.0 / (wall / 1000.0));
+
+  return errcnt ? 1 : 0;
+}
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# Copyright 2025 David Guillen Fandos <david@davidgf.net>
+
+# Generates the patch engine dispatch table. Collects the first word of every
+# save/RTC function signature (save_signatures.h) and the fixed patterns the
+# scanner looks for (*_WORD0 and *_VALUE defines in patchengine.c), and builds
+# a perfect hash table so that each ROM word costs a single table probe.
+
+import sys, re, random
+
+if len(sys.argv) != 3:
+  print("Usage: %s save_signatures.h patchengine.c" % sys.argv[0])
+  sys.exit(1)
+
+keys = []
+sigsrc = open(sys.argv[1]).read()
+for name, value in re.findall(r"const\s+uint32_t\s+(\w+_word0)\s*=\s*(0x[0-9a-fA-F]+)\s*;", sigsrc):
+  keys.append((name.upper(), int(value, 16)))
+pesrc = open(sys.argv[2]).read()
+for name, value in re.findall(r"^#define\s+(\w+_(?:WORD0|VALUE|VALUE_EXACT))\s+(0x[0-9a-fA-F]+)", pesrc, re.M):
+  keys.append((name, int(value, 16)))
+
+# Words must be unique, otherwise dispatching is ambiguous.
+assert len(set(k[1] for k in keys)) == len(keys), "Duplicated dispatch words"
+assert all(k[1] != 0 for k in keys), "Zero is reserved for empty slots"
+
+def hashw(w, mult, bits):
+  return ((w * mult) & 0xFFFFFFFF) >> (32 - bits)
+
+# Find a multiplier that places all words in distinct slots (deterministic).
+rng = random.Random(0x5f3759df)
+bits = max(4, (2 * len(keys) - 1).bit_length())
+while True:
+  for _ in range(100000):
+    mult = rng.getrandbits(32) | 1
+    if len(set(hashw(w, mult, bits) for _, w in keys)) == len(keys):
+      break
+  else:
+    bits += 1
+    continue
+  break
+
+size = 1 << bits
+slots = [(0, "PE_SIG_NONE")] * size
+for name, w in keys:
+  slots[hashw(w, mult, bits)] = (w, "PE_SIG_" + name)
+
+print("// Generated by tools/sigtable-gen.py, do not edit!")
+print("")
+print("#define %-41s %d" % ("PE_SIG_NONE", 0))
+for i, (name, w) in enumerate(keys):
+  print("#define %-41s %d" % ("PE_SIG_" + name, i + 1))
+print("")
+print("#define PE_SIG_HASH(w)   (((uint32_t)(w) * 0x%08xU) >> %d)" % (mult, 32 - bits))
+print("")
+print("static const uint32_t pe_sig_keys[%d] = {" % size)
+for w, _ in slots:
+  print("  0x%08x," % w)
+print("};")
+print("static const uint8_t pe_sig_ids[%d] = {" % size)
+for _, name in slots:
+  print("  %s," % name)
+print("};")